@@ -16,6 +16,17 @@ extern "C" {
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <xmmintrin.h>
+#endif
 
 // Define this to use 32-bit offsets instead of pointers for symbol tables.
 // useful on 64-bit systems to roughly halve memory cost.
@@ -29,31 +40,152 @@ extern "C" {
 // #define _SYMTREE_BLOCK_SIZE 1
 
 
+// Define this to use adaptive-width nodes.
+// Subtrees start out with room for 4 children and grow into 16-wide, 48-wide and full-width nodes as needed,
+// shrinking again as children are removed. Greatly reduces memory cost for sparse trees.
+// #define _SYMTREE_ADAPTIVE_NODES
+
+// Define this to accept any byte in keys, such as '.', '/', ':' and the bytes of utf-8 sequences. (implies _SYMTREE_ADAPTIVE_NODES)
+// Each byte is its own key number, so full-width nodes have 256 subtree slots, but most nodes stay 4 or 16 wide.
+// Keys containing zero bytes must be passed with their length. Cannot be combined with a custom alphabet.
+// #define _SYMTREE_BINARY_KEYS
+
+// Define this to keep the rest of sparse keys in compact containers instead of chains of subtrees. (burst trie, implies _SYMTREE_ADAPTIVE_NODES)
+// A container holds the suffixes of up to _SYMTREE_BURST_THRESHOLD keys in a sorted packed run, and bursts into a node with a container per character when it overflows.
+// Cannot be combined with _SYMTREE_PATH_COMPRESSION, _SYMTREE_USE_PAGED_NODES, _SYMTREE_CONCURRENT, _SYMTREE_COPY_ON_WRITE or _SYMTREE_WEIGHTS.
+// #define _SYMTREE_BURST_CONTAINERS
+// #define _SYMTREE_BURST_THRESHOLD 32
+
+// Define this to compress chains of single-child subtrees into labeled edges. (radix tree)
+// Each subtree stores the key characters following the one used to reach it, up to _SYMTREE_MAX_LABEL_LEN of them.
+// #define _SYMTREE_PATH_COMPRESSION
+
+// Define this to allocate each tree's nodes from its own contiguous arena instead of using _malloc/_free.
+// Freed nodes are kept on per-tree free lists, and free_symtree releases the whole arena at once.
+// Since all nodes of a tree lie within _SYMTREE_ARENA_RESERVE bytes, 32-bit offsets are always safe with the default reservation.
+// #define _SYMTREE_USE_ARENA
+// Define this to request transparent huge pages for arenas. (Linux only)
+// #define _SYMTREE_ARENA_HUGEPAGES
+
+// Define this along with _SYMTREE_USE_INT16_OFFSETS to store nodes in fixed-size pages of the tree's arena. (implies _SYMTREE_USE_ARENA)
+// Subtree references within a page are 16-bit block numbers, and references to other pages go through the page's escape table.
+// New subtrees are placed in the same page as their parent when possible.
+// #define _SYMTREE_USE_PAGED_NODES
+// #define _SYMTREE_PAGE_SIZE 65536
+
+// Define this to enable binary snapshots, which are written with save_symtree_snapshot and served straight from a memory-mapped file with find_sym_snapshot.
+// #define _SYMTREE_SNAPSHOTS
+// Number of bytes of a value that snapshots copy, by default those of a C string and its null terminator.
+// Redefine this if VALUE_TYPE points to something other than a C string. find_sym_snapshot returns a pointer to the copy, 8-byte aligned.
+// #define _SYMTREE_SNAPSHOT_VALUE_SIZE(value) (strlen(value) + 1)
+
+// Define this to enable parallel bulk loading with new_syms_parallel and load_symtree_parallel.
+// Keys are grouped by their first character, and the subtree of each group is built on its own thread.
+// Requires pthreads on systems other than Windows, and _malloc/_free must be thread-safe.
+// #define _SYMTREE_PARALLEL
+
+// Define this to let any number of threads look up symbols while one thread at a time modifies the tree.
+// Readers register with symtree_register_reader and bracket their lookups with symtree_read_begin/symtree_read_end, without locks or atomic read-modify-writes.
+// Nodes and values removed by the writer are freed once every reader that could still see them has left its read section.
+// Cannot be combined with 16-bit offsets, and 32-bit offsets require _SYMTREE_USE_ARENA.
+// Without adaptive nodes and path compression, new_sym_atomic also lets any number of threads add symbols at once.
+// #define _SYMTREE_CONCURRENT
+
+// Number of lookups find_sym_batch keeps in flight at once.
+// Each lookup prefetches its next node while the others are being advanced, hiding the latency of cache misses.
+// #define _SYMTREE_BATCH_WIDTH 16
+
+// Number of tree levels a symtree_iter_t can walk before it allocates memory for its stack and key buffer.
+// #define _SYMTREE_ITER_DEPTH 32
+
+// Define this to make clone_symtree take constant time, with the clone sharing every subtree of the original.
+// Nodes are reference counted, and new_sym, set_sym and del_sym copy the shared nodes on the path they modify.
+// Cannot be combined with _SYMTREE_USE_ARENA or _SYMTREE_CONCURRENT.
+// #define _SYMTREE_COPY_ON_WRITE
+
+// Define this to give keys a weight, set with new_sym_weighted, and find the heaviest keys under a prefix with symtree_complete_topk.
+// Every node keeps the largest weight within its subtree, which new_sym_weighted, set_sym and del_sym keep up to date.
+// #define _SYMTREE_WEIGHTS
+
+// Define this to give each tree a value store, which symtree_intern copies values into so that equal values share storage.
+// Values are bumped into blocks owned by the tree, each after its length, and append_symtree interns every value it loads.
+// The store's bytes are counted once as a whole, rather than once per key.
+// #define _SYMTREE_INTERN_VALUES
+// Bytes in the first pool of a value store, and slots in the first table. Both double as they fill up.
+// #define _SYMTREE_INTERN_POOL_SIZE 4096
+// #define _SYMTREE_INTERN_TABLE_SIZE 64
+
+// Number of tree levels symtree_stats reports separately. Deeper levels are added to the last one.
+// #define _SYMTREE_STATS_DEPTH 64
+
+// Define this to count operations, nodes visited, misses, invalid characters and node allocations per thread, and time a sample of operations.
+// Counters are summed up with symtree_metrics, and timed operations are passed to hooks registered with symtree_add_trace_hook.
+// #define _SYMTREE_INSTRUMENT
+// #define _SYMTREE_LATENCY_SAMPLE 64
+
 // Define this to enable json pretty-printing
 #define _SYMTREE_DUMP_PRETTY_JSON
 
 // File header and footer for json dump files
 #ifdef _SYMTREE_DUMP_PRETTY_JSON
-const char *symtree_file_header = "{";
-const char *symtree_file_footer = "\n}";
+static const char *symtree_file_header = "{";
+static const char *symtree_file_footer = "\n}";
 #else
-const char *symtree_file_header = "{";
-const char *symtree_file_footer = "}";
+static const char *symtree_file_header = "{";
+static const char *symtree_file_footer = "}";
 #endif
 
 // Key string to treat as the root node for json loading/unloading
-const char *symtree_root_node_key = "<root>";
+static const char *symtree_root_node_key = "<root>";
+
+#ifdef _SYMTREE_BINARY_KEYS
+#if defined(_PARSE_SYM_NAME_CHAR) || defined(_UNPARSE_SYM_NAME_CHAR) || defined(_SYMTREE_NUM_CHARS)
+#error "_SYMTREE_BINARY_KEYS cannot be combined with a custom alphabet"
+#endif
+#ifndef _SYMTREE_ADAPTIVE_NODES
+#define _SYMTREE_ADAPTIVE_NODES
+#endif
+// Every byte is a valid key character, and is its own key number.
+#define _PARSE_SYM_NAME_CHAR(c) ((uint8_t)(c))
+#define _UNPARSE_SYM_NAME_CHAR(c) ((char)(c))
+#define _SYMTREE_NUM_CHARS 256
+#endif
+
+#ifdef _SYMTREE_BURST_CONTAINERS
+#if defined(_SYMTREE_PATH_COMPRESSION) || defined(_SYMTREE_USE_PAGED_NODES) || defined(_SYMTREE_CONCURRENT) || defined(_SYMTREE_COPY_ON_WRITE) || defined(_SYMTREE_WEIGHTS)
+#error "_SYMTREE_BURST_CONTAINERS cannot be combined with _SYMTREE_PATH_COMPRESSION, _SYMTREE_USE_PAGED_NODES, _SYMTREE_CONCURRENT, _SYMTREE_COPY_ON_WRITE or _SYMTREE_WEIGHTS"
+#endif
+#ifndef _SYMTREE_ADAPTIVE_NODES
+#define _SYMTREE_ADAPTIVE_NODES
+#endif
+// Number of keys a container holds before it bursts.
+#ifndef _SYMTREE_BURST_THRESHOLD
+#define _SYMTREE_BURST_THRESHOLD 32
+#endif
+#endif
+
+#ifdef _SYMTREE_INTERN_VALUES
+#ifndef _SYMTREE_INTERN_POOL_SIZE
+#define _SYMTREE_INTERN_POOL_SIZE 4096
+#endif
+// must be a power of two
+#ifndef _SYMTREE_INTERN_TABLE_SIZE
+#define _SYMTREE_INTERN_TABLE_SIZE 64
+#endif
+#endif
 
 // Convert character to dictionary key number
 #ifndef _PARSE_SYM_NAME_CHAR
-const uint8_t symtree_parse_sym_name_char_tbl[256] = {255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 255, 255, 255, 255, 255, 255, 255, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 255, 255, 255, 255, 62, 255, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+static const uint8_t symtree_parse_sym_name_char_tbl[256] = {255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 255, 255, 255, 255, 255, 255, 255, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 255, 255, 255, 255, 62, 255, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255};
 #define _PARSE_SYM_NAME_CHAR(c) symtree_parse_sym_name_char_tbl[c]
 #define _PARSE_SYM_NAME_CHAR_INVALID 255
+// the default alphabet is made of a few ranges, which _symtree_parse_key converts 16 or 32 characters at a time
+#define _SYMTREE_DEFAULT_ALPHABET
 #endif
 
 // Convert dictionary key number to character
 #ifndef _UNPARSE_SYM_NAME_CHAR
-const char symtree_unparse_sym_name_char_tbl[256] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_\xff";
+static const char symtree_unparse_sym_name_char_tbl[256] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_\xff";
 #define _UNPARSE_SYM_NAME_CHAR(c) symtree_unparse_sym_name_char_tbl[c]
 #define _UNPARSE_SYM_NAME_CHAR_INVALID 0xff
 #endif
@@ -63,26 +195,93 @@ const char symtree_unparse_sym_name_char_tbl[256] = "ABCDEFGHIJKLMNOPQRSTUVWXYZa
 #define _SYMTREE_NUM_CHARS 63
 #endif
 
+#ifndef _SYMTREE_BATCH_WIDTH
+#define _SYMTREE_BATCH_WIDTH 16
+#endif
+
+// Hint to the processor that memory at p is about to be read.
+#if defined(__GNUC__) || defined(__clang__)
+#define _SYMTREE_PREFETCH(p) __builtin_prefetch((const void*)(p), 0, 3)
+#elif defined(_MSC_VER)
+#define _SYMTREE_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define _SYMTREE_PREFETCH(p) ((void)(p))
+#endif
+
+// Evaluates true if a converted character is not a valid dictionary key number.
+// Works with custom _PARSE_SYM_NAME_CHAR definitions returning either 255 or -1 for invalid characters.
+#define _SYMTREE_INVALID_CHAR(c) ((unsigned)(c) >= _SYMTREE_NUM_CHARS)
+
 // Dictionary value type
 #ifndef VALUE_TYPE
 #define VALUE_TYPE char*
 #endif
 
 
-// Symbol tree and subtree structure
-typedef struct _symtree {
-	VALUE_TYPE leaf;
+// Subtree reference type
 #ifdef _SYMTREE_USE_INT32_OFFSETS
-	int32_t symbols[_SYMTREE_NUM_CHARS];
+typedef int32_t symtree_ref_t;
 #else
 #ifdef _SYMTREE_USE_INT16_OFFSETS
-	int16_t symbols[_SYMTREE_NUM_CHARS];
+typedef int16_t symtree_ref_t;
 #else
-	void *symbols[_SYMTREE_NUM_CHARS];
+typedef void *symtree_ref_t;
+#endif
+#endif
+
+// Symbol tree and subtree structure
+// In adaptive node mode only full-width nodes have _SYMTREE_NUM_CHARS subtree slots.
+// Smaller nodes are allocated with fewer slots, followed by their key number table.
+typedef struct _symtree {
+	VALUE_TYPE leaf;
+#ifdef _SYMTREE_COPY_ON_WRITE
+	// number of nodes (in any tree) referencing this one
+	uint32_t refs;
+#endif
+#ifdef _SYMTREE_WEIGHTS
+	// weight of the node's own value, and the largest weight of any value in its subtree (including its own)
+	uint32_t weight;
+	uint32_t maxweight;
 #endif
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	uint8_t kind;
+	uint16_t count;
 #endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+	uint16_t labellen;
+#endif
+	symtree_ref_t symbols[_SYMTREE_NUM_CHARS];
 } symtree_t;
 
+// Field of a node's header, accessed on its own since nodes other than full-width ones are allocated smaller than symtree_t.
+#define _SYMTREE_NODE_FIELD(t,type,field) (*(type*)((uint8_t*)(t) + offsetof(symtree_t, field)))
+
+#ifdef _SYMTREE_USE_PAGED_NODES
+#ifndef _SYMTREE_USE_INT16_OFFSETS
+#error "_SYMTREE_USE_PAGED_NODES requires _SYMTREE_USE_INT16_OFFSETS"
+#endif
+#ifndef _SYMTREE_USE_ARENA
+#define _SYMTREE_USE_ARENA
+#endif
+// Size of each page in bytes. Must be a power of two.
+#ifndef _SYMTREE_PAGE_SIZE
+#define _SYMTREE_PAGE_SIZE 65536
+#endif
+// Size of each block in bytes. Must be a power of two of at least 8.
+#ifndef _SYMTREE_BLOCK_SIZE
+#define _SYMTREE_BLOCK_SIZE 8
+#endif
+#if _SYMTREE_PAGE_SIZE / _SYMTREE_BLOCK_SIZE > 32767
+#error "_SYMTREE_PAGE_SIZE / _SYMTREE_BLOCK_SIZE must be at most 32767"
+#endif
+// Labels have to fit within a page.
+#ifndef _SYMTREE_MAX_LABEL_LEN
+#define _SYMTREE_MAX_LABEL_LEN 1024
+#endif
+#define _READ_SYMBOL_TREE(t,c) _symtree_page_read((t), (t)->symbols[c])
+#define _WRITE_SYMBOL_TREE(t,c,v) _symtree_page_write((t), &(t)->symbols[c], (v))
+#endif
+
 // Defines how to read a subtree from a symbol tree.
 #ifndef _READ_SYMBOL_TREE
 #ifdef _SYMTREE_USE_INT32_OFFSETS
@@ -130,520 +329,6104 @@ typedef struct _symtree {
 #define _free free
 #endif
 
-// Allocate a symbol tree.
-// @returns Created and zeroed symbol tree. Returns NULL if failed to allocate memory.
-static symtree_t *alloc_symtree(void);
+#ifdef _SYMTREE_USE_ARENA
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
-// Clone a symbol tree recursively.
-// @param tree Symbol tree to clone.
-// @returns Cloned symbol tree. Returns NULL if failed to allocate memory.
-// NOTE: NOT YET IMPLEMENTED.
-static symtree_t *clone_symtree(symtree_t *tree);
+// Bytes of address space reserved for each tree's arena.
+// Keep this at or below 2 gigabytes to guarantee 32-bit offsets never overflow.
+#ifndef _SYMTREE_ARENA_RESERVE
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define _SYMTREE_ARENA_RESERVE ((size_t)1 << 31)
+#else
+#define _SYMTREE_ARENA_RESERVE ((size_t)1 << 28)
+#endif
+#endif
 
-// Locate a symbol and return its value.
-// @param tree Symbol tree to search.
-// @param name Dictionary key to search for.
-// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
-// @returns Symbol value.
-static VALUE_TYPE find_sym(symtree_t *tree, const char *name, size_t namelen);
+// Bytes of the arena committed at a time.
+#ifndef _SYMTREE_ARENA_CHUNK_SIZE
+#define _SYMTREE_ARENA_CHUNK_SIZE ((size_t)1 << 21)
+#endif
 
-// Locate a symbol and return a pointer to its value.
-// @param tree Symbol tree to search.
-// @param name Dictionary key to search for.
-// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
-// @returns Pointer to symbol value.
-static VALUE_TYPE *find_sym_addr(symtree_t *tree, const char *name, size_t namelen);
+// Arena allocations are rounded up to a multiple of this many bytes.
+#ifndef _SYMTREE_ARENA_ALIGN
+#ifdef _SYMTREE_USE_PAGED_NODES
+#define _SYMTREE_ARENA_ALIGN _SYMTREE_BLOCK_SIZE
+#else
+#define _SYMTREE_ARENA_ALIGN 8
+#endif
+#endif
 
+// Alignment of the start of each arena.
+#ifdef _SYMTREE_USE_PAGED_NODES
+#define _SYMTREE_ARENA_BASE_ALIGN _SYMTREE_PAGE_SIZE
+#else
+#define _SYMTREE_ARENA_BASE_ALIGN 1
+#endif
 
-// Add a key to a symbol tree (if it doesn't exist) and assign a value.
-// @param tree Symbol tree to add to.
-// @param name Name of dictionary key.
-// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
-// @param value Value to set the symbol to.
-// @returns Value the symbol was set to, or NULL if failed.
-static VALUE_TYPE new_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+// Number of exact-size free lists, indexed by size in units of _SYMTREE_ARENA_ALIGN.
+// Larger freed blocks share a single list.
+#define _SYMTREE_ARENA_FREE_LISTS 256
+#endif
 
-// Assign a value to a key in a symbol tree.
-// @param tree Symbol tree to modify.
-// @param name Name of dictionary key.
-// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
-// @param value Value to set the symbol to.
-// @returns Value the symbol was set to, or NULL if failed. (eg. the key doesn't exist)
-static VALUE_TYPE set_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+#ifdef _SYMTREE_PARALLEL
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
-// Remove a key from a symbol tree.
-// @param tree Symbol tree to remove from.
-// @param name Name of dictionary key.
-// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
-// @param free_value Whether or not to free the value. Note: this uses free() not _free().
-// @returns True if successfuly deleted the key, False if failed. (eg. the key doesn't exist)
-static bool del_sym(symtree_t *tree, const char *name, size_t namelen, bool free_value);
+// Bytes of a tree's arena handed to a bulk loading thread at a time.
+#ifndef _SYMTREE_PARALLEL_CHUNK_SIZE
+#define _SYMTREE_PARALLEL_CHUNK_SIZE ((size_t)1 << 18)
+#endif
+#endif
 
-// Get the size of a symbol tree with or without including the lengths of value strings.
-// @param tree Symbol tree to get the size of.
-// @param include_value_strings Whether to include value strings in the size calculation.
-// @returns Size of the symbol tree in bytes.
-static size_t symtree_size(symtree_t *tree, bool include_value_strings);
+#ifdef _SYMTREE_CONCURRENT
+#ifdef _SYMTREE_USE_INT16_OFFSETS
+#error "_SYMTREE_CONCURRENT cannot be combined with _SYMTREE_USE_INT16_OFFSETS"
+#endif
+#if defined(_SYMTREE_USE_INT32_OFFSETS) && !defined(_SYMTREE_USE_ARENA)
+// a reference that turns out to be out of range would be visible to readers before it is rolled back
+#error "_SYMTREE_CONCURRENT with _SYMTREE_USE_INT32_OFFSETS requires _SYMTREE_USE_ARENA"
+#endif
 
-// Dump a symbol tree to a semi-readable text format into a buffer for debugging the tree structure.
-// @param tree Symbol tree to dump.
-// @param buffer Buffer to dump text into.
-// @param bufferlen Length of the buffer to dump text into.
-// @param len Pointer to length of dumped text.
-// @returns True if success, False if the buffer isn't large enough.
-static bool debug_dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len);
+// Encode and decode subtree references as values, for slots that have to be loaded once or swapped atomically.
+#ifdef _SYMTREE_USE_INT32_OFFSETS
+#define _SYMTREE_ENCODE_REF(t,v) ((symtree_ref_t)((uint8_t*)(v) - (uint8_t*)(t)))
+#define _SYMTREE_DECODE_REF(t,r) ((symtree_t*)((uint8_t*)(t) + (r)))
+#else
+#define _SYMTREE_ENCODE_REF(t,v) ((symtree_ref_t)(v))
+#define _SYMTREE_DECODE_REF(t,r) ((symtree_t*)(r))
+#endif
 
-// Dump a symbol tree to a buffer in json format
-// @param tree Symbol tree to dump.
-// @param buffer Buffer to dump data into.
-// @param bufferlen Length of the buffer to dump text into.
-// @param len Pointer to length of dumped data.
-// @returns True if success, False if the buffer isn't large enough.
-static bool dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len);
+// Inserting with compare-and-swap needs every node to be full-width and unlabeled, so that a missing child is the only thing to fill in.
+#if !defined(_SYMTREE_ADAPTIVE_NODES) && !defined(_SYMTREE_PATH_COMPRESSION)
+#define _SYMTREE_ATOMIC_INSERT
+#endif
 
-// Load a symbol tree from json format.
-// @param data Binary data to load data from.
-// @param datalen Length of binary data to load from.
-// @returns Pointer to new symbol tree if success, NULL if failed.
-static symtree_t *load_symtree(const char *data, size_t datalen);
+// Maximum number of readers registered with a tree at once.
+#ifndef _SYMTREE_MAX_READERS
+#define _SYMTREE_MAX_READERS 64
+#endif
 
-// Add symbols to a tree from data in json format.
-// @param tree Pointer to symbol tree to add data to.
-// @param data Binary data to load data from.
-// @param datalen Length of binary data to load from.
-// @returns Pointer to new symbol tree if success, NULL if failed.
-static symtree_t *append_symtree(symtree_t *tree, const char *data, size_t datalen);
+// Number of retired nodes and values after which the writer tries to free them.
+#ifndef _SYMTREE_RECLAIM_THRESHOLD
+#define _SYMTREE_RECLAIM_THRESHOLD 1024
+#endif
 
+#ifndef _SYMTREE_CACHE_LINE
+#define _SYMTREE_CACHE_LINE 64
+#endif
 
-// Recursive function used internally within dump_symtree.
-static bool _dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len, const char *prefix) {
-	size_t i = 0, prefixlen = 0, newlen, curlen = 0;
-	char *newprefix;
-	char c;
-	if (tree->leaf != NULL) {
-#ifdef _SYMTREE_DUMP_PRETTY_JSON
-		if (curlen + 2 >= bufferlen) {
-			*len = curlen;
-			return false;
-		}
-		buffer[curlen++] = '\n';
-		buffer[curlen++] = '\t';
+// Memory ordering. Slots, values and epochs that readers and the writer share are loaded with acquire loads and stored with release stores,
+// so that a node or value is complete before a reader can reach it.
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#if defined(_M_ARM64) || defined(_M_ARM)
+#define _SYMTREE_RELEASE_FENCE() __dmb(_ARM64_BARRIER_ISH)
+#define _SYMTREE_FULL_FENCE() __dmb(_ARM64_BARRIER_ISH)
+#else
+#define _SYMTREE_RELEASE_FENCE() _ReadWriteBarrier()
+#define _SYMTREE_FULL_FENCE() _mm_mfence()
 #endif
-		if (prefix == NULL) {
-			// printf("Found data node %s\n", symtree_root_node_key);
-			if (curlen + strlen(symtree_root_node_key) + 4 >= bufferlen) {
-				*len = curlen;
-				return false;
-			}
-			buffer[curlen++] = '"';
-			memcpy(buffer, symtree_root_node_key, strlen(symtree_root_node_key));
-			buffer[curlen++] = '"';
-		} else {
-			// printf("Found data node %s\n", prefix);
-			if (curlen + strlen(prefix) + 4 >= bufferlen) {
-				*len = curlen;
-				return false;
-			}
-			buffer[curlen++] = '"';
-			while (prefix[i]) {
-				buffer[curlen++] = prefix[i++];
+#define _SYMTREE_CLAIM(p) (_InterlockedCompareExchange((p), 1, 0) == 0)
+#ifdef _SYMTREE_USE_INT32_OFFSETS
+#define _SYMTREE_CAS_REF(p,o,n) (_InterlockedCompareExchange((volatile long*)(p), (n), (o)) == (o))
+#else
+#define _SYMTREE_CAS_REF(p,o,n) (_InterlockedCompareExchangePointer((void *volatile*)(p), (n), (o)) == (o))
+#endif
+#ifdef _WIN64
+#define _SYMTREE_FETCH_ADD(p,v) ((size_t)_InterlockedExchangeAdd64((volatile __int64*)(p), (__int64)(v)))
+#else
+#define _SYMTREE_FETCH_ADD(p,v) ((size_t)_InterlockedExchangeAdd((volatile long*)(p), (long)(v)))
+#endif
+#define _SYMTREE_SWAP(p,v) ((VALUE_TYPE)_InterlockedExchangePointer((void *volatile*)(p), (v)))
+// volatile accesses have acquire and release semantics with /volatile:ms, the default on x86 and x64
+#define _SYMTREE_LOAD(p) (*(p))
+#define _SYMTREE_STORE(p,v) (_SYMTREE_RELEASE_FENCE(), *(p) = (v))
+#else
+#define _SYMTREE_RELEASE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define _SYMTREE_FULL_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define _SYMTREE_CLAIM(p) __sync_bool_compare_and_swap((p), 0, 1)
+#define _SYMTREE_CAS_REF(p,o,n) __sync_bool_compare_and_swap((p), (o), (n))
+#define _SYMTREE_FETCH_ADD(p,v) __sync_fetch_and_add((p), (v))
+#define _SYMTREE_SWAP(p,v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define _SYMTREE_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _SYMTREE_STORE(p,v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+// Load the subtree in slot i of a node, which the writer may be replacing.
+// @returns Subtree, or NULL if the slot is empty.
+static inline symtree_t *_symtree_load_child(symtree_t *tree, unsigned i) {
+	symtree_ref_t r = _SYMTREE_LOAD((volatile symtree_ref_t*)&tree->symbols[i]);
+	return r == _SYM_NULL ? NULL : _SYMTREE_DECODE_REF(tree, r);
+}
+#define _SYMTREE_CHILD_SLOT(t,i) _symtree_load_child((t), (i))
+#define _SYMTREE_LOAD_LEAF(p) _SYMTREE_LOAD((VALUE_TYPE volatile*)(p))
+
+// Reader of a concurrent symbol tree, padded to its own cache line.
+typedef struct {
+	// epoch the reader's current read section started in, or 0 outside of read sections
+	volatile size_t epoch;
+	volatile long used;
+	const volatile size_t *global;
+	uint8_t pad[_SYMTREE_CACHE_LINE - 2 * sizeof(size_t) - sizeof(void*)];
+} symtree_reader_t;
+
+// Epoch counter and reader slots of a concurrent tree.
+typedef struct {
+	volatile size_t epoch;
+	uint8_t pad[_SYMTREE_CACHE_LINE - sizeof(size_t)];
+	symtree_reader_t readers[_SYMTREE_MAX_READERS];
+} _symtree_epochs_t;
+
+// Node or value unlinked by the writer, waiting for readers to move past the epoch it was unlinked in.
+typedef struct {
+	void *p;
+	size_t epoch;
+	bool node;
+} _symtree_retired_t;
+#else
+#define _SYMTREE_RELEASE_FENCE()
+#define _SYMTREE_CHILD_SLOT(t,i) _READ_SYMBOL_TREE((t), (i))
+#define _SYMTREE_LOAD_LEAF(p) (*(p))
+#endif
+
+#ifdef _SYMTREE_COPY_ON_WRITE
+#ifdef _SYMTREE_USE_ARENA
+#error "_SYMTREE_COPY_ON_WRITE cannot be combined with _SYMTREE_USE_ARENA, since clones share nodes across trees"
+#endif
+#ifdef _SYMTREE_CONCURRENT
+#error "_SYMTREE_COPY_ON_WRITE cannot be combined with _SYMTREE_CONCURRENT"
+#endif
+#endif
+
+#ifdef _SYMTREE_INSTRUMENT
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Number of buckets in each latency histogram.
+// Bucket b counts operations that took from 2^b up to 2^(b+1) nanoseconds, with the first bucket also counting faster ones and the last bucket slower ones.
+#ifndef _SYMTREE_LATENCY_BUCKETS
+#define _SYMTREE_LATENCY_BUCKETS 32
+#endif
+
+// Each thread times one in this many of its operations, until changed with symtree_metrics_sample_every.
+#ifndef _SYMTREE_LATENCY_SAMPLE
+#define _SYMTREE_LATENCY_SAMPLE 64
+#endif
+
+// Maximum number of trace hooks registered at once.
+#ifndef _SYMTREE_MAX_TRACE_HOOKS
+#define _SYMTREE_MAX_TRACE_HOOKS 8
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define _SYMTREE_THREAD_LOCAL __declspec(thread)
+#define _SYMTREE_METRICS_CLAIM(p) (_InterlockedCompareExchange((p), 1, 0) == 0)
+#define _SYMTREE_METRICS_RELEASE(p) _InterlockedExchange((p), 0)
+#define _SYMTREE_METRICS_PUSH(p,o,n) (_InterlockedCompareExchangePointer((void *volatile*)(p), (n), (o)) == (o))
+#else
+#define _SYMTREE_THREAD_LOCAL __thread
+#define _SYMTREE_METRICS_CLAIM(p) __sync_bool_compare_and_swap((p), 0, 1)
+#define _SYMTREE_METRICS_RELEASE(p) __sync_lock_release(p)
+#define _SYMTREE_METRICS_PUSH(p,o,n) __sync_bool_compare_and_swap((p), (o), (n))
+#endif
+
+// Operations counted and timed by the instrumentation.
+// find_sym and find_sym_addr
+#define SYMTREE_OP_FIND 0
+// new_sym, new_sym_weighted and new_sym_atomic
+#define SYMTREE_OP_NEW 1
+#define SYMTREE_OP_SET 2
+#define SYMTREE_OP_DEL 3
+// find_sym_batch, once per call
+#define SYMTREE_OP_BATCH 4
+#define SYMTREE_NUM_OPS 5
+
+// Counters of the threads using symbol trees.
+typedef struct {
+	// operations made, by SYMTREE_OP_*
+	uint64_t ops[SYMTREE_NUM_OPS];
+	// subtrees stepped into by lookups, insertions and deletions
+	uint64_t nodesvisited;
+	// lookups and deletions that ran out of tree before the end of their key
+	uint64_t earlymisses;
+	// keys rejected for a character outside of the alphabet
+	uint64_t invalidchars;
+	uint64_t nodesallocated;
+	// nodes freed one at a time, such as by del_sym, rather than all at once by free_symtree
+	uint64_t nodesfreed;
+	// nodes that failed to allocate
+	uint64_t allocfailures;
+	// operations timed, and their latency histograms, by SYMTREE_OP_*
+	uint64_t sampled[SYMTREE_NUM_OPS];
+	uint64_t latency[SYMTREE_NUM_OPS][_SYMTREE_LATENCY_BUCKETS];
+} symtree_metrics_t;
+
+// Called after each timed operation, on the thread that made it.
+// @param op Operation, one of SYMTREE_OP_*.
+// @param name Key of the operation, or NULL for find_sym_batch.
+// @param namelen Length of the key as passed to the operation, or the number of keys for find_sym_batch.
+// @param found Whether the operation found the key, or for insertions whether it set it. For find_sym_batch, whether it found any of its keys.
+// @param nanoseconds Time the operation took.
+typedef void (*symtree_trace_hook_t)(void *context, symtree_t *tree, unsigned op, const char *name, size_t namelen, bool found, uint64_t nanoseconds);
+
+// Counters of a thread, kept in a list of every thread's counters so that they can be added up.
+typedef struct _symtree_metrics_block {
+	symtree_metrics_t metrics;
+	// operations made since the last timed one
+	unsigned sincesample;
+	// whether a thread is using the block
+	volatile long owned;
+	struct _symtree_metrics_block *next;
+} _symtree_metrics_block_t;
+#endif
+
+#ifdef _SYMTREE_USE_PAGED_NODES
+// Header at the start of each page.
+typedef struct {
+	uint8_t *base;
+	// escape table, holding block numbers relative to the arena base
+	uint32_t *escapes;
+	uint16_t used;
+	uint16_t count;
+	uint16_t capacity;
+	// 1 + index of the first free escape entry, or 0 if none are free
+	uint16_t free;
+} symtree_page_t;
+
+#define _SYMTREE_PAGE_HEADER_SIZE ((sizeof(symtree_page_t) + _SYMTREE_BLOCK_SIZE - 1) / _SYMTREE_BLOCK_SIZE * _SYMTREE_BLOCK_SIZE)
+#define _SYMTREE_PAGE_OF(t) ((symtree_page_t*)((uintptr_t)(t) & ~(uintptr_t)(_SYMTREE_PAGE_SIZE - 1)))
+
+// Resolve a page-relative subtree reference.
+// Positive references are block numbers within the page, negative references index the page's escape table.
+static inline symtree_t *_symtree_page_read(const void *t, int16_t r) {
+	symtree_page_t *page = _SYMTREE_PAGE_OF(t);
+	if (r > 0) {
+		return (symtree_t*)((uint8_t*)page + r * _SYMTREE_BLOCK_SIZE);
+	}
+	return (symtree_t*)(page->base + (size_t)page->escapes[-r-1] * _SYMTREE_BLOCK_SIZE);
+}
+
+// Add an entry to a page's escape table, growing it if needed.
+// @returns Index of the entry, or -1 if the table is full or failed to allocate memory.
+static int _symtree_page_escape(symtree_page_t *page, uint32_t block) {
+	uint32_t *escapes;
+	int e, capacity;
+	if (page->free != 0) {
+		e = page->free - 1;
+		page->free = page->escapes[e];
+	} else {
+		if (page->count >= page->capacity) {
+			if (page->capacity >= 32767) {
+				return -1;
 			}
-			buffer[curlen++] = '"';
-			i = 0;
-		}
-		buffer[curlen++] = ':';
-		buffer[curlen++] = '"';
-		while ((c = tree->leaf[i])) {
-			if (curlen + 1 >= bufferlen) {
-				*len = curlen;
-				return false;
+			capacity = page->capacity < 8 ? 8 : page->capacity * 2;
+			if (capacity > 32767) {
+				capacity = 32767;
 			}
-			if (c == '\n') {
-				if (curlen + 2 >= bufferlen) {
-					*len = curlen;
-					return false;
-				}
-				buffer[curlen++] = '\\';
-				buffer[curlen++] = 'n';
-			} else if (c == '\t') {
-				if (curlen + 2 >= bufferlen) {
-					*len = curlen;
-					return false;
-				}
-				buffer[curlen++] = '\\';
-				buffer[curlen++] = 't';
-			} else {
-				if (c == '"') {
-					if (curlen + 2 >= bufferlen) {
-						*len = curlen;
-						return false;
-					}
-					buffer[curlen++] = '\\';
-				}
-				buffer[curlen++] = c;
+			if ((escapes = (uint32_t*)_malloc(capacity * sizeof(uint32_t))) == NULL) {
+				return -1;
 			}
-			i++;
-		}
-		if (curlen + 2 >= bufferlen) {
-			*len = curlen;
-			return false;
-		}
-		buffer[curlen++] = '"';
-		buffer[curlen++] = ',';
-	}
-	if (prefix != NULL) {
-		prefixlen += strlen(prefix);
-	}
-	if ((newprefix = malloc(prefixlen+2)) == NULL) {
-		*len = curlen;
-		return false;
-	}
-	if (prefixlen > 0) {
-		memcpy(newprefix, prefix, prefixlen);
-	}
-	newprefix[prefixlen+1] = 0;
-	for (i=0; i<_SYMTREE_NUM_CHARS; i++) {
-		if (tree->symbols[i] != _SYM_NULL) {
-			newprefix[prefixlen] = _UNPARSE_SYM_NAME_CHAR(i);
-			// printf("Found tree node %s\n", newprefix);
-			if (_dump_symtree(_READ_SYMBOL_TREE(tree, i), &buffer[curlen], bufferlen-curlen, &newlen, newprefix)) {
-				curlen += newlen;
-			} else {
-				free(newprefix);
-				*len = curlen + newlen;
-				return false;
+			if (page->escapes != NULL) {
+				memcpy(escapes, page->escapes, page->count * sizeof(uint32_t));
+				_free(page->escapes);
 			}
+			page->escapes = escapes;
+			page->capacity = capacity;
 		}
+		e = page->count++;
 	}
-	free(newprefix);
-	*len = curlen;
-	return true;
+	page->escapes[e] = block;
+	return e;
 }
 
-static bool dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len) {
-	size_t curlen = 0, newlen;
-	if (curlen + sizeof(symtree_file_header) >= bufferlen) {
-		*len = curlen;
-		return false;
-	}
-	memcpy(buffer, symtree_file_header, strlen(symtree_file_header));
-	curlen += strlen(symtree_file_header);
-	if (!(_dump_symtree(tree, &buffer[curlen], bufferlen-curlen, &newlen, NULL))) {
-		*len = curlen + newlen;
-		return false;
-	}
-	if (newlen > 0) {
-		curlen = curlen + newlen - 1; // rewind a byte to remove extra comma
+// Encode a page-relative subtree reference, using an escape entry if v is in a different page.
+// Writes _SYM_NULL if the page's escape table is full.
+static inline void _symtree_page_write(const void *t, int16_t *r, const void *v) {
+	symtree_page_t *page = _SYMTREE_PAGE_OF(t);
+	uint32_t block;
+	int e;
+	if (_SYMTREE_PAGE_OF(v) == page) {
+		*r = ((uint8_t*)v - (uint8_t*)page) / _SYMTREE_BLOCK_SIZE;
+		return;
 	}
-	if (curlen + strlen(symtree_file_footer) >= bufferlen) {
-		*len = curlen;
-		return false;
+	block = ((uint8_t*)v - page->base) / _SYMTREE_BLOCK_SIZE;
+	if (*r < 0) {
+		// each escape entry belongs to a single slot, so it can be reused in place
+		page->escapes[-*r-1] = block;
+	} else if ((e = _symtree_page_escape(page, block)) >= 0) {
+		*r = -(e + 1);
+	} else {
+		*r = 0;
 	}
-	memcpy(&buffer[curlen], symtree_file_footer, strlen(symtree_file_footer));
-	*len = curlen + strlen(symtree_file_footer);
-	return true;
 }
 
-static symtree_t *load_symtree(const char *data, size_t datalen) {
-	symtree_t *tree = alloc_symtree();
-	if (tree == NULL) {
-		return NULL;
-	}
-	return append_symtree(tree, data, datalen);
+// Release the escape entry used by slot i of a node, if any.
+// Must be called before a slot holding a subtree is cleared.
+#define _SYMTREE_RELEASE_REF(t, i) { \
+	int16_t _r = (t)->symbols[i]; \
+	if (_r < 0) { \
+		symtree_page_t *_page = _SYMTREE_PAGE_OF(t); \
+		_page->escapes[-_r-1] = _page->free; \
+		_page->free = -_r; \
+	} \
 }
+#else
+#define _SYMTREE_RELEASE_REF(t, i)
+#endif
 
-// Used internally by append_symtree to read quoted strings
-static char *_read_until(const char *data, size_t datalen, char end, size_t *read) {
-	char c, *str;
-	size_t i = 0;
-	
-	while (i < datalen) {
-		c = data[i++];
-		if (c == '\\') {
-			if (i+1 >= datalen) {
-				return NULL;
-			}
-			i++;
-		} else if (c == end) {
-			break;
-		}
-	}
-	*read = i;
-	str = malloc(i);
-	if (str != NULL) {
-		if (i <= 1) {
+// Block of value strings loaded by append_symtree, owned by the tree. The strings follow the header.
+// Pools are shared with clones, and counted by the trees and pools linking to them.
+typedef struct _symtree_pool {
+	struct _symtree_pool *next;
+	size_t size;
+	size_t refs;
+} symtree_pool_t;
+
+// Running totals of a symbol tree, kept up to date as it is modified.
+typedef struct {
+	// nodes, including the root
+	size_t nodes;
+	// keys with a value
+	size_t keys;
+	// bytes taken by the nodes
+	size_t nodebytes;
+	// bytes taken by the value strings, including their null terminators
+	size_t valuebytes;
+} symtree_counts_t;
+
+// Per-tree state, stored directly in front of the root node.
+typedef struct _symtree_info symtree_info_t;
+
+// State shared by the threads of a parallel bulk load.
+typedef struct _symtree_bulk _symtree_bulk_t;
+
+struct _symtree_info {
+	symtree_pool_t *pools;
+	symtree_counts_t counts;
+#ifdef _SYMTREE_INTERN_VALUES
+	// open-addressed table of the values in the store, with a power of two number of slots
+	char **interns;
+	size_t numinterns;
+	size_t interncapacity;
+	// pool that values are being bumped into, and how much of it is used
+	symtree_pool_t *internpool;
+	size_t internused;
+	// bytes taken by the store's pools and table
+	size_t internbytes;
+#endif
+	// set once the tree has been cloned or is a clone, after which values may be shared with other trees
+	bool cloned;
+#ifdef _SYMTREE_USE_ARENA
+	uint8_t *mapping;
+	uint8_t *base;
+	size_t used;
+	size_t committed;
+	void *free_lists[_SYMTREE_ARENA_FREE_LISTS + 1];
+#endif
+#ifdef _SYMTREE_USE_PAGED_NODES
+	symtree_page_t *page;
+	symtree_t *near;
+#endif
+#ifdef _SYMTREE_CONCURRENT
+	_symtree_epochs_t *epochs;
+	void *epochsmem;
+	_symtree_retired_t *retired;
+	size_t numretired;
+	size_t maxretired;
+	size_t reclaimat;
+#if defined(_SYMTREE_ATOMIC_INSERT) && defined(_SYMTREE_USE_ARENA)
+	// held while committing more of the arena for new_sym_atomic
+	volatile long commitlock;
+#endif
+#endif
+#if defined(_SYMTREE_PARALLEL) && defined(_SYMTREE_USE_ARENA)
+	// set for the scratch trees of a parallel bulk load, which allocate from windows of the loaded tree's arena
+	_symtree_bulk_t *bulk;
+#endif
+};
+
+#if defined(_SYMTREE_USE_PAGED_NODES) && _SYMTREE_BLOCK_SIZE > 16
+#define _SYMTREE_INFO_ALIGN _SYMTREE_BLOCK_SIZE
+#else
+#define _SYMTREE_INFO_ALIGN 16
+#endif
+#define _SYMTREE_INFO_SIZE ((sizeof(symtree_info_t) + _SYMTREE_INFO_ALIGN - 1) & ~(size_t)(_SYMTREE_INFO_ALIGN - 1))
+#define _SYMTREE_INFO(t) ((symtree_info_t*)((uint8_t*)(t) - _SYMTREE_INFO_SIZE))
+
+// Hint that the next node allocated should be placed near node t.
+#ifdef _SYMTREE_USE_PAGED_NODES
+#define _SYMTREE_ALLOC_NEAR(info, t) ((info)->near = (t))
+#else
+#define _SYMTREE_ALLOC_NEAR(info, t)
+#endif
+
+#ifdef _SYMTREE_PARALLEL
+struct _symtree_bulk {
+	symtree_t *tree;
+	const char **names;
+	size_t *namelens;
+	VALUE_TYPE *values;
+	size_t count;
+	size_t capacity;
+	// key indices grouped by first key number, group c spanning order[start[c]] up to order[start[c+1]]
+	size_t *order;
+	size_t start[_SYMTREE_NUM_CHARS + 1];
+	// first key numbers of the groups left to build, largest first
+	uint8_t queue[_SYMTREE_NUM_CHARS];
+	unsigned queued;
+	unsigned next;
+	// set if a key had characters outside of the alphabet
+	bool invalid;
+#ifdef _SYMTREE_INTERN_VALUES
+	// buffer holding the unescaped keys of the queued keys
+	char *scratch;
+#endif
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+#ifdef _SYMTREE_USE_ARENA
+// Move a bulk load scratch tree to a new window of the loaded tree's arena, with room for an allocation ending at end.
+// @returns False if the arena is exhausted.
+static bool _symtree_bulk_window(symtree_info_t *info, size_t end);
+#endif
+#endif
+
+#ifdef _SYMTREE_USE_ARENA
+// Commit arena memory from oldsize up to newsize bytes.
+static bool _symtree_arena_commit(uint8_t *base, size_t oldsize, size_t newsize) {
+#ifdef _WIN32
+	return VirtualAlloc(base + oldsize, newsize - oldsize, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+	return mprotect(base + oldsize, newsize - oldsize, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+// Release an arena's address space.
+static void _symtree_arena_release(uint8_t *mapping) {
+#ifdef _WIN32
+	VirtualFree(mapping, 0, MEM_RELEASE);
+#else
+	munmap(mapping, _SYMTREE_ARENA_RESERVE + _SYMTREE_ARENA_BASE_ALIGN);
+#endif
+}
+
+// Reserve a new arena, with its info block placed offset bytes from the start.
+// @returns Arena info, or NULL if failed to reserve memory.
+static symtree_info_t *_symtree_arena_create(size_t offset) {
+	symtree_info_t *info;
+	uint8_t *mapping, *base;
+#ifdef _WIN32
+	if ((mapping = (uint8_t*)VirtualAlloc(NULL, _SYMTREE_ARENA_RESERVE + _SYMTREE_ARENA_BASE_ALIGN, MEM_RESERVE, PAGE_NOACCESS)) == NULL) {
+		return NULL;
+	}
+#else
+	if ((mapping = (uint8_t*)mmap(NULL, _SYMTREE_ARENA_RESERVE + _SYMTREE_ARENA_BASE_ALIGN, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+		return NULL;
+	}
+#endif
+	base = (uint8_t*)(((uintptr_t)mapping + _SYMTREE_ARENA_BASE_ALIGN - 1) / _SYMTREE_ARENA_BASE_ALIGN * _SYMTREE_ARENA_BASE_ALIGN);
+#if !defined(_WIN32) && defined(_SYMTREE_ARENA_HUGEPAGES) && defined(MADV_HUGEPAGE)
+	madvise(base, _SYMTREE_ARENA_RESERVE, MADV_HUGEPAGE);
+#endif
+	if (!_symtree_arena_commit(base, 0, _SYMTREE_ARENA_CHUNK_SIZE)) {
+		_symtree_arena_release(mapping);
+		return NULL;
+	}
+	info = (symtree_info_t*)(base + offset);
+	memset(info, 0, sizeof(symtree_info_t));
+	info->mapping = mapping;
+	info->base = base;
+	info->used = offset + _SYMTREE_INFO_SIZE;
+	info->committed = _SYMTREE_ARENA_CHUNK_SIZE;
+	return info;
+}
+
+// Release an arena and everything allocated from it.
+static void _symtree_arena_destroy(symtree_info_t *info) {
+	_symtree_arena_release(info->mapping);
+}
+
+// Make sure the arena is committed up to end bytes.
+// @returns False if the arena is exhausted.
+static bool _symtree_arena_ensure(symtree_info_t *info, size_t end) {
+	size_t newcommitted;
+	if (end > info->committed) {
+#ifdef _SYMTREE_PARALLEL
+		if (info->bulk != NULL) {
+			return _symtree_bulk_window(info, end);
+		}
+#endif
+		newcommitted = (end + _SYMTREE_ARENA_CHUNK_SIZE - 1) / _SYMTREE_ARENA_CHUNK_SIZE * _SYMTREE_ARENA_CHUNK_SIZE;
+		if (newcommitted > _SYMTREE_ARENA_RESERVE || !_symtree_arena_commit(info->base, info->committed, newcommitted)) {
+			return false;
+		}
+		info->committed = newcommitted;
+	}
+	return true;
+}
+
+// Take a freed block of n allocation units from the arena's free lists.
+// @returns Block, or NULL if there is none.
+static void *_symtree_arena_reuse(symtree_info_t *info, size_t n) {
+	void **prev, *p;
+	if (n < _SYMTREE_ARENA_FREE_LISTS) {
+		if ((p = info->free_lists[n]) != NULL) {
+			info->free_lists[n] = *(void**)p;
+		}
+		return p;
+	}
+	// large blocks store their size after the link
+	for (prev = &info->free_lists[_SYMTREE_ARENA_FREE_LISTS]; (p = *prev) != NULL; prev = (void**)p) {
+		if (((size_t*)p)[1] == n * _SYMTREE_ARENA_ALIGN) {
+			*prev = *(void**)p;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Allocate memory from an arena, reusing freed blocks of the same size first.
+// @returns Allocated memory, or NULL if the arena is exhausted.
+static void *_symtree_arena_alloc(symtree_info_t *info, size_t size) {
+	size_t n = (size + _SYMTREE_ARENA_ALIGN - 1) / _SYMTREE_ARENA_ALIGN;
+	void *p;
+	if ((p = _symtree_arena_reuse(info, n)) != NULL) {
+		return p;
+	}
+	size = n * _SYMTREE_ARENA_ALIGN;
+	if (!_symtree_arena_ensure(info, info->used + size)) {
+		return NULL;
+	}
+	p = info->base + info->used;
+	info->used += size;
+	return p;
+}
+
+// Return memory to an arena's free lists.
+static void _symtree_arena_free(symtree_info_t *info, void *p, size_t size) {
+	size_t n = (size + _SYMTREE_ARENA_ALIGN - 1) / _SYMTREE_ARENA_ALIGN;
+	if (n < _SYMTREE_ARENA_FREE_LISTS) {
+		*(void**)p = info->free_lists[n];
+		info->free_lists[n] = p;
+	} else {
+		((size_t*)p)[1] = n * _SYMTREE_ARENA_ALIGN;
+		*(void**)p = info->free_lists[_SYMTREE_ARENA_FREE_LISTS];
+		info->free_lists[_SYMTREE_ARENA_FREE_LISTS] = p;
+	}
+}
+
+#ifdef _SYMTREE_ATOMIC_INSERT
+// Allocate memory from an arena while other threads may be allocating from it too. Freed blocks are not reused.
+// @returns Allocated zeroed memory, or NULL if the arena is exhausted.
+static void *_symtree_arena_alloc_atomic(symtree_info_t *info, size_t size) {
+	size_t offset, end, newcommitted;
+	size = (size + _SYMTREE_ARENA_ALIGN - 1) / _SYMTREE_ARENA_ALIGN * _SYMTREE_ARENA_ALIGN;
+	offset = _SYMTREE_FETCH_ADD(&info->used, size);
+	end = offset + size;
+	while (end > _SYMTREE_LOAD((volatile size_t*)&info->committed)) {
+		if (!_SYMTREE_CLAIM(&info->commitlock)) {
+			continue;
+		}
+		if (end > info->committed) {
+			newcommitted = (end + _SYMTREE_ARENA_CHUNK_SIZE - 1) / _SYMTREE_ARENA_CHUNK_SIZE * _SYMTREE_ARENA_CHUNK_SIZE;
+			if (newcommitted > _SYMTREE_ARENA_RESERVE || !_symtree_arena_commit(info->base, info->committed, newcommitted)) {
+				_SYMTREE_STORE(&info->commitlock, 0);
+				return NULL;
+			}
+			_SYMTREE_STORE((volatile size_t*)&info->committed, newcommitted);
+		}
+		_SYMTREE_STORE(&info->commitlock, 0);
+	}
+	// memory past the bump pointer has never been handed out, so it is still zero from being committed
+	return info->base + offset;
+}
+#endif
+#endif
+
+#ifdef _SYMTREE_USE_PAGED_NODES
+// Open a new page at the end of the arena.
+// @returns Page, or NULL if the arena is exhausted.
+static symtree_page_t *_symtree_page_open(symtree_info_t *info) {
+	size_t start = (info->used + _SYMTREE_PAGE_SIZE - 1) / _SYMTREE_PAGE_SIZE * _SYMTREE_PAGE_SIZE;
+	symtree_page_t *page;
+	if (!_symtree_arena_ensure(info, start + _SYMTREE_PAGE_SIZE)) {
+		return NULL;
+	}
+	// bulk load scratch trees may have moved to a new window
+	start = (info->used + _SYMTREE_PAGE_SIZE - 1) / _SYMTREE_PAGE_SIZE * _SYMTREE_PAGE_SIZE;
+	page = (symtree_page_t*)(info->base + start);
+	memset(page, 0, sizeof(symtree_page_t));
+	page->base = info->base;
+	page->used = _SYMTREE_PAGE_HEADER_SIZE / _SYMTREE_BLOCK_SIZE;
+	info->used = start + _SYMTREE_PAGE_SIZE;
+	return page;
+}
+
+// Take n blocks from the unused part of a page.
+// @returns Allocated memory, or NULL if the page is full.
+static void *_symtree_page_take(symtree_page_t *page, size_t n) {
+	void *p;
+	if ((page->used + n) * _SYMTREE_BLOCK_SIZE > _SYMTREE_PAGE_SIZE) {
+		return NULL;
+	}
+	p = (uint8_t*)page + page->used * _SYMTREE_BLOCK_SIZE;
+	page->used += n;
+	return p;
+}
+
+// Allocate a node, preferring the page of the node hinted with _SYMTREE_ALLOC_NEAR.
+// @returns Allocated memory, or NULL if the arena is exhausted.
+static void *_symtree_page_alloc(symtree_info_t *info, size_t size) {
+	size_t n = (size + _SYMTREE_BLOCK_SIZE - 1) / _SYMTREE_BLOCK_SIZE;
+	symtree_page_t *near = info->near == NULL ? NULL : _SYMTREE_PAGE_OF(info->near);
+	void **prev, *p;
+	int tries = 0;
+	info->near = NULL;
+	if (near != NULL) {
+		// look for a freed block in the same page first
+		if (n < _SYMTREE_ARENA_FREE_LISTS) {
+			for (prev = &info->free_lists[n]; (p = *prev) != NULL && tries < 8; prev = (void**)p, tries++) {
+				if (_SYMTREE_PAGE_OF(p) == near) {
+					*prev = *(void**)p;
+					return p;
+				}
+			}
+		}
+		if ((p = _symtree_page_take(near, n)) != NULL) {
+			return p;
+		}
+	}
+	if ((p = _symtree_arena_reuse(info, n)) != NULL) {
+		return p;
+	}
+	if (info->page != NULL && (p = _symtree_page_take(info->page, n)) != NULL) {
+		return p;
+	}
+	if ((info->page = _symtree_page_open(info)) == NULL) {
+		return NULL;
+	}
+	return _symtree_page_take(info->page, n);
+}
+#endif
+
+#ifdef _SYMTREE_ADAPTIVE_NODES
+
+// Adaptive node kinds.
+// 4 and 16-wide nodes store a sorted table of key numbers after their subtree slots.
+// 48-wide nodes store a table mapping each key number to a subtree slot (plus one) after their subtree slots.
+// Kinds at least as wide as _SYMTREE_NUM_CHARS are skipped in favor of full-width nodes.
+#define _SYMTREE_NODE4 0
+#define _SYMTREE_NODE16 1
+#define _SYMTREE_NODE48 2
+#define _SYMTREE_NODE_FULL 3
+
+static const uint16_t symtree_node_capacity[4] = {4, 16, 48, _SYMTREE_NUM_CHARS};
+
+// Key number table of a 4/16-wide node, or slot table of a 48-wide node.
+#define _SYMTREE_NODE_KEYS(t) ((uint8_t*)&(t)->symbols[symtree_node_capacity[(t)->kind]])
+#define _SYMTREE_NODE_KIND(t) _SYMTREE_NODE_FIELD((t), uint8_t, kind)
+#define _SYMTREE_NODE_COUNT(t) _SYMTREE_NODE_FIELD((t), uint16_t, count)
+#else
+#define _SYMTREE_NODE_KIND(t) 0
+#endif
+
+#ifdef _SYMTREE_BURST_CONTAINERS
+// Containers have no subtrees. Instead they hold a sorted run of entries, each the value of a key and the key numbers that follow the container.
+// A container's count is its number of entries, and its leaf is the value of the key ending at the container.
+#define _SYMTREE_NODE_BURST 4
+// Longest key suffix an entry can hold. Longer suffixes burst the container.
+#define _SYMTREE_BURST_MAX_SUFFIX 255
+#if _SYMTREE_BURST_MAX_SUFFIX > UINT8_MAX
+#error "_SYMTREE_BURST_MAX_SUFFIX must fit the one-byte length of a container entry"
+#endif
+
+// Container header, in place of the subtree slots.
+typedef struct {
+	// bytes of entries, and bytes of room for entries
+	uint32_t used;
+	uint32_t capacity;
+} _symtree_bucket_t;
+
+// The header overlays the subtree slots, so it is only ever copied in and out with memcpy rather than accessed through a cast.
+#define _SYMTREE_BUCKET_HEADER(t) ((uint8_t*)(t) + offsetof(symtree_t, symbols))
+
+// Get the bytes of entries in a container.
+static inline uint32_t _symtree_bucket_used(const symtree_t *tree) {
+	uint32_t used;
+	memcpy(&used, (const uint8_t*)tree + offsetof(symtree_t, symbols) + offsetof(_symtree_bucket_t, used), sizeof(used));
+	return used;
+}
+
+// Get the bytes of room for entries in a container.
+static inline uint32_t _symtree_bucket_capacity(const symtree_t *tree) {
+	uint32_t capacity;
+	memcpy(&capacity, (const uint8_t*)tree + offsetof(symtree_t, symbols) + offsetof(_symtree_bucket_t, capacity), sizeof(capacity));
+	return capacity;
+}
+
+// Set the bytes of entries in a container.
+static inline void _symtree_bucket_set_used(symtree_t *tree, size_t used) {
+	uint32_t v = (uint32_t)used;
+	memcpy(_SYMTREE_BUCKET_HEADER(tree) + offsetof(_symtree_bucket_t, used), &v, sizeof(v));
+}
+
+// Set the bytes of room for entries in a container.
+static inline void _symtree_bucket_set_capacity(symtree_t *tree, size_t capacity) {
+	uint32_t v = (uint32_t)capacity;
+	memcpy(_SYMTREE_BUCKET_HEADER(tree) + offsetof(_symtree_bucket_t, capacity), &v, sizeof(v));
+}
+
+// Entries are aligned to values, and are laid out as the value, the suffix length and the suffix.
+#define _SYMTREE_BUCKET_OFFSET ((offsetof(symtree_t, symbols) + sizeof(_symtree_bucket_t) + sizeof(VALUE_TYPE) - 1) / sizeof(VALUE_TYPE) * sizeof(VALUE_TYPE))
+#define _SYMTREE_BUCKET_DATA(t) ((uint8_t*)(t) + _SYMTREE_BUCKET_OFFSET)
+#define _SYMTREE_ENTRY_VALUE(e) ((VALUE_TYPE*)(e))
+#define _SYMTREE_ENTRY_LEN(e) ((e)[sizeof(VALUE_TYPE)])
+#define _SYMTREE_ENTRY_KEY(e) (&(e)[sizeof(VALUE_TYPE) + 1])
+#define _SYMTREE_ENTRY_SIZE(len) ((sizeof(VALUE_TYPE) * 2 + (len)) / sizeof(VALUE_TYPE) * sizeof(VALUE_TYPE))
+#define _SYMTREE_IS_CONTAINER(t) ((t)->kind == _SYMTREE_NODE_BURST)
+
+// Loop through the entries of a container.
+#define _SYMTREE_FOREACH_ENTRY(t, e) for (uint8_t *e = _SYMTREE_BUCKET_DATA(t); e < _SYMTREE_BUCKET_DATA(t) + _symtree_bucket_used(t); e += _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(e)))
+#else
+#define _SYMTREE_IS_CONTAINER(t) 0
+#endif
+
+#ifdef _SYMTREE_PATH_COMPRESSION
+// Maximum number of characters in a single subtree label. Longer key suffixes are split across multiple subtrees.
+#ifndef _SYMTREE_MAX_LABEL_LEN
+#define _SYMTREE_MAX_LABEL_LEN 65535
+#endif
+// Labels are stored as canonical key characters directly after the node's subtree slots (and key table).
+#define _SYMTREE_LABEL(t) ((uint8_t*)(t) + _symtree_node_base_size(t))
+#define _SYMTREE_LABEL_LEN(t) ((t)->labellen)
+#else
+#define _SYMTREE_LABEL_LEN(t) 0
+#endif
+
+#ifdef _SYMTREE_SNAPSHOTS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef _SYMTREE_SNAPSHOT_VALUE_SIZE
+#define _SYMTREE_SNAPSHOT_VALUE_SIZE(value) (strlen(value) + 1)
+// values are C strings, whose copies must end within the image
+#define _SYMTREE_SNAPSHOT_STRING_VALUES
+#endif
+
+// Snapshot images are made of 8-byte units. Offsets within the image are 32-bit unit numbers, limiting images to 32 gigabytes.
+// Each value is stored as its 64-bit size followed by its bytes.
+#define _SYMTREE_SNAPSHOT_UNIT 8
+#define _SYMTREE_SNAPSHOT_MAGIC "SYMSNAP"
+#define _SYMTREE_SNAPSHOT_VERSION 2
+
+// Snapshot file header.
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint16_t num_chars;
+	// 0x0102 in the byte order of the machine that wrote the snapshot
+	uint16_t byte_order;
+	uint64_t size;
+	uint32_t root;
+	uint32_t reserved;
+} symtree_snapshot_header_t;
+
+// Snapshot node header.
+// Followed by count 32-bit child offsets, count key numbers in ascending order, and labellen label characters.
+typedef struct {
+	uint32_t value;
+	uint16_t count;
+	uint16_t labellen;
+} symtree_snapshot_node_t;
+
+#define _SYMTREE_SNAPSHOT_CHILDREN(n) ((const uint32_t*)((const symtree_snapshot_node_t*)(n) + 1))
+#define _SYMTREE_SNAPSHOT_KEYS(n) ((const uint8_t*)(_SYMTREE_SNAPSHOT_CHILDREN(n) + (n)->count))
+#define _SYMTREE_SNAPSHOT_LABEL(n) (_SYMTREE_SNAPSHOT_KEYS(n) + (n)->count)
+
+// Read-only symbol tree image, either mapped from a file or supplied by the caller.
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	const symtree_snapshot_node_t *root;
+	bool mapped;
+} symtree_snapshot_t;
+#endif
+
+// One level of an iterative tree walk.
+typedef struct {
+	symtree_t *tree;
+	// length of the key up to and including the node's label
+	size_t prefixlen;
+	int next;
+} _symtree_walk_frame_t;
+
+// Number of tree levels an iterator holds without allocating memory, along with 4 key characters per level.
+#ifndef _SYMTREE_ITER_DEPTH
+#define _SYMTREE_ITER_DEPTH 32
+#endif
+
+// Cursor over the keys of a symbol tree under a prefix, in key number order.
+// The walk stack and key buffer are kept inside the iterator, and only move to the heap once keys outgrow them.
+typedef struct {
+	symtree_t *tree;
+	// the prefix is kept at the start of the key buffer
+	size_t prefixlen;
+	// subtree holding every key under the prefix, or NULL if there are none
+	symtree_t *start;
+	size_t startlen;
+	// heap buffers once the inline ones have been outgrown, otherwise NULL
+	_symtree_walk_frame_t *frames;
+	char *key;
+	size_t numframes;
+	size_t keycapacity;
+	size_t depth;
+	// set while the value of the node on top of the stack is yet to be returned
+	bool pending;
+	// set if the walk was cut short by failing to allocate memory
+	bool failed;
+	_symtree_walk_frame_t stackframes[_SYMTREE_ITER_DEPTH];
+	char stackkey[_SYMTREE_ITER_DEPTH * 4];
+} symtree_iter_t;
+
+#define _SYMTREE_ITER_FRAMES(it) ((it)->frames != NULL ? (it)->frames : (it)->stackframes)
+#define _SYMTREE_ITER_KEY(it) ((it)->key != NULL ? (it)->key : (it)->stackkey)
+
+// Number of tree levels symtree_stats reports separately.
+#ifndef _SYMTREE_STATS_DEPTH
+#define _SYMTREE_STATS_DEPTH 64
+#endif
+
+// Shape of a symbol tree, as measured by symtree_stats.
+typedef struct {
+	// totals found by walking the tree
+	symtree_counts_t counts;
+	// number of levels below the root
+	size_t depth;
+	// nodes, keys and node bytes on each level, with the root on level 0 and deeper levels added to the last one
+	size_t levelnodes[_SYMTREE_STATS_DEPTH];
+	size_t levelkeys[_SYMTREE_STATS_DEPTH];
+	size_t levelbytes[_SYMTREE_STATS_DEPTH];
+	// number of nodes by how many subtrees they have
+	size_t fanout[_SYMTREE_NUM_CHARS + 1];
+	// share of the nodes that have exactly one subtree
+	double singlechild;
+#ifdef _SYMTREE_BURST_CONTAINERS
+	// number of containers, and of keys held in their entries
+	size_t containers;
+	size_t containerkeys;
+#endif
+} symtree_stats_t;
+
+// Allocate a symbol tree.
+// @returns Created and zeroed symbol tree. Returns NULL if failed to allocate memory.
+static symtree_t *alloc_symtree(void);
+
+// Free a symbol tree, along with any values loaded into it by append_symtree.
+// @param tree Symbol tree to free.
+static void free_symtree(symtree_t *tree);
+
+// Clone a symbol tree, copying every node unless _SYMTREE_COPY_ON_WRITE is defined, in which case the clone shares them with the original until either tree modifies them.
+// Values are shared rather than copied, so del_sym no longer frees values of either tree once it has been cloned.
+// @param tree Symbol tree to clone.
+// @returns Cloned symbol tree. Returns NULL if failed to allocate memory.
+static symtree_t *clone_symtree(symtree_t *tree);
+
+// Build a symbol tree from keys sorted in any order that keeps keys sharing a prefix together, such as strcmp order.
+// The keys are streamed once, without ever walking the tree from the root, and each subtree's nodes are allocated together depth-first.
+// If the keys turn out not to be sorted, the rest of them are added with new_sym.
+// Keys with characters outside of the alphabet are skipped. Later duplicates replace the values of earlier ones.
+// @param names Names of dictionary keys.
+// @param namelens Lengths of dictionary keys in bytes, or NULL to substitute strlen(name) for every key. Entries of 0 also substitute strlen(name).
+// @param values Values to set the symbols to.
+// @param count Number of keys.
+// @returns Built symbol tree. Returns NULL if failed to allocate memory.
+static symtree_t *symtree_build_sorted(const char *const *names, const size_t *namelens, VALUE_TYPE const *values, size_t count);
+
+// Locate a symbol and return its value.
+// @param tree Symbol tree to search.
+// @param name Dictionary key to search for.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @returns Symbol value.
+static VALUE_TYPE find_sym(symtree_t *tree, const char *name, size_t namelen);
+
+// Locate a symbol and return a pointer to its value.
+// @param tree Symbol tree to search.
+// @param name Dictionary key to search for.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @returns Pointer to symbol value.
+static VALUE_TYPE *find_sym_addr(symtree_t *tree, const char *name, size_t namelen);
+
+// Locate many symbols at once, interleaving the lookups so that their cache misses overlap.
+// @param tree Symbol tree to search.
+// @param names Dictionary keys to search for.
+// @param namelens Lengths of dictionary keys in bytes. Set to NULL or set individual lengths to 0 to substitute strlen.
+// @param values Array of count values to receive the results. Keys that are not found get NULL.
+// @param count Number of keys.
+// @returns Number of keys found with a non-NULL value.
+static size_t find_sym_batch(symtree_t *tree, const char *const *names, const size_t *namelens, VALUE_TYPE *values, size_t count);
+
+
+// Add a key to a symbol tree (if it doesn't exist) and assign a value.
+// @param tree Symbol tree to add to.
+// @param name Name of dictionary key.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @param value Value to set the symbol to.
+// @returns Value the symbol was set to, or NULL if failed.
+static VALUE_TYPE new_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+
+// Assign a value to a key in a symbol tree.
+// @param tree Symbol tree to modify.
+// @param name Name of dictionary key.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @param value Value to set the symbol to.
+// @returns Value the symbol was set to, or NULL if failed. (eg. the key doesn't exist)
+static VALUE_TYPE set_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+
+// Remove a key from a symbol tree.
+// @param tree Symbol tree to remove from.
+// @param name Name of dictionary key.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @param free_value Whether or not to free the value. Note: this uses free() not _free(), and values loaded by append_symtree are left to free_symtree.
+// @returns True if successfuly deleted the key, False if failed. (eg. the key doesn't exist)
+static bool del_sym(symtree_t *tree, const char *name, size_t namelen, bool free_value);
+
+// Remove subtrees that no longer lead to any value, such as those left behind by setting symbols to NULL.
+// del_sym already prunes the nodes of the key it removes, so this is only needed after other modifications.
+// @param tree Symbol tree to compact.
+// @returns Number of nodes freed.
+static size_t symtree_compact(symtree_t *tree);
+
+#ifdef _SYMTREE_WEIGHTS
+// Completion found by symtree_complete_topk.
+typedef struct {
+	const char *key;
+	size_t keylen;
+	VALUE_TYPE value;
+	uint32_t weight;
+} symtree_completion_t;
+
+// Add a key to a symbol tree (if it doesn't exist) and assign a value and weight.
+// new_sym leaves the weight of existing keys as it is, and gives new keys a weight of 0.
+// @param tree Symbol tree to add to.
+// @param name Name of dictionary key.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @param value Value to set the symbol to.
+// @param weight Weight to rank the key by in symtree_complete_topk.
+// @returns Value the symbol was set to, or NULL if failed.
+static VALUE_TYPE new_sym_weighted(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value, uint32_t weight);
+
+// Find the k heaviest keys beginning with a prefix, heaviest first.
+// Subtrees are visited best first by the largest weight within them, so the time taken depends on k and the length of the keys rather than the number of keys under the prefix.
+// Keys of equal weight are returned in no particular order.
+// @param tree Symbol tree to search.
+// @param prefix Key prefix to complete.
+// @param prefixlen Length of the prefix in bytes.
+// @param k Maximum number of completions to find.
+// @param count Set to the number of completions found.
+// @returns Array of completions, followed by their keys, in a single block to be freed with free(). Returns NULL if failed to allocate memory.
+static symtree_completion_t *symtree_complete_topk(symtree_t *tree, const char *prefix, size_t prefixlen, size_t k, size_t *count);
+#endif
+
+// Get the size of a symbol tree with or without including the lengths of value strings.
+// Takes constant time, using the counts kept by the tree.
+// @param tree Symbol tree to get the size of.
+// @param include_value_strings Whether to include value strings in the size calculation.
+// @returns Size of the symbol tree in bytes.
+static size_t symtree_size(symtree_t *tree, bool include_value_strings);
+
+// Get the number of nodes and keys of a symbol tree and the bytes they take, in constant time.
+// Values written through find_sym_addr are not counted. In concurrent mode, nodes waiting to be reclaimed are still counted.
+// @param tree Symbol tree to get the counts of.
+// @returns Counts of the tree.
+static symtree_counts_t symtree_counts(symtree_t *tree);
+
+#ifdef _SYMTREE_INTERN_VALUES
+// Get a tree's copy of a value, adding it to the tree's value store if no equal value is there yet.
+// The copy lasts as long as the tree (and its clones), and del_sym never frees it.
+// @param tree Symbol tree whose store to use.
+// @param value Value to intern.
+// @param len Length of the value in bytes. Set to 0 to substitute strlen(value).
+// @returns Interned value, or NULL if failed to allocate memory.
+static VALUE_TYPE symtree_intern(symtree_t *tree, const char *value, size_t len);
+
+// Get the length of a value interned by symtree_intern, without scanning it.
+// @param value Interned value.
+// @returns Length of the value in bytes, excluding its null terminator.
+static inline size_t symtree_interned_len(const char *value) {
+	uint32_t len;
+	memcpy(&len, value - sizeof(uint32_t), sizeof(uint32_t));
+	return len;
+}
+#endif
+
+// Measure the shape of a symbol tree by walking every node.
+// @param tree Symbol tree to measure.
+// @param stats Set to the measurements.
+// @returns True if success, False if failed to allocate memory.
+static bool symtree_stats(symtree_t *tree, symtree_stats_t *stats);
+
+#ifdef _SYMTREE_INSTRUMENT
+// Add up the counters of every thread that has used a symbol tree, including threads that have since exited.
+// Counters of running threads are read while they may be changing, so their latest counts may be missed.
+// @param metrics Set to the totals.
+static void symtree_metrics(symtree_metrics_t *metrics);
+
+// Zero the counters of every thread. Counts made by other threads at the same time may be kept.
+static void symtree_metrics_reset(void);
+
+// Hand the calling thread's counters over to the next thread that uses a symbol tree, keeping its counts in the totals.
+// Threads should call this before they exit, since their counters are otherwise never reused.
+static void symtree_metrics_thread_exit(void);
+
+// Set how many operations each thread makes per timed operation.
+// @param every Time one in this many operations, or 0 to stop timing operations.
+static void symtree_metrics_sample_every(unsigned every);
+
+// Estimate a latency percentile of an operation from its histogram.
+// @param metrics Counters returned by symtree_metrics.
+// @param op Operation, one of SYMTREE_OP_*.
+// @param percentile Percentile from 0 to 100.
+// @returns Upper bound in nanoseconds of the histogram bucket the percentile falls in, or 0 if the operation was never timed.
+static uint64_t symtree_metrics_percentile(const symtree_metrics_t *metrics, unsigned op, double percentile);
+
+// Register a hook to be called after each timed operation.
+// Hooks must be added and removed while no other thread is using a symbol tree.
+// @param hook Function to call.
+// @param context Passed to the hook.
+// @returns False if _SYMTREE_MAX_TRACE_HOOKS hooks are already registered.
+static bool symtree_add_trace_hook(symtree_trace_hook_t hook, void *context);
+
+// Unregister a hook added by symtree_add_trace_hook.
+// @returns False if the hook wasn't registered with the same context.
+static bool symtree_remove_trace_hook(symtree_trace_hook_t hook, void *context);
+#endif
+
+// Start iterating over the keys of a symbol tree that begin with a prefix.
+// Takes time proportional to the length of the prefix, after which each key costs the nodes between it and the previous one.
+// The tree must not be modified while iterating, other than through symtree_iter_seek after modifying it.
+// @param it Iterator to initialize.
+// @param tree Symbol tree to iterate over.
+// @param prefix Key prefix to restrict the keys to, or NULL to iterate over every key.
+// @param prefixlen Length of the prefix in bytes.
+// @returns True if success, False if failed to allocate memory for a long prefix.
+static bool symtree_iter_init(symtree_iter_t *it, symtree_t *tree, const char *prefix, size_t prefixlen);
+
+// Get the next key of an iteration, and its value.
+// @param it Iterator to advance.
+// @param key Set to the key, in canonical form and null-terminated. Valid until the iterator is advanced, seeked or freed.
+// @param keylen Set to the length of the key in bytes.
+// @param value Set to the key's value.
+// @returns True if a key was found, False once there are none left or if failed to allocate memory. (see it->failed)
+static bool symtree_iter_next(symtree_iter_t *it, const char **key, size_t *keylen, VALUE_TYPE *value);
+
+// Move an iterator so that it continues at the first key not ordered before key.
+// Can also be used to resume an iteration after modifying the tree, by seeking to the last key returned.
+// @param it Iterator to move.
+// @param key Key to seek to, including the iterator's prefix.
+// @param keylen Length of the key in bytes.
+// @returns True if success, False if failed to allocate memory.
+static bool symtree_iter_seek(symtree_iter_t *it, const char *key, size_t keylen);
+
+// Free any memory held by an iterator.
+// @param it Iterator to free.
+static void symtree_iter_free(symtree_iter_t *it);
+
+// Callback receiving each key found by find_sym_fuzzy.
+// @param context User pointer passed to find_sym_fuzzy.
+// @param key Key in canonical form, null-terminated. Only valid until the callback returns.
+// @param keylen Length of the key in bytes.
+// @param value Value of the key.
+// @param dist Edit distance between the key and the name searched for.
+// @returns True to continue searching, False to stop.
+typedef bool (*symtree_fuzzy_callback_t)(void *context, const char *key, size_t keylen, VALUE_TYPE value, unsigned dist);
+
+// Find every key within an edit distance of a name, in key number order.
+// The distance counts the characters inserted, deleted or substituted to turn one into the other. (Levenshtein distance)
+// The tree is walked once, extending a row of distances by each key character on the way down, and skipping subtrees once every distance in the row exceeds maxdist.
+// Characters are compared by key number, so characters mapped to the same key number match, and characters outside of the alphabet match nothing.
+// @param tree Symbol tree to search.
+// @param name Name to search for.
+// @param namelen Length of the name in bytes. Set to 0 to substitute strlen(name).
+// @param maxdist Largest edit distance of the keys to find.
+// @param callback Callback to pass each key found to.
+// @param context User pointer passed to the callback.
+// @returns True if success or stopped by the callback, False if failed to allocate memory.
+static bool find_sym_fuzzy(symtree_t *tree, const char *name, size_t namelen, unsigned maxdist, symtree_fuzzy_callback_t callback, void *context);
+
+// Dump a symbol tree to a semi-readable text format into a buffer for debugging the tree structure.
+// @param tree Symbol tree to dump.
+// @param buffer Buffer to dump text into.
+// @param bufferlen Length of the buffer to dump text into.
+// @param len Pointer to length of dumped text.
+// @returns True if success, False if the buffer isn't large enough.
+static bool debug_dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len);
+
+// Dump a symbol tree to a buffer in json format
+// @param tree Symbol tree to dump.
+// @param buffer Buffer to dump data into.
+// @param bufferlen Length of the buffer to dump text into.
+// @param len Pointer to length of dumped data. If the buffer isn't large enough, this is set to the length required.
+// @returns True if success, False if the buffer isn't large enough.
+static bool dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len);
+
+// Callback receiving chunks of a streaming dump.
+// @param context User pointer passed to dump_symtree_stream.
+// @param data Data to write.
+// @param len Length of data in bytes.
+// @returns True if success, False to abort the dump.
+typedef bool (*symtree_writer_t)(void *context, const char *data, size_t len);
+
+// Dump a symbol tree in json format through a writer callback, in chunks of _SYMTREE_DUMP_CHUNK_SIZE bytes.
+// The tree is walked iteratively, using memory proportional to the longest key rather than the size of the tree.
+// @param tree Symbol tree to dump.
+// @param write Callback to write chunks of data.
+// @param context User pointer passed to the callback.
+// @returns True if success, False if the writer failed or failed to allocate memory.
+static bool dump_symtree_stream(symtree_t *tree, symtree_writer_t write, void *context);
+
+// Dump a symbol tree in json format to a file.
+// @param tree Symbol tree to dump.
+// @param fd File to write to.
+// @returns True if success, False if failed to write the file.
+static bool dump_symtree_file(symtree_t *tree, FILE *fd);
+
+// Get the exact length of the json dump of a symbol tree, without writing it anywhere.
+// @param tree Symbol tree to measure.
+// @returns Length of the dump in bytes, or 0 if failed to allocate memory.
+static size_t dump_symtree_size(symtree_t *tree);
+
+// Load a symbol tree from json format.
+// @param data Binary data to load data from.
+// @param datalen Length of binary data to load from.
+// @returns Pointer to new symbol tree if success, NULL if failed.
+static symtree_t *load_symtree(const char *data, size_t datalen);
+
+// Load a symbol tree from json format, reporting where parsing failed.
+// @param data Binary data to load data from.
+// @param datalen Length of binary data to load from.
+// @param error Pointer to byte offset of the parse error, set if failed. May be NULL.
+// @returns Pointer to new symbol tree if success, NULL if failed.
+static symtree_t *load_symtree_ex(const char *data, size_t datalen, size_t *error);
+
+// Add symbols to a tree from data in json format.
+// @param tree Pointer to symbol tree to add data to.
+// @param data Binary data to load data from.
+// @param datalen Length of binary data to load from.
+// @returns Pointer to new symbol tree if success, NULL if failed.
+static symtree_t *append_symtree(symtree_t *tree, const char *data, size_t datalen);
+
+// Add symbols to a tree from data in json format, reporting where parsing failed.
+// Keys are inserted directly from the data, and values are unescaped into a single block owned by the tree, which is released by free_symtree.
+// Symbols added before a parse error are kept. Anything but whitespace after the closing brace is a parse error.
+// @param tree Pointer to symbol tree to add data to.
+// @param data Binary data to load data from.
+// @param datalen Length of binary data to load from.
+// @param error Pointer to byte offset of the parse error, set if failed. May be NULL.
+// @returns Pointer to new symbol tree if success, NULL if failed.
+static symtree_t *append_symtree_ex(symtree_t *tree, const char *data, size_t datalen, size_t *error);
+
+#ifdef _SYMTREE_PARALLEL
+// Add many keys to a symbol tree at once, building the subtree of each first key character on its own thread.
+// Keys whose first character already has a subtree in the tree are added on the calling thread.
+// @param tree Symbol tree to add to.
+// @param names Names of dictionary keys.
+// @param namelens Lengths of dictionary keys in bytes, or NULL to substitute strlen(name) for every key. Entries of 0 also substitute strlen(name).
+// @param values Values to set the symbols to.
+// @param count Number of keys.
+// @param threads Maximum number of threads to use, including the calling thread. Set to 0 to use one per processor.
+// @returns True if success, False if any key failed to be added. (eg. invalid characters or failed to allocate memory)
+static bool new_syms_parallel(symtree_t *tree, const char *const *names, const size_t *namelens, VALUE_TYPE const *values, size_t count, unsigned threads);
+
+// Load a symbol tree from json format, building the subtree of each first key character on its own thread.
+// @param data Binary data to load data from.
+// @param datalen Length of binary data to load from.
+// @param threads Maximum number of threads to use, including the calling thread. Set to 0 to use one per processor.
+// @param error Pointer to byte offset of the parse error, set if failed. May be NULL.
+// @returns Pointer to new symbol tree if success, NULL if failed.
+static symtree_t *load_symtree_parallel(const char *data, size_t datalen, unsigned threads, size_t *error);
+
+// Add symbols to a tree from data in json format, building the subtree of each first key character on its own thread.
+// The data is parsed in full before any symbols are added, so nothing is added if parsing fails.
+// @param tree Pointer to symbol tree to add data to.
+// @param data Binary data to load data from.
+// @param datalen Length of binary data to load from.
+// @param threads Maximum number of threads to use, including the calling thread. Set to 0 to use one per processor.
+// @param error Pointer to byte offset of the parse error, set if failed. May be NULL.
+// @returns Pointer to the symbol tree if success, NULL if failed.
+static symtree_t *append_symtree_parallel(symtree_t *tree, const char *data, size_t datalen, unsigned threads, size_t *error);
+#endif
+
+#ifdef _SYMTREE_CONCURRENT
+// Register the calling thread as a reader of a symbol tree.
+// Lookups (find_sym, find_sym_addr and find_sym_batch) are safe while another thread modifies the tree, as long as they are made within a read section.
+// @param tree Symbol tree to read.
+// @returns Reader to pass to symtree_read_begin and symtree_read_end, or NULL if _SYMTREE_MAX_READERS readers are already registered.
+static symtree_reader_t *symtree_register_reader(symtree_t *tree);
+
+// Give up a reader's slot. The reader must not be inside a read section.
+// @param reader Reader returned by symtree_register_reader.
+static void symtree_unregister_reader(symtree_reader_t *reader);
+
+// Start a read section. Nodes and values seen within it are not freed until it ends.
+// Read sections should be kept short, since the memory retired by the writer meanwhile builds up until they end.
+// @param reader Reader returned by symtree_register_reader.
+static inline void symtree_read_begin(symtree_reader_t *reader);
+
+// End a read section. Values found within it must not be used afterwards if they may be freed by del_sym.
+// @param reader Reader returned by symtree_register_reader.
+static inline void symtree_read_end(symtree_reader_t *reader);
+
+#ifdef _SYMTREE_ATOMIC_INSERT
+// Add a key to a symbol tree (if it doesn't exist) and assign a value, while other threads may be doing the same.
+// Missing subtrees are installed with compare-and-swap; a thread that loses the race frees its node and continues down the winner's.
+// May run alongside lookups and other calls to new_sym_atomic, but not alongside new_sym, set_sym, del_sym or symtree_compact.
+// Only available without adaptive nodes and path compression.
+// @param tree Symbol tree to add to.
+// @param name Name of dictionary key.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @param value Value to set the symbol to.
+// @returns Value the symbol was set to, or NULL if failed.
+static VALUE_TYPE new_sym_atomic(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+#endif
+
+// Free the nodes and values retired by the writer that no reader can still see.
+// The writer calls this on its own every _SYMTREE_RECLAIM_THRESHOLD retirements. Must only be called by the writer.
+// @param tree Symbol tree to reclaim memory of.
+// @returns Number of retired nodes and values still waiting for readers.
+static size_t symtree_reclaim(symtree_t *tree);
+#endif
+
+#ifdef _SYMTREE_SNAPSHOTS
+// Write a symbol tree to a file as a binary snapshot, which can be mapped back in with open_symtree_snapshot.
+// Chains of subtrees without values are stored as labeled edges, regardless of the tree's configuration.
+// Values are copied with _SYMTREE_SNAPSHOT_VALUE_SIZE bytes each, which assumes C strings unless redefined.
+// @param tree Symbol tree to save.
+// @param fd File to write to, opened in binary mode. Must be seekable.
+// @returns True if success, False if failed to write the file or the snapshot would exceed 32 gigabytes.
+static bool save_symtree_snapshot(symtree_t *tree, FILE *fd);
+
+// Map a binary snapshot file into memory for lookups with find_sym_snapshot.
+// Nothing is copied or allocated, so several processes mapping the same file share its pages.
+// @param snap Snapshot to initialize.
+// @param path Path of the snapshot file.
+// @returns True if success, False if the file could not be mapped or isn't a valid snapshot.
+static bool open_symtree_snapshot(symtree_snapshot_t *snap, const char *path);
+
+// Use a binary snapshot already in memory for lookups with find_sym_snapshot.
+// The data must stay valid and 8-byte aligned while the snapshot is in use.
+// Every offset followed by find_sym_snapshot is checked against the image size, so corrupt data is not read out of bounds.
+// @param snap Snapshot to initialize.
+// @param data Snapshot image.
+// @param size Size of the snapshot image in bytes.
+// @returns True if success, False if the data isn't a valid snapshot.
+static bool init_symtree_snapshot(symtree_snapshot_t *snap, const void *data, size_t size);
+
+// Unmap a snapshot opened with open_symtree_snapshot.
+// @param snap Snapshot to close.
+static void close_symtree_snapshot(symtree_snapshot_t *snap);
+
+// Locate a symbol in a snapshot and return its value.
+// The value points into the snapshot, and must not be modified or freed.
+// @param snap Snapshot to search.
+// @param name Dictionary key to search for.
+// @param namelen Length of dictionary key in bytes. Set to 0 to substitute strlen(name).
+// @returns Symbol value, or NULL if not found or the snapshot is corrupt.
+static VALUE_TYPE find_sym_snapshot(const symtree_snapshot_t *snap, const char *name, size_t namelen);
+#endif
+
+
+
+// Allocate a zeroed subtree node.
+// In adaptive node mode, kind selects the node width.
+// In path compression mode, room is made for a label of labellen characters.
+// Containers are made with room for labellen bytes of entries.
+static symtree_t *_alloc_symtree_node(symtree_info_t *info, uint8_t kind, size_t labellen);
+
+// Free a subtree node. (not including its subtrees)
+static void _symtree_free_node(symtree_info_t *info, symtree_t *tree);
+
+// Functions used internally within find_sym_addr, new_sym, set_sym, del_sym and new_sym_atomic, which time them.
+static VALUE_TYPE *_find_sym_addr(symtree_t *tree, const char *name, size_t namelen);
+static VALUE_TYPE _new_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+static VALUE_TYPE _set_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+static bool _del_sym(symtree_t *tree, const char *name, size_t namelen, bool free_value);
+#ifdef _SYMTREE_ATOMIC_INSERT
+static VALUE_TYPE _new_sym_atomic(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value);
+#endif
+
+#ifdef _SYMTREE_INSTRUMENT
+// Counters of the calling thread, or NULL until its first operation.
+static _SYMTREE_THREAD_LOCAL _symtree_metrics_block_t *_symtree_metrics_self;
+// Every thread's counters, newest first. Blocks are never freed, only handed over to other threads.
+static _symtree_metrics_block_t *volatile _symtree_metrics_blocks;
+// Counters shared by threads that failed to allocate their own.
+static _symtree_metrics_block_t _symtree_metrics_shared;
+static volatile unsigned _symtree_sample_every = _SYMTREE_LATENCY_SAMPLE;
+static symtree_trace_hook_t _symtree_trace_hooks[_SYMTREE_MAX_TRACE_HOOKS];
+static void *_symtree_trace_contexts[_SYMTREE_MAX_TRACE_HOOKS];
+static unsigned _symtree_num_trace_hooks;
+
+// Claim a block of counters for the calling thread, reusing one handed over by an exited thread if there is one.
+// @returns Claimed block, or the shared block if failed to allocate memory.
+static _symtree_metrics_block_t *_symtree_metrics_attach(void);
+
+// Get the counters of the calling thread.
+static inline symtree_metrics_t *_symtree_metrics_local(void);
+
+// Add one set of counters to another.
+static void _symtree_metrics_add(symtree_metrics_t *metrics, const symtree_metrics_t *add);
+
+// Start an operation, counting it.
+// @returns Time the operation started, or 0 if it isn't timed.
+static inline uint64_t _symtree_op_begin(unsigned op);
+
+// Finish an operation, recording its latency and calling the trace hooks if it is timed.
+static inline void _symtree_op_end(unsigned op, uint64_t start, symtree_t *tree, const char *name, size_t namelen, bool found);
+
+#define _SYMTREE_COUNT(field, n) (_symtree_metrics_local()->field += (n))
+#define _SYMTREE_OP_BEGIN(op) uint64_t _symtree_op_start = _symtree_op_begin(op)
+#define _SYMTREE_OP_END(op, tree, name, namelen, found) _symtree_op_end((op), _symtree_op_start, (tree), (name), (namelen), (found))
+#else
+#define _SYMTREE_COUNT(field, n) ((void)(n))
+#define _SYMTREE_OP_BEGIN(op)
+#define _SYMTREE_OP_END(op, tree, name, namelen, found)
+#endif
+
+#ifdef _SYMTREE_CONCURRENT
+// Queue a node or value unlinked by the writer to be freed once no reader can still see it.
+// @param p Node or value.
+// @param node True if p is a node, False if p is a value to free with free().
+static void _symtree_retire(symtree_info_t *info, void *p, bool node);
+
+// Advance the epoch and free everything retired before the oldest epoch a reader is still in.
+// @returns Number of retired nodes and values still waiting for readers.
+static size_t _symtree_reclaim(symtree_info_t *info);
+
+// Free a node that has been unlinked from a tree, once readers are done with it.
+#define _symtree_retire_node(info, tree) _symtree_retire((info), (tree), true)
+#else
+#define _symtree_retire_node(info, tree) _symtree_free_node((info), (tree))
+#endif
+
+#ifdef _SYMTREE_COPY_ON_WRITE
+// Let go of a node that has been replaced by a copy, which took over the references to its subtrees.
+// A node still used by another tree is kept, and its subtrees count the copy as another parent.
+static void _symtree_drop_node(symtree_info_t *info, symtree_t *tree);
+
+// Make sure subtree st (key number c of a node not shared with other trees) is not shared either, copying it if it is.
+// @returns The unshared subtree, or NULL if failed to copy it.
+static symtree_t *_symtree_unshare(symtree_info_t *info, symtree_t *tree, unsigned c, symtree_t *st);
+#else
+// Let go of a node that has been replaced by a copy.
+#define _symtree_drop_node(info, tree) _symtree_retire_node((info), (tree))
+#endif
+
+#ifdef _SYMTREE_WEIGHTS
+// Weight of a node's own value, which only counts while it has one.
+#define _SYMTREE_LEAF_WEIGHT(t) ((t)->leaf != NULL ? (t)->weight : 0)
+
+// Bring the largest weights of the nodes on the path of a key up to date, after its value or weight has changed.
+// @param set Whether to set the weight of the key's node to weight first.
+// @returns False if the key has no node, or if failed to allocate memory for a long path. (in which case the largest weights are left too high, which only costs symtree_complete_topk time)
+static bool _symtree_reweigh(symtree_t *tree, const char *name, size_t namelen, bool set, uint32_t weight);
+#endif
+
+// Get the size in bytes of a single node, excluding its label.
+static inline size_t _symtree_node_base_size(symtree_t *tree);
+
+#ifdef _SYMTREE_ADAPTIVE_NODES
+// Get the size in bytes of a node of a kind, excluding its label.
+static inline size_t _symtree_kind_size(uint8_t kind);
+#endif
+
+// Get the size in bytes of a single node.
+static inline size_t _symtree_node_size(symtree_t *tree) {
+#ifdef _SYMTREE_BURST_CONTAINERS
+	if (_SYMTREE_NODE_KIND(tree) == _SYMTREE_NODE_BURST) {
+		return _SYMTREE_BUCKET_OFFSET + _symtree_bucket_capacity(tree);
+	}
+#endif
+	return _symtree_node_base_size(tree) + _SYMTREE_LABEL_LEN(tree);
+}
+
+#ifdef _SYMTREE_INSTRUMENT
+// Returns a monotonic time in nanoseconds.
+static inline uint64_t _symtree_now(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static _symtree_metrics_block_t *_symtree_metrics_attach(void) {
+	_symtree_metrics_block_t *block, *head;
+	for (block = _symtree_metrics_blocks; block != NULL; block = block->next) {
+		if (block->owned == 0 && _SYMTREE_METRICS_CLAIM(&block->owned)) {
+			return block;
+		}
+	}
+	if ((block = (_symtree_metrics_block_t*)calloc(1, sizeof(_symtree_metrics_block_t))) == NULL) {
+		return &_symtree_metrics_shared;
+	}
+	block->owned = 1;
+	do {
+		head = _symtree_metrics_blocks;
+		block->next = head;
+	} while (!_SYMTREE_METRICS_PUSH(&_symtree_metrics_blocks, head, block));
+	return block;
+}
+
+static inline symtree_metrics_t *_symtree_metrics_local(void) {
+	if (_symtree_metrics_self == NULL) {
+		_symtree_metrics_self = _symtree_metrics_attach();
+	}
+	return &_symtree_metrics_self->metrics;
+}
+
+static inline uint64_t _symtree_op_begin(unsigned op) {
+	_symtree_metrics_block_t *block;
+	uint64_t t;
+	_symtree_metrics_local()->ops[op]++;
+	block = _symtree_metrics_self;
+	if (_symtree_sample_every == 0 || ++block->sincesample < _symtree_sample_every) {
+		return 0;
+	}
+	block->sincesample = 0;
+	t = _symtree_now();
+	return t != 0 ? t : 1;
+}
+
+static inline void _symtree_op_end(unsigned op, uint64_t start, symtree_t *tree, const char *name, size_t namelen, bool found) {
+	symtree_metrics_t *metrics;
+	uint64_t ns;
+	unsigned b = 0;
+	if (start == 0) {
+		return;
+	}
+	ns = _symtree_now() - start;
+	metrics = _symtree_metrics_local();
+	while (b < _SYMTREE_LATENCY_BUCKETS - 1 && (ns >> (b + 1)) != 0) {
+		b++;
+	}
+	metrics->sampled[op]++;
+	metrics->latency[op][b]++;
+	for (unsigned i=0; i<_symtree_num_trace_hooks; i++) {
+		_symtree_trace_hooks[i](_symtree_trace_contexts[i], tree, op, name, namelen, found, ns);
+	}
+}
+#endif
+
+static symtree_t *_alloc_symtree_node(symtree_info_t *info, uint8_t kind, size_t labellen) {
+	symtree_t *tree;
+	size_t size;
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	size = _symtree_kind_size(kind) + labellen;
+#else
+	size = sizeof(symtree_t) + labellen;
+#endif
+#if defined(_SYMTREE_USE_PAGED_NODES)
+	tree = (symtree_t*)_symtree_page_alloc(info, size);
+#elif defined(_SYMTREE_USE_ARENA)
+	tree = (symtree_t*)_symtree_arena_alloc(info, size);
+#else
+	tree = (symtree_t*)_malloc(size);
+#endif
+	if (tree == NULL) {
+		_SYMTREE_COUNT(allocfailures, 1);
+		return NULL;
+	}
+	_SYMTREE_COUNT(nodesallocated, 1);
+	memset(tree, 0, size);
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	_SYMTREE_NODE_KIND(tree) = kind;
+#endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+	_SYMTREE_NODE_FIELD(tree, uint16_t, labellen) = labellen;
+#endif
+#ifdef _SYMTREE_COPY_ON_WRITE
+	_SYMTREE_NODE_FIELD(tree, uint32_t, refs) = 1;
+#endif
+	info->counts.nodes++;
+	info->counts.nodebytes += size;
+	return tree;
+}
+
+static void _symtree_free_node(symtree_info_t *info, symtree_t *tree) {
+	_SYMTREE_COUNT(nodesfreed, 1);
+	info->counts.nodes--;
+	info->counts.nodebytes -= _symtree_node_size(tree);
+#ifdef _SYMTREE_USE_PAGED_NODES
+	// give back the node's escape entries
+	for (unsigned i=0; i<_SYMTREE_NUM_CHARS; i++) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+		if (tree->kind != _SYMTREE_NODE_FULL && i >= tree->count) {
+			break;
+		}
+#endif
+		_SYMTREE_RELEASE_REF(tree, i);
+	}
+#endif
+#ifdef _SYMTREE_USE_ARENA
+	_symtree_arena_free(info, tree, _symtree_node_size(tree));
+#else
+	_free(tree);
+#endif
+}
+
+#ifdef _SYMTREE_CONCURRENT
+static void _symtree_retire(symtree_info_t *info, void *p, bool node) {
+	_symtree_retired_t *retired;
+	size_t max;
+	if (info->numretired >= info->maxretired) {
+		max = info->maxretired < 64 ? 64 : info->maxretired * 2;
+		if ((retired = (_symtree_retired_t*)realloc(info->retired, max * sizeof(_symtree_retired_t))) == NULL) {
+			// without a record of it there is no safe time to free it, so it is leaked instead
+			return;
+		}
+		info->retired = retired;
+		info->maxretired = max;
+	}
+	info->retired[info->numretired].p = p;
+	info->retired[info->numretired].epoch = info->epochs->epoch;
+	info->retired[info->numretired].node = node;
+	if (++info->numretired >= info->reclaimat) {
+		_symtree_reclaim(info);
+	}
+}
+
+static size_t _symtree_reclaim(symtree_info_t *info) {
+	_symtree_epochs_t *epochs = info->epochs;
+	size_t oldest, e, n;
+	// readers starting after the increment cannot reach anything that was unlinked before it
+	_SYMTREE_FULL_FENCE();
+	oldest = epochs->epoch + 1;
+	_SYMTREE_STORE(&epochs->epoch, oldest);
+	_SYMTREE_FULL_FENCE();
+	for (unsigned i=0; i<_SYMTREE_MAX_READERS; i++) {
+		if ((e = _SYMTREE_LOAD(&epochs->readers[i].epoch)) != 0 && e < oldest) {
+			oldest = e;
+		}
+	}
+	_SYMTREE_FULL_FENCE();
+	// retirements are recorded in epoch order
+	for (n=0; n<info->numretired && info->retired[n].epoch < oldest; n++) {
+		if (info->retired[n].node) {
+			_symtree_free_node(info, (symtree_t*)info->retired[n].p);
+		} else {
+			free(info->retired[n].p);
+		}
+	}
+	if (n > 0) {
+		memmove(info->retired, &info->retired[n], (info->numretired - n) * sizeof(_symtree_retired_t));
+		info->numretired -= n;
+	}
+	// readers that stay in a read section keep some memory pinned, so don't rescan on every retirement meanwhile
+	info->reclaimat = info->numretired + _SYMTREE_RECLAIM_THRESHOLD;
+	return info->numretired;
+}
+#endif
+
+#ifdef _SYMTREE_ADAPTIVE_NODES
+static inline size_t _symtree_kind_size(uint8_t kind) {
+	switch (kind) {
+		case _SYMTREE_NODE4:
+			return offsetof(symtree_t, symbols) + 4 * (sizeof(symtree_ref_t) + 1);
+		case _SYMTREE_NODE16:
+			return offsetof(symtree_t, symbols) + 16 * (sizeof(symtree_ref_t) + 1);
+		case _SYMTREE_NODE48:
+			return offsetof(symtree_t, symbols) + 48 * sizeof(symtree_ref_t) + _SYMTREE_NUM_CHARS;
+#ifdef _SYMTREE_BURST_CONTAINERS
+		case _SYMTREE_NODE_BURST:
+			return _SYMTREE_BUCKET_OFFSET;
+#endif
+		default:
+			return sizeof(symtree_t);
+	}
+}
+
+static inline size_t _symtree_node_base_size(symtree_t *tree) {
+	return _symtree_kind_size(_SYMTREE_NODE_KIND(tree));
+}
+
+// Returns the narrowest node kind able to hold count children.
+static inline uint8_t _symtree_fit_kind(unsigned count) {
+	if (count <= 4 && 4 < _SYMTREE_NUM_CHARS) {
+		return _SYMTREE_NODE4;
+	}
+	if (count <= 16 && 16 < _SYMTREE_NUM_CHARS) {
+		return _SYMTREE_NODE16;
+	}
+	if (count <= 48 && 48 < _SYMTREE_NUM_CHARS) {
+		return _SYMTREE_NODE48;
+	}
+	return _SYMTREE_NODE_FULL;
+}
+#define _SYMTREE_NEW_NODE_KIND _symtree_fit_kind(1)
+#else
+static inline size_t _symtree_node_base_size(symtree_t *tree) {
+	return sizeof(symtree_t);
+}
+#define _SYMTREE_NEW_NODE_KIND 0
+#endif
+
+// Get the subtree of a node for key number c.
+// @returns Subtree, or NULL if there is none.
+static inline symtree_t *_symtree_child(symtree_t *tree, unsigned c) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	unsigned i;
+	uint8_t *keys;
+	switch (tree->kind) {
+		case _SYMTREE_NODE4:
+			keys = _SYMTREE_NODE_KEYS(tree);
+			for (i=0; i<tree->count; i++) {
+				if (keys[i] == c) {
+					return _SYMTREE_CHILD_SLOT(tree, i);
+				}
+			}
+			return NULL;
+		case _SYMTREE_NODE16:
+			keys = _SYMTREE_NODE_KEYS(tree);
+#ifdef __SSE2__
+			i = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)c), _mm_loadu_si128((const __m128i*)keys)));
+			i &= (1u << tree->count) - 1;
+			if (i == 0) {
+				return NULL;
+			}
+			return _SYMTREE_CHILD_SLOT(tree, __builtin_ctz(i));
+#else
+			for (i=0; i<tree->count; i++) {
+				if (keys[i] == c) {
+					return _SYMTREE_CHILD_SLOT(tree, i);
+				}
+			}
+			return NULL;
+#endif
+		case _SYMTREE_NODE48:
+			// the writer adds to 48-wide nodes in place, filling the slot before the key table entry
+#ifdef _SYMTREE_CONCURRENT
+			if ((i = _SYMTREE_LOAD((volatile uint8_t*)&_SYMTREE_NODE_KEYS(tree)[c])) == 0) {
+#else
+			if ((i = _SYMTREE_NODE_KEYS(tree)[c]) == 0) {
+#endif
+				return NULL;
+			}
+			return _SYMTREE_CHILD_SLOT(tree, i-1);
+#ifdef _SYMTREE_BURST_CONTAINERS
+		case _SYMTREE_NODE_BURST:
+			return NULL;
+#endif
+		default:
+			break;
+	}
+#endif
+#ifdef _SYMTREE_CONCURRENT
+	// the writer may clear the slot between two loads
+	return _symtree_load_child(tree, c);
+#else
+	if (tree->symbols[c] == _SYM_NULL) {
+		return NULL;
+	}
+	return _READ_SYMBOL_TREE(tree, c);
+#endif
+}
+
+// Find the lowest key number >= c that a node has a subtree for.
+// @param child Set to the subtree if found.
+// @returns Key number, or -1 if there is none.
+static int _symtree_next_child(symtree_t *tree, unsigned c, symtree_t **child) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	unsigned i;
+	uint8_t *keys;
+	if (tree->kind == _SYMTREE_NODE4 || tree->kind == _SYMTREE_NODE16) {
+		keys = _SYMTREE_NODE_KEYS(tree);
+		for (i=0; i<tree->count; i++) {
+			if (keys[i] >= c) {
+				*child = _READ_SYMBOL_TREE(tree, i);
+				return keys[i];
+			}
+		}
+		return -1;
+	} else if (tree->kind == _SYMTREE_NODE48) {
+		keys = _SYMTREE_NODE_KEYS(tree);
+		for (; c<_SYMTREE_NUM_CHARS; c++) {
+			if (keys[c] != 0) {
+				*child = _READ_SYMBOL_TREE(tree, keys[c]-1);
+				return c;
+			}
+		}
+		return -1;
+	}
+#ifdef _SYMTREE_BURST_CONTAINERS
+	if (tree->kind == _SYMTREE_NODE_BURST) {
+		return -1;
+	}
+#endif
+#endif
+	for (; c<_SYMTREE_NUM_CHARS; c++) {
+		if (tree->symbols[c] != _SYM_NULL) {
+			*child = _READ_SYMBOL_TREE(tree, c);
+			return c;
+		}
+	}
+	return -1;
+}
+
+// Iterate over the subtrees of a node in key number order.
+#define _SYMTREE_FOREACH_CHILD(tree, c, child) for (int c = _symtree_next_child((tree), 0, &(child)); c >= 0; c = _symtree_next_child((tree), c+1, &(child)))
+
+// Write a subtree reference into slot i of a node, checking that it could be encoded.
+// @returns True if success, False if the subtree is out of range of the node. (in which case the slot is left unchanged)
+static inline bool _symtree_set_ref(symtree_t *tree, unsigned i, symtree_t *st) {
+#ifdef _SYMTREE_CONCURRENT
+	// the subtree has to be complete before readers can reach it, and references within the arena are always in range
+	_SYMTREE_STORE((volatile symtree_ref_t*)&tree->symbols[i], _SYMTREE_ENCODE_REF(tree, st));
+	return true;
+#else
+	symtree_ref_t old = tree->symbols[i];
+	_WRITE_SYMBOL_TREE(tree, i, st);
+	if (tree->symbols[i] != _SYM_NULL && _READ_SYMBOL_TREE(tree, i) == st) {
+		return true;
+	}
+	tree->symbols[i] = old;
+	return false;
+#endif
+}
+
+// Store a subtree into a node for key number c, overwriting any existing subtree for c.
+// In adaptive node mode, the node must have room for another child if c is not present.
+// @returns True if success, False if the subtree is out of range of the node. (in which case the node is left unchanged)
+static bool _symtree_put_child(symtree_t *tree, unsigned c, symtree_t *st) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	unsigned i;
+	uint8_t *keys = _SYMTREE_NODE_KEYS(tree);
+	if (tree->kind == _SYMTREE_NODE4 || tree->kind == _SYMTREE_NODE16) {
+		for (i=0; i<tree->count && keys[i] < c; i++);
+		if (i < tree->count && keys[i] == c) {
+			return _symtree_set_ref(tree, i, st);
+		}
+		// subtree references are relative to the node, not the slot, so they can be moved as-is
+		memmove(&keys[i+1], &keys[i], tree->count - i);
+		memmove(&tree->symbols[i+1], &tree->symbols[i], (tree->count - i) * sizeof(symtree_ref_t));
+		tree->symbols[i] = _SYM_NULL;
+		keys[i] = c;
+		tree->count++;
+		if (_symtree_set_ref(tree, i, st)) {
+			return true;
+		}
+		tree->count--;
+		memmove(&keys[i], &keys[i+1], tree->count - i);
+		memmove(&tree->symbols[i], &tree->symbols[i+1], (tree->count - i) * sizeof(symtree_ref_t));
+		tree->symbols[tree->count] = _SYM_NULL;
+		return false;
+	} else if (tree->kind == _SYMTREE_NODE48) {
+		if ((i = keys[c]) != 0) {
+			return _symtree_set_ref(tree, i-1, st);
+		}
+		// the slot past the used ones is not visible to readers until the key table points to it
+		if (!_symtree_set_ref(tree, tree->count, st)) {
+			return false;
+		}
+		tree->count++;
+#ifdef _SYMTREE_CONCURRENT
+		_SYMTREE_STORE((volatile uint8_t*)&keys[c], (uint8_t)tree->count);
+#else
+		keys[c] = tree->count;
+#endif
+		return true;
+	}
+	if (tree->symbols[c] == _SYM_NULL) {
+		if (!_symtree_set_ref(tree, c, st)) {
+			return false;
+		}
+		tree->count++;
+		return true;
+	}
+#endif
+	return _symtree_set_ref(tree, c, st);
+}
+
+// Copy a node's leaf and subtrees into a new node of a different kind and/or with a different label.
+// The old node is not freed. label may point into the old node's own label.
+// @returns New node, or NULL if failed to allocate memory or encode a subtree reference.
+static symtree_t *_symtree_copy_node(symtree_info_t *info, symtree_t *tree, uint8_t kind, const uint8_t *label, size_t labellen) {
+	symtree_t *nt, *st;
+	_SYMTREE_ALLOC_NEAR(info, tree);
+	if ((nt = _alloc_symtree_node(info, kind, labellen)) == NULL) {
+		return NULL;
+	}
+#ifdef _SYMTREE_PATH_COMPRESSION
+	memcpy(_SYMTREE_LABEL(nt), label, labellen);
+#endif
+	nt->leaf = tree->leaf;
+#ifdef _SYMTREE_WEIGHTS
+	nt->weight = tree->weight;
+	nt->maxweight = tree->maxweight;
+#endif
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+		if (!_symtree_put_child(nt, c, st)) {
+			_symtree_free_node(info, nt);
+			return NULL;
+		}
+	}
+	return nt;
+}
+
+// Copy a node's leaf, label and subtrees into a new node, of a different kind in adaptive node mode.
+#ifdef _SYMTREE_PATH_COMPRESSION
+#define _symtree_resize_node(info, tree, kind) _symtree_copy_node((info), (tree), (kind), _SYMTREE_LABEL(tree), (tree)->labellen)
+#else
+#define _symtree_resize_node(info, tree, kind) _symtree_copy_node((info), (tree), (kind), NULL, 0)
+#endif
+
+#ifdef _SYMTREE_COPY_ON_WRITE
+static void _symtree_drop_node(symtree_info_t *info, symtree_t *tree) {
+	symtree_t *st;
+	if (tree->refs > 1) {
+		tree->refs--;
+		_SYMTREE_FOREACH_CHILD(tree, c, st) {
+			st->refs++;
+		}
+		// the node lives on in other trees, but is no longer part of this one
+		info->counts.nodes--;
+		info->counts.nodebytes -= _symtree_node_size(tree);
+		return;
+	}
+	_symtree_free_node(info, tree);
+}
+
+static symtree_t *_symtree_unshare(symtree_info_t *info, symtree_t *tree, unsigned c, symtree_t *st) {
+	symtree_t *nt;
+	if (st->refs <= 1) {
+		return st;
+	}
+	if ((nt = _symtree_resize_node(info, st, _SYMTREE_NODE_KIND(st))) == NULL) {
+		return NULL;
+	}
+	if (!_symtree_put_child(tree, c, nt)) {
+		_symtree_free_node(info, nt);
+		return NULL;
+	}
+	_symtree_drop_node(info, st);
+	return nt;
+}
+#endif
+
+// Link a new subtree into a node for key number c, growing the node if it is full.
+// @param parent Node referencing tree, or NULL if tree is a root node.
+// @param pc Key number of tree within parent.
+// @returns tree, or its replacement if it was grown. NULL if failed to allocate memory or encode a subtree reference.
+// Note: tree may have been replaced even if this fails.
+static symtree_t *_symtree_add_child(symtree_info_t *info, symtree_t *parent, unsigned pc, symtree_t *tree, unsigned c, symtree_t *st) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	symtree_t *nt;
+#ifdef _SYMTREE_CONCURRENT
+	// inserting into a 4/16-wide node shifts its entries around under any readers, so a copy with the new child replaces it instead
+	if (tree->kind == _SYMTREE_NODE4 || tree->kind == _SYMTREE_NODE16 || (tree->kind == _SYMTREE_NODE48 && tree->count >= symtree_node_capacity[tree->kind])) {
+		if ((nt = _symtree_resize_node(info, tree, _symtree_fit_kind(tree->count + 1))) == NULL) {
+			return NULL;
+		}
+		if (!_symtree_put_child(nt, c, st) || !_symtree_put_child(parent, pc, nt)) {
+			_symtree_free_node(info, nt);
+			return NULL;
+		}
+		_symtree_drop_node(info, tree);
+		return nt;
+	}
+#else
+	if (tree->kind != _SYMTREE_NODE_FULL && tree->count >= symtree_node_capacity[tree->kind]) {
+		if ((nt = _symtree_resize_node(info, tree, _symtree_fit_kind(tree->count + 1))) == NULL) {
+			return NULL;
+		}
+		if (!_symtree_put_child(parent, pc, nt)) {
+			_symtree_free_node(info, nt);
+			return NULL;
+		}
+		_symtree_drop_node(info, tree);
+		tree = nt;
+	}
+#endif
+#endif
+	if (!_symtree_put_child(tree, c, st)) {
+		return NULL;
+	}
+	return tree;
+}
+
+#ifdef _SYMTREE_ADAPTIVE_NODES
+// Unlink the subtree for key number c from a node in place, if it has one.
+static void _symtree_unlink_child(symtree_t *tree, unsigned c) {
+	unsigned i, last;
+	uint8_t *keys = _SYMTREE_NODE_KEYS(tree);
+	if (tree->kind == _SYMTREE_NODE4 || tree->kind == _SYMTREE_NODE16) {
+		for (i=0; i<tree->count && keys[i] != c; i++);
+		if (i >= tree->count) {
+			return;
+		}
+		_SYMTREE_RELEASE_REF(tree, i);
+		tree->count--;
+		memmove(&keys[i], &keys[i+1], tree->count - i);
+		memmove(&tree->symbols[i], &tree->symbols[i+1], (tree->count - i) * sizeof(symtree_ref_t));
+		// unused slots are kept null
+		tree->symbols[tree->count] = _SYM_NULL;
+	} else if (tree->kind == _SYMTREE_NODE48) {
+		if ((i = keys[c]) == 0) {
+			return;
+		}
+		_SYMTREE_RELEASE_REF(tree, i-1);
+		keys[c] = 0;
+		last = tree->count--;
+		if (i != last) {
+			// keep slots dense by moving the last slot into the hole
+			tree->symbols[i-1] = tree->symbols[last-1];
+			for (c=0; keys[c] != last; c++);
+			keys[c] = i;
+		}
+		tree->symbols[last-1] = _SYM_NULL;
+	} else {
+		if (tree->symbols[c] == _SYM_NULL) {
+			return;
+		}
+		_SYMTREE_RELEASE_REF(tree, c);
+#ifdef _SYMTREE_CONCURRENT
+		_SYMTREE_STORE((volatile symtree_ref_t*)&tree->symbols[c], _SYM_NULL);
+#else
+		tree->symbols[c] = _SYM_NULL;
+#endif
+		tree->count--;
+	}
+}
+#endif
+
+// Unlink the subtree for key number c from a node, shrinking the node if it became sparse.
+// The subtree itself is not freed.
+// @param parent Node referencing tree, or NULL if tree is a root node.
+// @param pc Key number of tree within parent.
+// @returns tree, or its replacement if it was shrunk or copied.
+// In concurrent mode, returns NULL if the node could not be copied, in which case the subtree is left linked.
+static symtree_t *_symtree_remove_child(symtree_info_t *info, symtree_t *parent, unsigned pc, symtree_t *tree, unsigned c) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	uint8_t kind;
+	symtree_t *nt;
+#ifdef _SYMTREE_CONCURRENT
+	if (tree->kind != _SYMTREE_NODE_FULL) {
+		// narrower nodes are rearranged when a child is removed, so readers are given a copy without it instead
+		if (_symtree_child(tree, c) == NULL) {
+			return tree;
+		}
+		if ((kind = _symtree_fit_kind((tree->count - 1) * 2)) > tree->kind) {
+			kind = tree->kind;
+		}
+		if ((nt = _symtree_resize_node(info, tree, kind)) == NULL) {
+			return NULL;
+		}
+		_symtree_unlink_child(nt, c);
+		if (!_symtree_put_child(parent, pc, nt)) {
+			_symtree_free_node(info, nt);
+			return NULL;
+		}
+		_symtree_drop_node(info, tree);
+		return nt;
+	}
+#endif
+	_symtree_unlink_child(tree, c);
+	// shrink once the node would be at most half full in a narrower kind
+	if (parent != NULL && (kind = _symtree_fit_kind(tree->count * 2)) < tree->kind) {
+		if ((nt = _symtree_resize_node(info, tree, kind)) != NULL) {
+			if (_symtree_put_child(parent, pc, nt)) {
+				_symtree_drop_node(info, tree);
+				tree = nt;
+			} else {
+				_symtree_free_node(info, nt);
+			}
+		}
+	}
+	return tree;
+#else
+	_SYMTREE_RELEASE_REF(tree, c);
+#ifdef _SYMTREE_CONCURRENT
+	_SYMTREE_STORE((volatile symtree_ref_t*)&tree->symbols[c], _SYM_NULL);
+#else
+	tree->symbols[c] = _SYM_NULL;
+#endif
+	return tree;
+#endif
+}
+
+// Returns true if a node has no subtrees.
+static inline bool _symtree_is_empty(symtree_t *tree) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	return tree->count == 0;
+#else
+	symtree_t *st;
+	return _symtree_next_child(tree, 0, &st) < 0;
+#endif
+}
+
+// Returns true if a node has any subtree other than the one for key number c, which must be present.
+static inline bool _symtree_has_other_child(symtree_t *tree, unsigned c) {
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	return tree->count > 1;
+#else
+	for (unsigned i=0; i<_SYMTREE_NUM_CHARS; i++) {
+		if (i != c && tree->symbols[i] != _SYM_NULL) {
+			return true;
+		}
+	}
+	return false;
+#endif
+}
+
+// Returns true if a value is stored in one of the tree's value pools.
+static inline bool _symtree_in_pool(symtree_info_t *info, VALUE_TYPE value) {
+	for (symtree_pool_t *pool = info->pools; pool != NULL; pool = pool->next) {
+		if ((char*)value >= (char*)(pool + 1) && (char*)value < (char*)(pool + 1) + pool->size) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns the bytes a value adds to the tree's count of value bytes.
+// Values in the value store add none, since the store is counted as a whole.
+static inline size_t _symtree_value_size(symtree_info_t *info, VALUE_TYPE value) {
+#ifdef _SYMTREE_INTERN_VALUES
+	if (_symtree_in_pool(info, value)) {
+		return 0;
+	}
+#endif
+	return strlen(value) + 1;
+}
+
+// Free a value with free(), unless it is stored in one of the tree's value pools.
+static void _symtree_free_value(symtree_info_t *info, VALUE_TYPE value) {
+	if (_symtree_in_pool(info, value)) {
+		return;
+	}
+#ifdef _SYMTREE_CONCURRENT
+	_symtree_retire(info, value, false);
+#else
+	free(value);
+#endif
+}
+
+// Set the value of a node, keeping the tree's counts of keys and value bytes up to date.
+// @param leaf Address of the node's value.
+// @returns value
+static inline VALUE_TYPE _symtree_set_leaf(symtree_info_t *info, VALUE_TYPE *leaf, VALUE_TYPE value) {
+	if (*leaf != NULL) {
+		info->counts.keys--;
+		info->counts.valuebytes -= _symtree_value_size(info, *leaf);
+	}
+	if (value != NULL) {
+		info->counts.keys++;
+		info->counts.valuebytes += _symtree_value_size(info, value);
+	}
+#ifdef _SYMTREE_CONCURRENT
+	_SYMTREE_STORE((VALUE_TYPE volatile*)leaf, value);
+	return value;
+#else
+	return (*leaf = value);
+#endif
+}
+
+// Free a chain of nodes unlinked from a tree, each of which has at most one subtree.
+static void _symtree_free_chain(symtree_info_t *info, symtree_t *tree) {
+	symtree_t *st;
+	while (tree != NULL) {
+		if (_symtree_next_child(tree, 0, &st) < 0) {
+			st = NULL;
+		}
+		_symtree_retire_node(info, tree);
+		tree = st;
+	}
+}
+
+#if defined(_SYMTREE_DEFAULT_ALPHABET) && defined(__SSE2__)
+// Convert 16 characters of the default alphabet to key numbers.
+// Each of its ranges is moved to start at 0, where a saturating subtract of the range's last number leaves 0 for the characters within it.
+// @param invalid Set to a mask of the characters outside of the alphabet.
+// @returns Key numbers, which are meaningless for invalid characters.
+static inline __m128i _symtree_parse_key16(const char *name, unsigned *invalid) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_loadu_si128((const __m128i*)name);
+	__m128i upper = _mm_sub_epi8(v, _mm_set1_epi8('A'));
+	__m128i lower = _mm_sub_epi8(v, _mm_set1_epi8('a'));
+	__m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	__m128i isupper = _mm_cmpeq_epi8(_mm_subs_epu8(upper, _mm_set1_epi8(25)), zero);
+	__m128i islower = _mm_cmpeq_epi8(_mm_subs_epu8(lower, _mm_set1_epi8(25)), zero);
+	__m128i isdigit = _mm_cmpeq_epi8(_mm_subs_epu8(digit, _mm_set1_epi8(9)), zero);
+	__m128i isunder = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+	__m128i k = _mm_or_si128(_mm_and_si128(isupper, upper), _mm_and_si128(islower, _mm_add_epi8(lower, _mm_set1_epi8(26))));
+	k = _mm_or_si128(k, _mm_and_si128(isdigit, _mm_add_epi8(digit, _mm_set1_epi8(52))));
+	*invalid = ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(isupper, islower), _mm_or_si128(isdigit, isunder))) & 0xffff;
+	return _mm_or_si128(k, _mm_and_si128(isunder, _mm_set1_epi8(62)));
+}
+#endif
+
+#if defined(_SYMTREE_DEFAULT_ALPHABET) && defined(__AVX2__)
+// Convert 32 characters of the default alphabet to key numbers, as _symtree_parse_key16 does.
+// @param invalid Set to a mask of the characters outside of the alphabet.
+// @returns Key numbers, which are meaningless for invalid characters.
+static inline __m256i _symtree_parse_key32(const char *name, uint32_t *invalid) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v = _mm256_loadu_si256((const __m256i*)name);
+	__m256i upper = _mm256_sub_epi8(v, _mm256_set1_epi8('A'));
+	__m256i lower = _mm256_sub_epi8(v, _mm256_set1_epi8('a'));
+	__m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+	__m256i isupper = _mm256_cmpeq_epi8(_mm256_subs_epu8(upper, _mm256_set1_epi8(25)), zero);
+	__m256i islower = _mm256_cmpeq_epi8(_mm256_subs_epu8(lower, _mm256_set1_epi8(25)), zero);
+	__m256i isdigit = _mm256_cmpeq_epi8(_mm256_subs_epu8(digit, _mm256_set1_epi8(9)), zero);
+	__m256i isunder = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+	__m256i k = _mm256_or_si256(_mm256_and_si256(isupper, upper), _mm256_and_si256(islower, _mm256_add_epi8(lower, _mm256_set1_epi8(26))));
+	k = _mm256_or_si256(k, _mm256_and_si256(isdigit, _mm256_add_epi8(digit, _mm256_set1_epi8(52))));
+	*invalid = ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(isupper, islower), _mm256_or_si256(isdigit, isunder)));
+	return _mm256_or_si256(k, _mm256_and_si256(isunder, _mm256_set1_epi8(62)));
+}
+#endif
+
+// Convert a key to key numbers.
+// With the default alphabet and SSE2 or AVX2, whole blocks of 16 or 32 characters are converted and checked at once, and the rest one at a time.
+// With binary keys every byte is its own key number, so the key is copied as it is.
+// @param out Buffer for the key numbers, or NULL to only check the key.
+// @returns False if the key has a character outside of the alphabet.
+static inline bool _symtree_parse_key(uint8_t *out, const char *name, size_t namelen) {
+#ifdef _SYMTREE_BINARY_KEYS
+	if (out != NULL) {
+		memcpy(out, name, namelen);
+	}
+	return true;
+#else
+	size_t i = 0;
+	unsigned c;
+#if defined(_SYMTREE_DEFAULT_ALPHABET) && defined(__AVX2__)
+	uint32_t invalid32;
+	__m256i k32;
+	for (; i + 32 <= namelen; i += 32) {
+		k32 = _symtree_parse_key32(&name[i], &invalid32);
+		if (invalid32 != 0) {
+			return false;
+		}
+		if (out != NULL) {
+			_mm256_storeu_si256((__m256i*)&out[i], k32);
+		}
+	}
+#endif
+#if defined(_SYMTREE_DEFAULT_ALPHABET) && defined(__SSE2__)
+	unsigned invalid;
+	__m128i k;
+	// a padded copy of the last few characters costs more than it saves, so they are converted one at a time
+	for (; i + 16 <= namelen; i += 16) {
+		k = _symtree_parse_key16(&name[i], &invalid);
+		if (invalid != 0) {
+			return false;
+		}
+		if (out != NULL) {
+			_mm_storeu_si128((__m128i*)&out[i], k);
+		}
+	}
+#endif
+	for (; i<namelen; i++) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		if (_SYMTREE_INVALID_CHAR(c)) {
+			return false;
+		}
+		if (out != NULL) {
+			out[i] = c;
+		}
+	}
+	return true;
+#endif
+}
+
+#ifdef _SYMTREE_BURST_CONTAINERS
+// Allocate an empty container with room for capacity bytes of entries.
+// @returns Container, or NULL if failed to allocate memory.
+static symtree_t *_symtree_bucket_alloc(symtree_info_t *info, size_t capacity) {
+	symtree_t *st;
+	if ((st = _alloc_symtree_node(info, _SYMTREE_NODE_BURST, capacity)) != NULL) {
+		_symtree_bucket_set_capacity(st, capacity);
+	}
+	return st;
+}
+
+// Find the entry of a container for a key suffix of at least one key number, or the entry it would be inserted before.
+// @param found Set to whether the entry holds the suffix.
+// @returns Entry, or the end of the container's entries.
+static inline uint8_t *_symtree_bucket_seek(symtree_t *tree, const uint8_t *key, size_t len, bool *found) {
+	uint8_t *e = _SYMTREE_BUCKET_DATA(tree), *end = e + _symtree_bucket_used(tree);
+	size_t elen;
+	int d;
+	for (; e < end; e += _SYMTREE_ENTRY_SIZE(elen)) {
+		elen = _SYMTREE_ENTRY_LEN(e);
+		// most entries are told apart by their first key number
+		if ((d = (int)_SYMTREE_ENTRY_KEY(e)[0] - (int)key[0]) == 0 && (d = memcmp(_SYMTREE_ENTRY_KEY(e), key, elen < len ? elen : len)) == 0) {
+			d = (int)elen - (int)len;
+		}
+		if (d >= 0) {
+			*found = d == 0;
+			return e;
+		}
+	}
+	*found = false;
+	return end;
+}
+
+// Locate the value of a key suffix within a container.
+// @returns Address of the value, which moves if the container is modified. NULL if the container does not hold the suffix.
+static VALUE_TYPE *_symtree_bucket_find(symtree_t *tree, const char *name, size_t namelen) {
+	uint8_t key[_SYMTREE_BURST_MAX_SUFFIX];
+	uint8_t *e;
+	bool found;
+	if (namelen == 0) {
+		return &tree->leaf;
+	}
+	if (namelen > _SYMTREE_BURST_MAX_SUFFIX) {
+		return NULL;
+	}
+	if (!_symtree_parse_key(key, name, namelen)) {
+		_SYMTREE_COUNT(invalidchars, 1);
+		return NULL;
+	}
+	e = _symtree_bucket_seek(tree, key, namelen, &found);
+	if (!found) {
+		_SYMTREE_COUNT(earlymisses, 1);
+		return NULL;
+	}
+	return _SYMTREE_ENTRY_VALUE(e);
+}
+
+// Write the value and suffix of an entry.
+static inline void _symtree_bucket_write(uint8_t *e, const uint8_t *key, size_t len, VALUE_TYPE value) {
+	*_SYMTREE_ENTRY_VALUE(e) = value;
+	_SYMTREE_ENTRY_LEN(e) = (uint8_t)len;
+	memcpy(_SYMTREE_ENTRY_KEY(e), key, len);
+}
+
+// Link a new container holding a single key suffix into a node for key number c.
+// @param parent Node referencing tree, or NULL if tree is a root node.
+// @param pc Key number of tree within parent.
+// @param len Length of the suffix, which may be 0.
+// @returns value. NULL if failed to allocate memory or encode a subtree reference.
+static VALUE_TYPE _symtree_bucket_new(symtree_info_t *info, symtree_t *parent, unsigned pc, symtree_t *tree, unsigned c, const uint8_t *key, size_t len, VALUE_TYPE value) {
+	symtree_t *st;
+	VALUE_TYPE *leaf;
+	if ((st = _symtree_bucket_alloc(info, len > 0 ? _SYMTREE_ENTRY_SIZE(len) : 0)) == NULL) {
+		return NULL;
+	}
+	leaf = &st->leaf;
+	if (len > 0) {
+		_symtree_bucket_write(_SYMTREE_BUCKET_DATA(st), key, len, NULL);
+		_symtree_bucket_set_used(st, _SYMTREE_ENTRY_SIZE(len));
+		_SYMTREE_NODE_COUNT(st) = 1;
+		leaf = _SYMTREE_ENTRY_VALUE(_SYMTREE_BUCKET_DATA(st));
+	}
+	if (_symtree_add_child(info, parent, pc, tree, c, st) == NULL) {
+		_symtree_free_node(info, st);
+		return NULL;
+	}
+	return _symtree_set_leaf(info, leaf, value);
+}
+
+// Set the value of a key suffix of at least one key number within a container, adding an entry for it if needed.
+// The container is moved into a larger one if it is out of room.
+// @param tree Node referencing the container.
+// @param c Key number of the container within tree.
+// @param value Value to set, replaced with the value set, or NULL if failed to allocate memory.
+// @returns False if the container is full and does not hold the suffix, in which case it is left unchanged.
+static bool _symtree_bucket_put(symtree_info_t *info, symtree_t *tree, unsigned c, symtree_t *st, const uint8_t *key, size_t len, VALUE_TYPE *value) {
+	size_t size = _SYMTREE_ENTRY_SIZE(len), used = _symtree_bucket_used(st), capacity = _symtree_bucket_capacity(st);
+	symtree_t *nt;
+	bool found;
+	uint8_t *e = _symtree_bucket_seek(st, key, len, &found);
+	if (found) {
+		*value = _symtree_set_leaf(info, _SYMTREE_ENTRY_VALUE(e), *value);
+		return true;
+	}
+	if (st->count >= _SYMTREE_BURST_THRESHOLD) {
+		return false;
+	}
+	if (used + size > capacity) {
+		// grow by half, so that filling a container copies each entry a bounded number of times
+		capacity += capacity / 2;
+		if (capacity < used + size) {
+			capacity = used + size;
+		}
+		_SYMTREE_ALLOC_NEAR(info, st);
+		if ((nt = _symtree_bucket_alloc(info, capacity)) == NULL) {
+			*value = NULL;
+			return true;
+		}
+		nt->leaf = st->leaf;
+		nt->count = st->count;
+		_symtree_bucket_set_used(nt, used);
+		memcpy(_SYMTREE_BUCKET_DATA(nt), _SYMTREE_BUCKET_DATA(st), used);
+		if (!_symtree_put_child(tree, c, nt)) {
+			_symtree_free_node(info, nt);
+			*value = NULL;
+			return true;
+		}
+		e = _SYMTREE_BUCKET_DATA(nt) + (e - _SYMTREE_BUCKET_DATA(st));
+		_symtree_free_node(info, st);
+		st = nt;
+	}
+	memmove(e + size, e, _SYMTREE_BUCKET_DATA(st) + used - e);
+	_symtree_bucket_set_used(st, used + size);
+	st->count++;
+	_symtree_bucket_write(e, key, len, NULL);
+	*value = _symtree_set_leaf(info, _SYMTREE_ENTRY_VALUE(e), *value);
+	return true;
+}
+
+// Replace a container with a node holding a container for each first key number of its entries.
+// Values move to the new containers as they are, without changing the tree's counts.
+// @param tree Node referencing the container.
+// @param c Key number of the container within tree.
+// @returns New node, or NULL if failed to allocate memory or encode a subtree reference. (in which case the container is left in place)
+static symtree_t *_symtree_burst(symtree_info_t *info, symtree_t *tree, unsigned c, symtree_t *st) {
+	uint8_t *data = _SYMTREE_BUCKET_DATA(st), *end = data + _symtree_bucket_used(st), *e, *g, *o;
+	unsigned groups = 0, k;
+	size_t size;
+	symtree_t *nt, *ct;
+	for (e = data; e < end; e = g) {
+		k = _SYMTREE_ENTRY_KEY(e)[0];
+		for (g = e; g < end && _SYMTREE_ENTRY_KEY(g)[0] == k; g += _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(g)));
+		groups++;
+	}
+	_SYMTREE_ALLOC_NEAR(info, st);
+	if ((nt = _alloc_symtree_node(info, _symtree_fit_kind(groups), 0)) == NULL) {
+		return NULL;
+	}
+	nt->leaf = st->leaf;
+	for (e = data; e < end; e = g) {
+		k = _SYMTREE_ENTRY_KEY(e)[0];
+		size = 0;
+		for (g = e; g < end && _SYMTREE_ENTRY_KEY(g)[0] == k; g += _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(g))) {
+			if (_SYMTREE_ENTRY_LEN(g) > 1) {
+				size += _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(g) - 1);
+			}
+		}
+		if ((ct = _symtree_bucket_alloc(info, size)) == NULL) {
+			goto fail;
+		}
+		for (o = e; o < g; o += _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(o))) {
+			// the entry for just k becomes the new container's own value
+			if (_SYMTREE_ENTRY_LEN(o) == 1) {
+				ct->leaf = *_SYMTREE_ENTRY_VALUE(o);
+			} else {
+				_symtree_bucket_write(_SYMTREE_BUCKET_DATA(ct) + _symtree_bucket_used(ct), _SYMTREE_ENTRY_KEY(o) + 1, _SYMTREE_ENTRY_LEN(o) - 1, *_SYMTREE_ENTRY_VALUE(o));
+				_symtree_bucket_set_used(ct, _symtree_bucket_used(ct) + _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(o) - 1));
+				ct->count++;
+			}
+		}
+		if (!_symtree_put_child(nt, k, ct)) {
+			_symtree_free_node(info, ct);
+			goto fail;
+		}
+	}
+	if (!_symtree_put_child(tree, c, nt)) {
+		goto fail;
+	}
+	_symtree_free_node(info, st);
+	return nt;
+fail:
+	_SYMTREE_FOREACH_CHILD(nt, j, ct) {
+		_symtree_free_node(info, ct);
+	}
+	_symtree_free_node(info, nt);
+	return NULL;
+}
+
+// Remove the entry of a key suffix of at least one key number from a container.
+// @param value Set to the value the entry held.
+// @returns False if the container does not hold the suffix.
+static bool _symtree_bucket_remove(symtree_info_t *info, symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE *value) {
+	size_t used = _symtree_bucket_used(tree), size;
+	VALUE_TYPE *v;
+	uint8_t *e;
+	if ((v = _symtree_bucket_find(tree, name, namelen)) == NULL) {
+		return false;
+	}
+	*value = *v;
+	_symtree_set_leaf(info, v, NULL);
+	e = (uint8_t*)v;
+	size = _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(e));
+	memmove(e, e + size, _SYMTREE_BUCKET_DATA(tree) + used - (e + size));
+	_symtree_bucket_set_used(tree, used - size);
+	tree->count--;
+	return true;
+}
+
+// Drop the entries without values from a container, and move it into a container with no spare room.
+// @param parent Node referencing tree.
+// @param pc Key number of tree within parent.
+static void _symtree_bucket_compact(symtree_info_t *info, symtree_t *parent, unsigned pc, symtree_t *tree) {
+	uint8_t *data = _SYMTREE_BUCKET_DATA(tree), *e = data, *o = data;
+	size_t used = _symtree_bucket_used(tree), size;
+	symtree_t *nt;
+	while (e < data + used) {
+		size = _SYMTREE_ENTRY_SIZE(_SYMTREE_ENTRY_LEN(e));
+		if (*_SYMTREE_ENTRY_VALUE(e) != NULL) {
+			memmove(o, e, size);
+			o += size;
+		} else {
+			tree->count--;
+		}
+		e += size;
+	}
+	used = o - data;
+	_symtree_bucket_set_used(tree, used);
+	if (used < _symtree_bucket_capacity(tree) && (nt = _symtree_bucket_alloc(info, used)) != NULL) {
+		nt->leaf = tree->leaf;
+		nt->count = tree->count;
+		_symtree_bucket_set_used(nt, used);
+		memcpy(_SYMTREE_BUCKET_DATA(nt), data, used);
+		if (_symtree_put_child(parent, pc, nt)) {
+			_symtree_free_node(info, tree);
+		} else {
+			_symtree_free_node(info, nt);
+		}
+	}
+}
+
+// Returns true if an entry's suffix starts with the key numbers of a string's characters.
+static inline bool _symtree_bucket_match(const uint8_t *e, const char *name, size_t namelen) {
+	if (_SYMTREE_ENTRY_LEN(e) < namelen) {
+		return false;
+	}
+	for (size_t i=0; i<namelen; i++) {
+		if (_SYMTREE_ENTRY_KEY(e)[i] != _PARSE_SYM_NAME_CHAR((uint8_t)name[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns the offset of the first entry of a container ordered at or after a key suffix.
+// Characters outside of the alphabet are ordered after every key number.
+static size_t _symtree_bucket_lower_bound(symtree_t *tree, const char *name, size_t namelen) {
+	size_t n, i;
+	unsigned k = 0;
+	_SYMTREE_FOREACH_ENTRY(tree, e) {
+		n = _SYMTREE_ENTRY_LEN(e);
+		for (i=0; i<n && i<namelen; i++) {
+			k = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+			if (_SYMTREE_INVALID_CHAR(k)) {
+				k = _SYMTREE_NUM_CHARS;
+			}
+			if (_SYMTREE_ENTRY_KEY(e)[i] != k) {
+				break;
+			}
+		}
+		if (i < n && i < namelen ? _SYMTREE_ENTRY_KEY(e)[i] > k : n >= namelen) {
+			return e - _SYMTREE_BUCKET_DATA(tree);
+		}
+	}
+	return _symtree_bucket_used(tree);
+}
+#endif
+
+// Returns the number of leading characters of a label matched by a key.
+static inline size_t _symtree_match_chars(const uint8_t *label, size_t n, const char *name, size_t namelen) {
+	size_t i = 0;
+	if (namelen >= n && memcmp(name, label, n) == 0) {
+		return n;
+	}
+	if (n > namelen) {
+		n = namelen;
+	}
+	while (i + 8 <= n && memcmp(&name[i], &label[i], 8) == 0) {
+		i += 8;
+	}
+	// fall back to comparing key numbers, in case the character mapping folds case or similar
+	for (; i<n; i++) {
+		if ((uint8_t)name[i] != label[i] && _PARSE_SYM_NAME_CHAR((uint8_t)name[i]) != _PARSE_SYM_NAME_CHAR(label[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+#ifdef _SYMTREE_PATH_COMPRESSION
+// Returns the number of leading characters of a node's label matched by a key.
+static inline size_t _symtree_match_label(symtree_t *tree, const char *name, size_t namelen) {
+	return _symtree_match_chars(_SYMTREE_LABEL(tree), tree->labellen, name, namelen);
+}
+
+// Store key characters into a node's label in canonical form.
+static inline void _symtree_set_label(symtree_t *tree, const char *name) {
+	uint8_t *label = _SYMTREE_LABEL(tree);
+	for (size_t i=0; i<tree->labellen; i++) {
+		label[i] = _UNPARSE_SYM_NAME_CHAR(_PARSE_SYM_NAME_CHAR((uint8_t)name[i]));
+	}
+}
+
+// Split the label of subtree st (key number c of tree) after its first m characters.
+// @returns New subtree holding the first m characters of the label, or NULL if failed. (in which case st is left intact)
+static symtree_t *_symtree_split_label(symtree_info_t *info, symtree_t *tree, unsigned c, symtree_t *st, size_t m) {
+	symtree_t *mid, *tail;
+	uint8_t *label = _SYMTREE_LABEL(st);
+	unsigned lc = _PARSE_SYM_NAME_CHAR(label[m]);
+	_SYMTREE_ALLOC_NEAR(info, tree);
+	if ((mid = _alloc_symtree_node(info, _SYMTREE_NEW_NODE_KIND, m)) == NULL) {
+		return NULL;
+	}
+	memcpy(_SYMTREE_LABEL(mid), label, m);
+#ifdef _SYMTREE_WEIGHTS
+	mid->maxweight = st->maxweight;
+#endif
+	if ((tail = _symtree_copy_node(info, st, _SYMTREE_NODE_KIND(st), &label[m+1], st->labellen-m-1)) == NULL) {
+		_symtree_free_node(info, mid);
+		return NULL;
+	}
+	if (!_symtree_put_child(mid, lc, tail) || !_symtree_put_child(tree, c, mid)) {
+		_symtree_free_node(info, tail);
+		_symtree_free_node(info, mid);
+		return NULL;
+	}
+	_symtree_drop_node(info, st);
+	return mid;
+}
+
+// Merge a subtree without a value into its only child, if it has exactly one.
+// @param parent Node referencing tree.
+// @param pc Key number of tree within parent.
+static void _symtree_merge_child(symtree_info_t *info, symtree_t *parent, unsigned pc, symtree_t *tree) {
+	symtree_t *st, *nt, *other;
+	int c;
+	size_t len;
+	if (tree->leaf != NULL || (c = _symtree_next_child(tree, 0, &st)) < 0 || _symtree_next_child(tree, c+1, &other) >= 0) {
+		return;
+	}
+	len = tree->labellen + 1 + st->labellen;
+	_SYMTREE_ALLOC_NEAR(info, parent);
+	if (len > _SYMTREE_MAX_LABEL_LEN || (nt = _alloc_symtree_node(info, _SYMTREE_NODE_KIND(st), len)) == NULL) {
+		return;
+	}
+	memcpy(_SYMTREE_LABEL(nt), _SYMTREE_LABEL(tree), tree->labellen);
+	_SYMTREE_LABEL(nt)[tree->labellen] = _UNPARSE_SYM_NAME_CHAR(c);
+	memcpy(&_SYMTREE_LABEL(nt)[tree->labellen + 1], _SYMTREE_LABEL(st), st->labellen);
+	nt->leaf = st->leaf;
+#ifdef _SYMTREE_WEIGHTS
+	nt->weight = st->weight;
+	nt->maxweight = st->maxweight;
+#endif
+	_SYMTREE_FOREACH_CHILD(st, k, other) {
+		if (!_symtree_put_child(nt, k, other)) {
+			_symtree_free_node(info, nt);
+			return;
+		}
+	}
+	if (!_symtree_put_child(parent, pc, nt)) {
+		_symtree_free_node(info, nt);
+		return;
+	}
+	_symtree_drop_node(info, st);
+	_symtree_drop_node(info, tree);
+}
+#endif
+
+// Size of the chunks streaming dumps are written in.
+#ifndef _SYMTREE_DUMP_CHUNK_SIZE
+#define _SYMTREE_DUMP_CHUNK_SIZE 4096
+#endif
+
+// Characters that are escaped in json values.
+#define _SYMTREE_DUMP_ESCAPED_CHARS "\"\\\x01\x02\x03\x04\x05\x06\x07\x08\t\n\x0b\x0c\r\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f"
+
+// State of a streaming dump.
+typedef struct {
+	symtree_writer_t write;
+	void *context;
+	size_t total;
+	size_t used;
+	size_t chunksize;
+	char *chunk;
+} _symtree_dump_t;
+
+// Pass buffered dump data to the writer.
+// Without a writer the chunk can't be emptied, so from then on data is only counted.
+static bool _symtree_dump_flush(_symtree_dump_t *dump) {
+	if (dump->write == NULL) {
+		dump->chunk = NULL;
+		dump->chunksize = dump->used = 0;
+		return true;
+	}
+	if (dump->used > 0 && !dump->write(dump->context, dump->chunk, dump->used)) {
+		return false;
+	}
+	dump->used = 0;
+	return true;
+}
+
+// Append data to a streaming dump, flushing full chunks to the writer. Without a chunk, the data is only counted.
+static bool _symtree_dump_put_slow(_symtree_dump_t *dump, const char *data, size_t len) {
+	size_t n;
+	while (len > 0) {
+		if (dump->used == dump->chunksize && !_symtree_dump_flush(dump)) {
+			return false;
+		}
+		if (dump->chunk == NULL) {
+			break;
+		}
+		n = dump->chunksize - dump->used;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(&dump->chunk[dump->used], data, n);
+		dump->used += n;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Append data to a streaming dump.
+static inline bool _symtree_dump_put(_symtree_dump_t *dump, const char *data, size_t len) {
+	dump->total += len;
+	if (len <= dump->chunksize - dump->used && dump->chunk != NULL) {
+		memcpy(&dump->chunk[dump->used], data, len);
+		dump->used += len;
+		return true;
+	}
+	return _symtree_dump_put_slow(dump, data, len);
+}
+
+#ifdef _SYMTREE_BINARY_KEYS
+// Append a key to a streaming dump, escaping quotes, backslashes and control characters (including zero bytes).
+// Other bytes are written as they are, so keys that aren't utf-8 are still read back unchanged by append_symtree.
+static bool _symtree_dump_key(_symtree_dump_t *dump, const char *key, size_t keylen) {
+	size_t run = 0;
+	const char *escape;
+	char hex[7];
+	for (size_t i=0; i<keylen; i++) {
+		uint8_t c = key[i];
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		if (!_symtree_dump_put(dump, key + run, i - run)) {
+			return false;
+		}
+		if (c == '"') {
+			escape = "\\\"";
+		} else if (c == '\\') {
+			escape = "\\\\";
+		} else {
+			snprintf(hex, sizeof(hex), "\\u%04x", c);
+			escape = hex;
+		}
+		if (!_symtree_dump_put(dump, escape, strlen(escape))) {
+			return false;
+		}
+		run = i + 1;
+	}
+	return _symtree_dump_put(dump, key + run, keylen - run);
+}
+#else
+// Keys of the alphabet never need escaping.
+#define _symtree_dump_key _symtree_dump_put
+#endif
+
+// Append a json key:value entry to a streaming dump, escaping the value.
+static bool _symtree_dump_entry(_symtree_dump_t *dump, const char *key, size_t keylen, const char *value, bool first) {
+	const char *run = value;
+	const char *escape;
+	if (!first && !_symtree_dump_put(dump, ",", 1)) {
+		return false;
+	}
+#ifdef _SYMTREE_DUMP_PRETTY_JSON
+	if (!_symtree_dump_put(dump, "\n\t", 2)) {
+		return false;
+	}
+#endif
+	if (!_symtree_dump_put(dump, "\"", 1) || !_symtree_dump_key(dump, key, keylen) || !_symtree_dump_put(dump, "\":\"", 3)) {
+		return false;
+	}
+	char hex[7];
+	for (;;) {
+		value = run + strcspn(run, _SYMTREE_DUMP_ESCAPED_CHARS);
+		if (!_symtree_dump_put(dump, run, value - run)) {
+			return false;
+		}
+		switch (*value) {
+			case 0:
+				return _symtree_dump_put(dump, "\"", 1);
+			case '\n':
+				escape = "\\n";
+				break;
+			case '\t':
+				escape = "\\t";
+				break;
+			case '\r':
+				escape = "\\r";
+				break;
+			case '"':
+				escape = "\\\"";
+				break;
+			case '\\':
+				escape = "\\\\";
+				break;
+			default:
+				// other control characters
+				snprintf(hex, sizeof(hex), "\\u%04x", (uint8_t)*value);
+				escape = hex;
+				break;
+		}
+		if (!_symtree_dump_put(dump, escape, strlen(escape))) {
+			return false;
+		}
+		run = value + 1;
+	}
+}
+
+// Grow a walk buffer that starts out on the stack.
+// @param buffer Pointer to the buffer, replaced with a larger heap buffer.
+// @param capacity Pointer to the capacity of the buffer in elements, which is doubled until it is at least needed.
+// @param used Number of elements in use, which are copied to the new buffer.
+// @param stackbuffer Initial buffer, which is never freed.
+// @returns False if failed to allocate memory.
+static bool _symtree_walk_grow(void **buffer, size_t *capacity, size_t needed, size_t used, size_t size, void *stackbuffer) {
+	size_t newcapacity = *capacity;
+	void *newbuffer;
+	while (newcapacity < needed) {
+		newcapacity *= 2;
+	}
+	if ((newbuffer = malloc(newcapacity * size)) == NULL) {
+		return false;
+	}
+	memcpy(newbuffer, *buffer, used * size);
+	if (*buffer != stackbuffer) {
+		free(*buffer);
+	}
+	*buffer = newbuffer;
+	*capacity = newcapacity;
+	return true;
+}
+
+// Walk a tree iteratively, writing a json entry for each value.
+// The key prefix is kept in a single buffer which is extended and truncated as the walk goes up and down the tree.
+static bool _symtree_dump(symtree_t *tree, _symtree_dump_t *dump) {
+	_symtree_walk_frame_t stackframes[64];
+	char stackprefix[256];
+	_symtree_walk_frame_t *frames = stackframes, *frame;
+	char *prefix = stackprefix;
+	size_t numframes = 64, prefixcapacity = sizeof(stackprefix), depth = 0, len;
+	bool first = true, success = true;
+	symtree_t *st;
+	int c;
+	if (!_symtree_dump_put(dump, symtree_file_header, strlen(symtree_file_header))) {
+		return false;
+	}
+	if (tree->leaf != NULL) {
+		if (!_symtree_dump_entry(dump, symtree_root_node_key, strlen(symtree_root_node_key), tree->leaf, first)) {
+			return false;
+		}
+		first = false;
+	}
+	frames[depth++] = (_symtree_walk_frame_t){tree, 0, 0};
+	while (depth > 0) {
+		frame = &frames[depth-1];
+		if ((c = _symtree_next_child(frame->tree, frame->next, &st)) < 0) {
+			depth--;
+			continue;
+		}
+		frame->next = c + 1;
+		len = frame->prefixlen + 1 + _SYMTREE_LABEL_LEN(st);
+		if (len > prefixcapacity && !_symtree_walk_grow((void**)&prefix, &prefixcapacity, len, frame->prefixlen, 1, stackprefix)) {
+			success = false;
+			break;
+		}
+		prefix[frame->prefixlen] = _UNPARSE_SYM_NAME_CHAR(c);
+#ifdef _SYMTREE_PATH_COMPRESSION
+		memcpy(&prefix[frame->prefixlen + 1], _SYMTREE_LABEL(st), st->labellen);
+#endif
+		if (st->leaf != NULL) {
+			if (!_symtree_dump_entry(dump, prefix, len, st->leaf, first)) {
+				success = false;
+				break;
+			}
+			first = false;
+		}
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (st->kind == _SYMTREE_NODE_BURST) {
+			// entries are in key order, and are dumped without pushing a frame
+			_SYMTREE_FOREACH_ENTRY(st, e) {
+				size_t elen = len + _SYMTREE_ENTRY_LEN(e);
+				if (*_SYMTREE_ENTRY_VALUE(e) == NULL) {
+					continue;
+				}
+				if (elen > prefixcapacity && !_symtree_walk_grow((void**)&prefix, &prefixcapacity, elen, len, 1, stackprefix)) {
+					success = false;
+					break;
+				}
+				for (size_t i=len; i<elen; i++) {
+					prefix[i] = _UNPARSE_SYM_NAME_CHAR(_SYMTREE_ENTRY_KEY(e)[i - len]);
+				}
+				if (!_symtree_dump_entry(dump, prefix, elen, *_SYMTREE_ENTRY_VALUE(e), first)) {
+					success = false;
+					break;
+				}
+				first = false;
+			}
+			if (!success) {
+				break;
+			}
+			continue;
+		}
+#endif
+		if (depth == numframes && !_symtree_walk_grow((void**)&frames, &numframes, depth + 1, depth, sizeof(_symtree_walk_frame_t), stackframes)) {
+			success = false;
+			break;
+		}
+		frames[depth++] = (_symtree_walk_frame_t){st, len, 0};
+	}
+	if (frames != stackframes) {
+		free(frames);
+	}
+	if (prefix != stackprefix) {
+		free(prefix);
+	}
+	return success && _symtree_dump_put(dump, symtree_file_footer, strlen(symtree_file_footer)) && _symtree_dump_flush(dump);
+}
+
+static bool dump_symtree_stream(symtree_t *tree, symtree_writer_t write, void *context) {
+	char chunk[_SYMTREE_DUMP_CHUNK_SIZE];
+	_symtree_dump_t dump = {write, context, 0, 0, sizeof(chunk), chunk};
+	return _symtree_dump(tree, &dump);
+}
+
+// Writer used by dump_symtree_file.
+static bool _symtree_file_writer(void *context, const char *data, size_t len) {
+	return fwrite(data, 1, len, (FILE*)context) == len;
+}
+
+static bool dump_symtree_file(symtree_t *tree, FILE *fd) {
+	return dump_symtree_stream(tree, _symtree_file_writer, fd);
+}
+
+static size_t dump_symtree_size(symtree_t *tree) {
+	_symtree_dump_t dump = {NULL, NULL, 0, 0, 0, NULL};
+	if (!_symtree_dump(tree, &dump)) {
+		return 0;
+	}
+	return dump.total;
+}
+
+static bool dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len) {
+	// dump straight into the buffer, falling back to counting once it is full
+	_symtree_dump_t dump = {NULL, NULL, 0, 0, bufferlen, buffer};
+	bool success = _symtree_dump(tree, &dump);
+	*len = dump.total;
+	return success && dump.total <= bufferlen;
+}
+
+// Make room in an iterator for a key of keylen characters, and one more tree level.
+static bool _symtree_iter_reserve(symtree_iter_t *it, size_t keylen) {
+	void *p;
+	if (keylen >= it->keycapacity) {
+		p = it->key != NULL ? (void*)it->key : (void*)it->stackkey;
+		if (!_symtree_walk_grow(&p, &it->keycapacity, keylen + 1, it->keycapacity, 1, it->stackkey)) {
+			return false;
+		}
+		it->key = (char*)p;
+	}
+	if (it->depth == it->numframes) {
+		p = it->frames != NULL ? (void*)it->frames : (void*)it->stackframes;
+		if (!_symtree_walk_grow(&p, &it->numframes, it->depth + 1, it->depth, sizeof(_symtree_walk_frame_t), it->stackframes)) {
+			return false;
+		}
+		it->frames = (_symtree_walk_frame_t*)p;
+	}
+	return true;
+}
+
+// Push subtree st (key number c of the node on top of an iterator's stack), appending its key characters to the key buffer.
+static bool _symtree_iter_push(symtree_iter_t *it, unsigned c, symtree_t *st) {
+	size_t prefixlen = _SYMTREE_ITER_FRAMES(it)[it->depth-1].prefixlen, len = prefixlen + 1 + _SYMTREE_LABEL_LEN(st);
+	char *key;
+	if (!_symtree_iter_reserve(it, len)) {
+		it->failed = true;
+		return false;
+	}
+	key = _SYMTREE_ITER_KEY(it);
+	key[prefixlen] = _UNPARSE_SYM_NAME_CHAR(c);
+#ifdef _SYMTREE_PATH_COMPRESSION
+	memcpy(&key[prefixlen + 1], _SYMTREE_LABEL(st), st->labellen);
+#endif
+	_SYMTREE_ITER_FRAMES(it)[it->depth++] = (_symtree_walk_frame_t){st, len, 0};
+	return true;
+}
+
+#ifdef _SYMTREE_BURST_CONTAINERS
+// Find the next entry with a value of the container on top of an iterator's stack, whose next field is the offset of the entry to look at.
+// The entry's suffix is appended to the key buffer. Entries of a container the prefix ends within are skipped unless they continue the prefix.
+// @param keylen Set to the length of the entry's key.
+// @returns False once the container has no entries left, or if failed to allocate memory.
+static bool _symtree_iter_entry(symtree_iter_t *it, size_t *keylen, VALUE_TYPE *value) {
+	_symtree_walk_frame_t *frame = &_SYMTREE_ITER_FRAMES(it)[it->depth-1];
+	symtree_t *tree = frame->tree;
+	size_t prefixlen = frame->prefixlen, skip = 0, len;
+	uint8_t *e;
+	char *key;
+	if (it->depth == 1 && it->prefixlen > prefixlen) {
+		skip = it->prefixlen - prefixlen;
+	}
+	while ((size_t)frame->next < _symtree_bucket_used(tree)) {
+		e = _SYMTREE_BUCKET_DATA(tree) + frame->next;
+		len = _SYMTREE_ENTRY_LEN(e);
+		frame->next += _SYMTREE_ENTRY_SIZE(len);
+		// the rest of the prefix is already in the key buffer, and stays there since only entries continuing it are written
+		if (*_SYMTREE_ENTRY_VALUE(e) == NULL || (skip > 0 && !_symtree_bucket_match(e, &_SYMTREE_ITER_KEY(it)[prefixlen], skip))) {
+			continue;
+		}
+		if (prefixlen + len >= it->keycapacity && !_symtree_iter_reserve(it, prefixlen + len)) {
+			it->failed = true;
+			return false;
+		}
+		key = _SYMTREE_ITER_KEY(it);
+		for (size_t i=0; i<len; i++) {
+			key[prefixlen + i] = _UNPARSE_SYM_NAME_CHAR(_SYMTREE_ENTRY_KEY(e)[i]);
+		}
+		key[prefixlen + len] = 0;
+		*keylen = prefixlen + len;
+		*value = *_SYMTREE_ENTRY_VALUE(e);
+		return true;
+	}
+	return false;
+}
+#endif
+
+// Go back to the start of an iteration.
+static void _symtree_iter_rewind(symtree_iter_t *it) {
+	it->depth = 0;
+	it->pending = false;
+	if (it->start != NULL) {
+		_SYMTREE_ITER_FRAMES(it)[it->depth++] = (_symtree_walk_frame_t){it->start, it->startlen, 0};
+		// unless the prefix continues into a container, the start node's own key is under it
+		it->pending = it->startlen >= it->prefixlen;
+	}
+}
+
+// Find the subtree that the prefix at the start of an iterator's key buffer leads to, and rewind to it.
+// The prefix may end partway through the subtree's label, which is then completed in the key buffer.
+// @returns False if failed to allocate memory.
+static bool _symtree_iter_find(symtree_iter_t *it) {
+	symtree_t *tree = it->tree, *st;
+	size_t i = 0, len = 0;
+	unsigned c;
+	while (i < it->prefixlen) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)_SYMTREE_ITER_KEY(it)[i]);
+		i++;
+		if (_SYMTREE_INVALID_CHAR(c) || (st = _symtree_child(tree, c)) == NULL) {
+			tree = NULL;
+			break;
+		}
+#ifdef _SYMTREE_PATH_COMPRESSION
+		if (st->labellen > 0) {
+			size_t m = _symtree_match_chars(_SYMTREE_LABEL(st), st->labellen, &_SYMTREE_ITER_KEY(it)[i], it->prefixlen - i);
+			if (m < st->labellen && i + m < it->prefixlen) {
+				tree = NULL;
+				break;
+			}
+		}
+		if (!_symtree_iter_reserve(it, len + 1 + st->labellen)) {
+			return false;
+		}
+		memcpy(&_SYMTREE_ITER_KEY(it)[i], _SYMTREE_LABEL(st), st->labellen);
+		i += st->labellen;
+#endif
+		len = i;
+		tree = st;
+#ifdef _SYMTREE_BURST_CONTAINERS
+		// the rest of the prefix is matched against the container's entries as they come up
+		if (tree->kind == _SYMTREE_NODE_BURST) {
+			break;
+		}
+#endif
+	}
+	it->start = tree;
+	it->startlen = len;
+	_symtree_iter_rewind(it);
+	return true;
+}
+
+static bool symtree_iter_init(symtree_iter_t *it, symtree_t *tree, const char *prefix, size_t prefixlen) {
+	it->tree = tree;
+	it->prefixlen = prefixlen;
+	it->start = NULL;
+	it->frames = NULL;
+	it->key = NULL;
+	it->numframes = _SYMTREE_ITER_DEPTH;
+	it->keycapacity = sizeof(it->stackkey);
+	it->depth = 0;
+	it->pending = false;
+	it->failed = false;
+	if (!_symtree_iter_reserve(it, prefixlen)) {
+		return false;
+	}
+	// the prefix is stored in canonical form, so that it reads the same as the keys it is a prefix of
+	for (size_t i=0; i<prefixlen; i++) {
+		unsigned c = _PARSE_SYM_NAME_CHAR((uint8_t)prefix[i]);
+		_SYMTREE_ITER_KEY(it)[i] = _SYMTREE_INVALID_CHAR(c) ? prefix[i] : _UNPARSE_SYM_NAME_CHAR(c);
+	}
+	if (!_symtree_iter_find(it)) {
+		symtree_iter_free(it);
+		return false;
+	}
+	return true;
+}
+
+static bool symtree_iter_next(symtree_iter_t *it, const char **key, size_t *keylen, VALUE_TYPE *value) {
+	_symtree_walk_frame_t *frame;
+	symtree_t *st;
+	int c;
+	if (it->pending) {
+		it->pending = false;
+		if (_SYMTREE_ITER_FRAMES(it)[it->depth-1].tree->leaf != NULL) {
+			goto found;
+		}
+	}
+	while (it->depth > 0) {
+		frame = &_SYMTREE_ITER_FRAMES(it)[it->depth-1];
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (frame->tree->kind == _SYMTREE_NODE_BURST) {
+			if (_symtree_iter_entry(it, keylen, value)) {
+				*key = _SYMTREE_ITER_KEY(it);
+				return true;
+			}
+			if (it->failed) {
+				return false;
+			}
+			it->depth--;
+			continue;
+		}
+#endif
+		if ((c = _symtree_next_child(frame->tree, frame->next, &st)) < 0) {
+			it->depth--;
+			continue;
+		}
+		frame->next = c + 1;
+		if (!_symtree_iter_push(it, c, st)) {
+			return false;
+		}
+		if (st->leaf != NULL) {
+			goto found;
+		}
+	}
+	return false;
+found:
+	frame = &_SYMTREE_ITER_FRAMES(it)[it->depth-1];
+	_SYMTREE_ITER_KEY(it)[frame->prefixlen] = 0;
+	*key = _SYMTREE_ITER_KEY(it);
+	*keylen = frame->prefixlen;
+	*value = frame->tree->leaf;
+	return true;
+}
+
+// Used internally within symtree_iter_seek, with a key that is not stored in the iterator's key buffer.
+static bool _symtree_iter_seek(symtree_iter_t *it, const char *key, size_t keylen) {
+	_symtree_walk_frame_t *frame;
+	size_t i = 0;
+	symtree_t *st;
+	unsigned c, kc;
+	// the tree may have been modified since the iterator was initialized, so the prefix is looked up again
+	it->failed = false;
+	if (!_symtree_iter_find(it)) {
+		it->failed = true;
+		return false;
+	}
+	while (it->depth > 0) {
+		frame = &_SYMTREE_ITER_FRAMES(it)[it->depth-1];
+		// compare the key with the characters of the node on top of the stack
+		for (; i<frame->prefixlen; i++) {
+			if (i == keylen) {
+				return true;
+			}
+			c = _PARSE_SYM_NAME_CHAR((uint8_t)key[i]);
+			kc = _PARSE_SYM_NAME_CHAR((uint8_t)_SYMTREE_ITER_KEY(it)[i]);
+			if (c != kc) {
+				if (c > kc) {
+					// the whole subtree is ordered before the key
+					it->depth--;
+					it->pending = false;
+				}
+				return true;
+			}
+		}
+		if (i == keylen) {
+			return true;
+		}
+		// the node's own key is ordered before the key, and so are its subtrees below key[i]
+		it->pending = false;
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (frame->tree->kind == _SYMTREE_NODE_BURST) {
+			frame->next = _symtree_bucket_lower_bound(frame->tree, &key[i], keylen - i);
+			return true;
+		}
+#endif
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)key[i]);
+		if (_SYMTREE_INVALID_CHAR(c)) {
+			frame->next = _SYMTREE_NUM_CHARS;
+			return true;
+		}
+		if ((st = _symtree_child(frame->tree, c)) == NULL) {
+			frame->next = c;
+			return true;
+		}
+		frame->next = c + 1;
+		if (!_symtree_iter_push(it, c, st)) {
+			return false;
+		}
+		it->pending = true;
+		i++;
+	}
+	return true;
+}
+
+static bool symtree_iter_seek(symtree_iter_t *it, const char *key, size_t keylen) {
+	const char *buffer = _SYMTREE_ITER_KEY(it);
+	char *copy;
+	bool success;
+	// a key just returned by the iterator is overwritten while seeking
+	if (key < buffer || key >= buffer + it->keycapacity) {
+		return _symtree_iter_seek(it, key, keylen);
+	}
+	if ((copy = (char*)malloc(keylen + 1)) == NULL) {
+		it->failed = true;
+		return false;
+	}
+	memcpy(copy, key, keylen);
+	success = _symtree_iter_seek(it, copy, keylen);
+	free(copy);
+	return success;
+}
+
+static void symtree_iter_free(symtree_iter_t *it) {
+	free(it->frames);
+	free(it->key);
+	it->frames = NULL;
+	it->key = NULL;
+	it->start = NULL;
+	it->depth = 0;
+	it->pending = false;
+}
+
+// Used internally by find_sym_fuzzy to extend a row of edit distances by key number c.
+// @param prev Distances between the key without c and each prefix of the name.
+// @param row Set to the distances between the key with c and each prefix of the name.
+// @returns Smallest distance in the row.
+static inline unsigned _symtree_fuzzy_row(const unsigned *prev, unsigned *row, const unsigned *chars, size_t namelen, unsigned c) {
+	unsigned d, least = row[0] = prev[0] + 1;
+	for (size_t j=1; j<=namelen; j++) {
+		d = prev[j-1] + (chars[j-1] != c);
+		if (prev[j] + 1 < d) {
+			d = prev[j] + 1;
+		}
+		if (row[j-1] + 1 < d) {
+			d = row[j-1] + 1;
+		}
+		row[j] = d;
+		if (d < least) {
+			least = d;
+		}
+	}
+	return least;
+}
+
+static bool find_sym_fuzzy(symtree_t *tree, const char *name, size_t namelen, unsigned maxdist, symtree_fuzzy_callback_t callback, void *context) {
+	_symtree_walk_frame_t stackframes[64];
+	char stackkey[256];
+	unsigned stackrows[1024], stackchars[64];
+	_symtree_walk_frame_t *frames = stackframes, *frame;
+	char *key = stackkey;
+	unsigned *rows = stackrows, *chars = stackchars, *row;
+	size_t numframes = 64, keycapacity = sizeof(stackkey), rowcapacity = 1024, charcapacity = 64, depth = 0, width, len, i;
+	bool success = true;
+	symtree_t *st;
+	int c;
+	if (namelen == 0) {
+		namelen = strlen(name);
+	}
+	// one row of distances is kept per key character, so that going back up the tree needs no recomputing
+	width = namelen + 1;
+	if ((namelen > charcapacity && !_symtree_walk_grow((void**)&chars, &charcapacity, namelen, 0, sizeof(unsigned), stackchars))
+		|| (width > rowcapacity && !_symtree_walk_grow((void**)&rows, &rowcapacity, width, 0, sizeof(unsigned), stackrows))) {
+		success = false;
+		goto done;
+	}
+	for (i=0; i<namelen; i++) {
+		chars[i] = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		if (_SYMTREE_INVALID_CHAR(chars[i])) {
+			chars[i] = _SYMTREE_NUM_CHARS;
+		}
+	}
+	for (i=0; i<width; i++) {
+		rows[i] = i;
+	}
+	if (tree->leaf != NULL && namelen <= maxdist) {
+		key[0] = 0;
+		if (!callback(context, key, 0, tree->leaf, namelen)) {
+			goto done;
+		}
+	}
+	frames[depth++] = (_symtree_walk_frame_t){tree, 0, 0};
+	while (depth > 0) {
+		frame = &frames[depth-1];
+		if ((c = _symtree_next_child(frame->tree, frame->next, &st)) < 0) {
+			depth--;
+			continue;
+		}
+		frame->next = c + 1;
+		len = frame->prefixlen + 1 + _SYMTREE_LABEL_LEN(st);
+		if ((len >= keycapacity && !_symtree_walk_grow((void**)&key, &keycapacity, len + 1, frame->prefixlen, 1, stackkey))
+			|| ((len + 1) * width > rowcapacity && !_symtree_walk_grow((void**)&rows, &rowcapacity, (len + 1) * width, (frame->prefixlen + 1) * width, sizeof(unsigned), stackrows))) {
+			success = false;
+			break;
+		}
+		key[frame->prefixlen] = _UNPARSE_SYM_NAME_CHAR(c);
+		row = &rows[(frame->prefixlen + 1) * width];
+		if (_symtree_fuzzy_row(row - width, row, chars, namelen, c) > maxdist) {
+			continue;
+		}
+#ifdef _SYMTREE_PATH_COMPRESSION
+		for (i=0; i<st->labellen; i++) {
+			key[frame->prefixlen + 1 + i] = _SYMTREE_LABEL(st)[i];
+			row += width;
+			if (_symtree_fuzzy_row(row - width, row, chars, namelen, _PARSE_SYM_NAME_CHAR(_SYMTREE_LABEL(st)[i])) > maxdist) {
+				break;
+			}
+		}
+		if (i < st->labellen) {
+			continue;
+		}
+#endif
+		if (st->leaf != NULL && row[namelen] <= maxdist) {
+			key[len] = 0;
+			if (!callback(context, key, len, st->leaf, row[namelen])) {
+				break;
+			}
+		}
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (st->kind == _SYMTREE_NODE_BURST) {
+			// entries are sorted, so the rows of the characters an entry shares with the one before it are still in place
+			const uint8_t *prev = NULL, *suffix;
+			size_t valid = 0, elen;
+			_SYMTREE_FOREACH_ENTRY(st, e) {
+				suffix = _SYMTREE_ENTRY_KEY(e);
+				elen = _SYMTREE_ENTRY_LEN(e);
+				if ((len + elen >= keycapacity && !_symtree_walk_grow((void**)&key, &keycapacity, len + elen + 1, len + valid, 1, stackkey))
+					|| ((len + elen + 1) * width > rowcapacity && !_symtree_walk_grow((void**)&rows, &rowcapacity, (len + elen + 1) * width, (len + valid + 1) * width, sizeof(unsigned), stackrows))) {
+					success = false;
+					goto done;
+				}
+				for (i=0; i<valid && i<elen && suffix[i] == prev[i]; i++);
+				row = &rows[(len + i) * width];
+				for (; i<elen; i++) {
+					key[len + i] = _UNPARSE_SYM_NAME_CHAR(suffix[i]);
+					row += width;
+					if (_symtree_fuzzy_row(row - width, row, chars, namelen, suffix[i]) > maxdist) {
+						break;
+					}
+				}
+				prev = suffix;
+				valid = i;
+				if (i == elen && *_SYMTREE_ENTRY_VALUE(e) != NULL && row[namelen] <= maxdist) {
+					key[len + elen] = 0;
+					if (!callback(context, key, len + elen, *_SYMTREE_ENTRY_VALUE(e), row[namelen])) {
+						goto done;
+					}
+				}
+			}
+			continue;
+		}
+#endif
+		if (depth == numframes && !_symtree_walk_grow((void**)&frames, &numframes, depth + 1, depth, sizeof(_symtree_walk_frame_t), stackframes)) {
+			success = false;
+			break;
+		}
+		frames[depth++] = (_symtree_walk_frame_t){st, len, 0};
+	}
+done:
+	if (frames != stackframes) {
+		free(frames);
+	}
+	if (key != stackkey) {
+		free(key);
+	}
+	if (rows != stackrows) {
+		free(rows);
+	}
+	if (chars != stackchars) {
+		free(chars);
+	}
+	return success;
+}
+
+static symtree_t *load_symtree(const char *data, size_t datalen) {
+	return load_symtree_ex(data, datalen, NULL);
+}
+
+static symtree_t *load_symtree_ex(const char *data, size_t datalen, size_t *error) {
+	symtree_t *tree = alloc_symtree();
+	if (tree == NULL) {
+		if (error != NULL) {
+			*error = 0;
+		}
+		return NULL;
+	}
+	if (append_symtree_ex(tree, data, datalen, error) == NULL) {
+		free_symtree(tree);
+		return NULL;
+	}
+	return tree;
+}
+
+// Used internally by append_symtree to find the end of a quoted string, or the next escape within it.
+// @returns Pointer to the first '"' or '\\' at or after p, or end if there is none.
+static inline const char *_symtree_scan_string(const char *p, const char *end) {
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while (p < end && *p != '"' && *p != '\\') {
+		p++;
+	}
+	return p;
+}
+
+// Used internally by append_symtree to skip whitespace.
+static inline const char *_symtree_skip_space(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+		p++;
+	}
+	return p;
+}
+
+// Used internally by append_symtree to read 4 hex digits of a \u escape.
+// @returns Code unit, or -1 if invalid.
+static int _symtree_read_hex4(const char *p, const char *end) {
+	int v = 0;
+	if (end - p < 4) {
+		return -1;
+	}
+	for (int i=0; i<4; i++) {
+		char c = p[i];
+		v <<= 4;
+		if (c >= '0' && c <= '9') {
+			v |= c - '0';
+		} else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+			v |= (c | 0x20) - 'a' + 10;
+		} else {
+			return -1;
+		}
+	}
+	return v;
+}
+
+// Used internally by append_symtree to unescape a quoted string into out.
+// @param p Pointer to the first character after the opening quote.
+// @param out Destination, which must have room for the raw length of the string plus a null terminator.
+// @param len Pointer to the unescaped length, not including the null terminator.
+// @returns Pointer to the character after the closing quote, or NULL if the string is invalid or unterminated. (in which case *len is set to the offset of the error from p)
+static const char *_symtree_read_string(const char *p, const char *end, char *out, size_t *len) {
+	const char *start = p, *run, *escape;
+	char *o = out;
+	int cp, lo;
+	for (;;) {
+		run = p;
+		p = _symtree_scan_string(p, end);
+		memcpy(o, run, p - run);
+		o += p - run;
+		if (p >= end) {
+			*len = p - start;
+			return NULL;
+		}
+		if (*p++ == '"') {
+			break;
+		}
+		escape = p - 1;
+		if (p >= end) {
+			*len = escape - start;
+			return NULL;
+		}
+		switch (*p++) {
+			case '"': *o++ = '"'; break;
+			case '\\': *o++ = '\\'; break;
+			case '/': *o++ = '/'; break;
+			case 'b': *o++ = '\b'; break;
+			case 'f': *o++ = '\f'; break;
+			case 'n': *o++ = '\n'; break;
+			case 'r': *o++ = '\r'; break;
+			case 't': *o++ = '\t'; break;
+			case 'u':
+				if ((cp = _symtree_read_hex4(p, end)) < 0) {
+					*len = escape - start;
+					return NULL;
+				}
+				p += 4;
+				if (cp >= 0xD800 && cp < 0xDC00) {
+					// surrogate pair
+					if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || (lo = _symtree_read_hex4(p + 2, end)) < 0xDC00 || lo >= 0xE000) {
+						*len = escape - start;
+						return NULL;
+					}
+					p += 6;
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				}
+				// encode as utf-8, which is never longer than the escape sequence
+				if (cp < 0x80) {
+					*o++ = cp;
+				} else if (cp < 0x800) {
+					*o++ = 0xC0 | (cp >> 6);
+					*o++ = 0x80 | (cp & 0x3F);
+				} else if (cp < 0x10000) {
+					*o++ = 0xE0 | (cp >> 12);
+					*o++ = 0x80 | ((cp >> 6) & 0x3F);
+					*o++ = 0x80 | (cp & 0x3F);
+				} else {
+					*o++ = 0xF0 | (cp >> 18);
+					*o++ = 0x80 | ((cp >> 12) & 0x3F);
+					*o++ = 0x80 | ((cp >> 6) & 0x3F);
+					*o++ = 0x80 | (cp & 0x3F);
+				}
+				break;
+			default:
+				*len = escape - start;
+				return NULL;
+		}
+	}
+	*o = 0;
+	*len = o - out;
+	return p;
+}
+
+// Returns true if every character of a key is in the alphabet.
+static inline bool _symtree_valid_key(const char *name, size_t namelen) {
+	return _symtree_parse_key(NULL, name, namelen);
+}
+
+#ifdef _SYMTREE_PARALLEL
+// Used internally by load_symtree_parallel to queue a key for a bulk load.
+// @returns False if failed to allocate memory.
+static bool _symtree_bulk_push(_symtree_bulk_t *bulk, const char *name, size_t namelen, VALUE_TYPE value);
+#endif
+
+// Used internally by append_symtree to add a key to the tree, or queue it in bulk if not NULL.
+// Keys with characters outside of the alphabet are skipped.
+// @returns False if failed to allocate memory.
+static inline bool _symtree_append_key(symtree_t *tree, _symtree_bulk_t *bulk, const char *key, size_t keylen, VALUE_TYPE value) {
+#ifdef _SYMTREE_PARALLEL
+	if (bulk != NULL) {
+		return _symtree_bulk_push(bulk, key, keylen, value);
+	}
+#endif
+	return new_sym(tree, key, keylen, value) != NULL || !_symtree_valid_key(key, keylen);
+}
+
+// Used internally by append_symtree and append_symtree_parallel to parse json data.
+// Keys are added to the tree if bulk is NULL, otherwise they are queued in bulk.
+static symtree_t *_symtree_append(symtree_t *tree, const char *data, size_t datalen, size_t *error, _symtree_bulk_t *bulk);
+
+static symtree_t *append_symtree(symtree_t *tree, const char *data, size_t datalen) {
+	return _symtree_append(tree, data, datalen, NULL, NULL);
+}
+
+static symtree_t *append_symtree_ex(symtree_t *tree, const char *data, size_t datalen, size_t *error) {
+	return _symtree_append(tree, data, datalen, error, NULL);
+}
+
+static symtree_t *_symtree_append(symtree_t *tree, const char *data, size_t datalen, size_t *error, _symtree_bulk_t *bulk) {
+	const char *p = data, *end = data + datalen, *key, *keystart, *next;
+	size_t rootkeylen = strlen(symtree_root_node_key);
+	char *values, *value;
+	size_t keylen, len;
+#ifdef _SYMTREE_INTERN_VALUES
+	// values are unescaped into a scratch buffer and interned from there, so only escaped keys stay in it
+	char *scratch;
+	if ((values = scratch = (char*)malloc(datalen + 1)) == NULL) {
+		if (error != NULL) {
+			*error = 0;
+		}
+		return NULL;
+	}
+#ifdef _SYMTREE_PARALLEL
+	if (bulk != NULL) {
+		// queued keys are inserted after parsing, so the buffer lives as long as the bulk load
+		bulk->scratch = scratch;
+		scratch = NULL;
+	}
+#endif
+#else
+	symtree_info_t *info = _SYMTREE_INFO(tree);
+	symtree_pool_t *pool;
+	// every value fits within the input, so one block holds them all
+	if ((pool = (symtree_pool_t*)malloc(sizeof(symtree_pool_t) + datalen)) == NULL) {
+		if (error != NULL) {
+			*error = 0;
+		}
+		return NULL;
+	}
+	pool->next = info->pools;
+	pool->size = datalen;
+	pool->refs = 1;
+	info->pools = pool;
+	values = (char*)(pool + 1);
+#endif
+	p = _symtree_skip_space(p, end);
+	if (p >= end || *p != '{') {
+		goto fail;
+	}
+	p = _symtree_skip_space(p + 1, end);
+	if (p < end && *p == '}') {
+		goto close;
+	}
+	while (p < end) {
+		if (*p++ != '"') {
+			p--;
+			goto fail;
+		}
+		// keys are inserted straight from the input unless they contain escapes
+		key = keystart = p;
+		next = _symtree_scan_string(p, end);
+		if (next < end && *next == '"') {
+			keylen = next - p;
+			p = next + 1;
+		} else {
+			if ((next = _symtree_read_string(p, end, values, &keylen)) == NULL) {
+				p += keylen;
+				goto fail;
+			}
+			// unescaped keys go into the pool as well, which still can't outgrow the input
+			key = values;
+			values += keylen;
+			p = next;
+		}
+		p = _symtree_skip_space(p, end);
+		if (p >= end || *p++ != ':') {
+			p--;
+			goto fail;
+		}
+		p = _symtree_skip_space(p, end);
+		if (p >= end || *p++ != '"') {
+			p--;
+			goto fail;
+		}
+		value = values;
+		if ((next = _symtree_read_string(p, end, value, &len)) == NULL) {
+			p += len;
+			goto fail;
+		}
+#ifdef _SYMTREE_INTERN_VALUES
+		if ((value = symtree_intern(tree, value, len)) == NULL) {
+			if (error != NULL) {
+				*error = 0;
+			}
+			free(scratch);
+			return NULL;
+		}
+#endif
+		if (keylen == rootkeylen && memcmp(key, symtree_root_node_key, keylen) == 0) {
+			// the root node is added as an empty key
+			if (!_symtree_append_key(tree, bulk, "", 0, value)) {
+				p = keystart;
+				goto fail;
+			}
+		} else if (keylen > 0 && !_symtree_append_key(tree, bulk, key, keylen, value)) {
+			p = keystart;
+			goto fail;
+		}
+#ifndef _SYMTREE_INTERN_VALUES
+		values += len + 1;
+#endif
+		p = _symtree_skip_space(next, end);
+		if (p < end && *p == ',') {
+			p = _symtree_skip_space(p + 1, end);
+		} else if (p < end && *p == '}') {
+			goto close;
+		} else {
+			goto fail;
+		}
+	}
+	goto fail;
+close:
+	// nothing but whitespace may follow the object
+	if ((p = _symtree_skip_space(p + 1, end)) >= end) {
+		goto done;
+	}
+fail:
+	if (error != NULL) {
+		*error = p - data;
+	}
+	tree = NULL;
+done:
+#ifdef _SYMTREE_INTERN_VALUES
+	free(scratch);
+#endif
+	return tree;
+}
+
+#ifdef _SYMTREE_PARALLEL
+// A thread of a parallel bulk load.
+typedef struct {
+	_symtree_bulk_t *bulk;
+	// scratch tree the thread builds its groups in, until they are moved into the loaded tree
+	symtree_t *tree;
+	bool failed;
+	bool invalid;
+	bool started;
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+} _symtree_bulk_worker_t;
+
+static inline void _symtree_bulk_lock(_symtree_bulk_t *bulk) {
+#ifdef _WIN32
+	EnterCriticalSection(&bulk->lock);
+#else
+	pthread_mutex_lock(&bulk->lock);
+#endif
+}
+
+static inline void _symtree_bulk_unlock(_symtree_bulk_t *bulk) {
+#ifdef _WIN32
+	LeaveCriticalSection(&bulk->lock);
+#else
+	pthread_mutex_unlock(&bulk->lock);
+#endif
+}
+
+// Returns the number of processors available.
+static unsigned _symtree_cpu_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n;
+#endif
+}
+
+static bool _symtree_bulk_push(_symtree_bulk_t *bulk, const char *name, size_t namelen, VALUE_TYPE value) {
+	size_t capacity;
+	void *p;
+	if (bulk->count >= bulk->capacity) {
+		capacity = bulk->capacity < 1024 ? 1024 : bulk->capacity * 2;
+		if ((p = realloc(bulk->names, capacity * sizeof(char*))) == NULL) {
+			return false;
+		}
+		bulk->names = (const char**)p;
+		if ((p = realloc(bulk->namelens, capacity * sizeof(size_t))) == NULL) {
+			return false;
+		}
+		bulk->namelens = (size_t*)p;
+		if ((p = realloc(bulk->values, capacity * sizeof(VALUE_TYPE))) == NULL) {
+			return false;
+		}
+		bulk->values = (VALUE_TYPE*)p;
+		bulk->capacity = capacity;
+	}
+	bulk->names[bulk->count] = name;
+	bulk->namelens[bulk->count] = namelen;
+	bulk->values[bulk->count] = value;
+	bulk->count++;
+	return true;
+}
+
+// Get the first key number of key k of a bulk load.
+// @returns Key number, _SYMTREE_NUM_CHARS if the key is empty, or an invalid key number.
+static inline unsigned _symtree_bulk_group(_symtree_bulk_t *bulk, size_t k) {
+	if ((bulk->namelens == NULL || bulk->namelens[k] == 0) && bulk->names[k][0] == 0) {
+		return _SYMTREE_NUM_CHARS;
+	}
+	return _PARSE_SYM_NAME_CHAR((uint8_t)bulk->names[k][0]);
+}
+
+// Add key k of a bulk load to a tree.
+// @param invalid Set if the key has characters outside of the alphabet.
+// @returns False if failed to allocate memory.
+static bool _symtree_bulk_add(_symtree_bulk_t *bulk, symtree_t *tree, size_t k, bool *invalid) {
+	const char *name = bulk->names[k];
+	size_t namelen = bulk->namelens == NULL ? 0 : bulk->namelens[k];
+	if (new_sym(tree, name, namelen, bulk->values[k]) != NULL) {
+		return true;
+	}
+	if (namelen == 0) {
+		namelen = strlen(name);
+	}
+	if (!_symtree_valid_key(name, namelen)) {
+		*invalid = true;
+		return true;
+	}
+	return false;
+}
+
+#ifdef _SYMTREE_USE_ARENA
+// Take a window of at least size bytes from the end of the loaded tree's arena.
+// @param start Set to the offset of the window from the arena base.
+// @param windowsize Set to the size of the window.
+// @returns False if the arena is exhausted.
+static bool _symtree_bulk_take(_symtree_bulk_t *bulk, size_t size, size_t *start, size_t *windowsize) {
+	symtree_info_t *owner = _SYMTREE_INFO(bulk->tree);
+#ifdef _SYMTREE_USE_PAGED_NODES
+	const size_t unit = _SYMTREE_PAGE_SIZE;
+#else
+	const size_t unit = _SYMTREE_ARENA_ALIGN;
+#endif
+	bool success;
+	if (size < _SYMTREE_PARALLEL_CHUNK_SIZE) {
+		size = _SYMTREE_PARALLEL_CHUNK_SIZE;
+	}
+	size = (size + unit - 1) / unit * unit;
+	_symtree_bulk_lock(bulk);
+	*start = (owner->used + unit - 1) / unit * unit;
+	if ((success = _symtree_arena_ensure(owner, *start + size))) {
+		owner->used = *start + size;
+	}
+	_symtree_bulk_unlock(bulk);
+	*windowsize = size;
+	return success;
+}
+
+static bool _symtree_bulk_window(symtree_info_t *info, size_t end) {
+	size_t start, size;
+	// the rest of the old window is left unused
+	if (!_symtree_bulk_take(info->bulk, end - info->used, &start, &size)) {
+		return false;
+	}
+	info->used = start;
+	info->committed = start + size;
+	return true;
+}
+#endif
+
+// Create a scratch tree for a bulk load thread.
+// In arena mode it lives in a window of the loaded tree's arena, which the thread allocates from without locking until it runs out.
+// @returns Scratch tree, or NULL if failed to allocate memory.
+static symtree_t *_symtree_bulk_scratch(_symtree_bulk_t *bulk) {
+#ifdef _SYMTREE_USE_ARENA
+	symtree_info_t *owner = _SYMTREE_INFO(bulk->tree), *info;
+	symtree_t *tree;
+	size_t start, size;
+#ifdef _SYMTREE_USE_PAGED_NODES
+	symtree_page_t *page;
+	if (!_symtree_bulk_take(bulk, _SYMTREE_PAGE_SIZE, &start, &size)) {
+		return NULL;
+	}
+	// as with alloc_symtree, the first page holds the info block and root node
+	page = (symtree_page_t*)(owner->base + start);
+	memset(page, 0, sizeof(symtree_page_t));
+	page->base = owner->base;
+	page->used = (_SYMTREE_PAGE_HEADER_SIZE + _SYMTREE_INFO_SIZE) / _SYMTREE_BLOCK_SIZE;
+	info = (symtree_info_t*)((uint8_t*)page + _SYMTREE_PAGE_HEADER_SIZE);
+	memset(info, 0, sizeof(symtree_info_t));
+	info->page = page;
+	info->used = start + _SYMTREE_PAGE_SIZE;
+#else
+	if (!_symtree_bulk_take(bulk, _SYMTREE_INFO_SIZE + sizeof(symtree_t), &start, &size)) {
+		return NULL;
+	}
+	info = (symtree_info_t*)(owner->base + start);
+	memset(info, 0, sizeof(symtree_info_t));
+	info->used = start + _SYMTREE_INFO_SIZE;
+#endif
+	info->base = owner->base;
+	info->committed = start + size;
+	info->bulk = bulk;
+#ifdef _SYMTREE_USE_PAGED_NODES
+	tree = (symtree_t*)_symtree_page_alloc(info, sizeof(symtree_t));
+#else
+	tree = (symtree_t*)_symtree_arena_alloc(info, sizeof(symtree_t));
+#endif
+	if (tree == NULL) {
+		return NULL;
+	}
+	memset(tree, 0, sizeof(symtree_t));
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	tree->kind = _SYMTREE_NODE_FULL;
+#endif
+	info->counts.nodes = 1;
+	info->counts.nodebytes = sizeof(symtree_t);
+#ifdef _SYMTREE_INTERN_VALUES
+	// borrowed without a reference, so that interned values are counted as the loaded tree counts them
+	info->pools = owner->pools;
+#endif
+	return tree;
+#else
+	symtree_t *tree = alloc_symtree();
+#ifdef _SYMTREE_INTERN_VALUES
+	if (tree != NULL) {
+		// borrowed without a reference, so that interned values are counted as the loaded tree counts them
+		_SYMTREE_INFO(tree)->pools = _SYMTREE_INFO(bulk->tree)->pools;
+	}
+#endif
+	return tree;
+#endif
+}
+
+// Build groups of a bulk load in a thread's scratch tree until there are none left.
+static void _symtree_bulk_run(_symtree_bulk_worker_t *worker) {
+	_symtree_bulk_t *bulk = worker->bulk;
+	unsigned c;
+	for (;;) {
+		_symtree_bulk_lock(bulk);
+		c = bulk->next < bulk->queued ? bulk->queue[bulk->next++] : _SYMTREE_NUM_CHARS;
+		_symtree_bulk_unlock(bulk);
+		if (c >= _SYMTREE_NUM_CHARS) {
+			return;
+		}
+		if (worker->tree == NULL && (worker->tree = _symtree_bulk_scratch(bulk)) == NULL) {
+			worker->failed = true;
+			return;
+		}
+		for (size_t i=bulk->start[c]; i<bulk->start[c+1]; i++) {
+			if (!_symtree_bulk_add(bulk, worker->tree, bulk->order[i], &worker->invalid)) {
+				worker->failed = true;
+				return;
+			}
+		}
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI _symtree_bulk_thread(LPVOID worker) {
+	_symtree_bulk_run(worker);
+#ifdef _SYMTREE_INSTRUMENT
+	symtree_metrics_thread_exit();
+#endif
+	return 0;
+}
+#else
+static void *_symtree_bulk_thread(void *worker) {
+	_symtree_bulk_run((_symtree_bulk_worker_t*)worker);
+#ifdef _SYMTREE_INSTRUMENT
+	symtree_metrics_thread_exit();
+#endif
+	return NULL;
+}
+#endif
+
+// Add up the nodes, keys and bytes of a subtree of the tree with the given info.
+static void _symtree_tally(symtree_info_t *info, symtree_t *tree, symtree_counts_t *counts) {
+	symtree_t *st;
+	counts->nodes++;
+	counts->nodebytes += _symtree_node_size(tree);
+	if (tree->leaf != NULL) {
+		counts->keys++;
+		counts->valuebytes += _symtree_value_size(info, tree->leaf);
+	}
+#ifdef _SYMTREE_BURST_CONTAINERS
+	if (tree->kind == _SYMTREE_NODE_BURST) {
+		_SYMTREE_FOREACH_ENTRY(tree, e) {
+			if (*_SYMTREE_ENTRY_VALUE(e) != NULL) {
+				counts->keys++;
+				counts->valuebytes += _symtree_value_size(info, *_SYMTREE_ENTRY_VALUE(e));
+			}
+		}
+	}
+#endif
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+		_symtree_tally(info, st, counts);
+	}
+}
+
+// Move the subtrees built by a bulk load thread into the loaded tree, and free its scratch tree.
+// @returns False if a subtree could not be linked into the loaded tree.
+static bool _symtree_bulk_merge(_symtree_bulk_t *bulk, symtree_t *scratch) {
+	symtree_t *tree = bulk->tree, *st;
+	symtree_info_t *info = _SYMTREE_INFO(tree), *sinfo = _SYMTREE_INFO(scratch);
+	symtree_counts_t lost = {0, 0, 0, 0};
+	bool success = true;
+#ifdef _SYMTREE_USE_ARENA
+	void *p;
+#endif
+	_SYMTREE_FOREACH_CHILD(scratch, c, st) {
+		if (!_symtree_put_child(tree, c, st)) {
+			_symtree_tally(sinfo, st, &lost);
+			success = false;
+			continue;
+		}
+#ifndef _SYMTREE_USE_ARENA
+		scratch->symbols[c] = _SYM_NULL;
+#endif
+	}
+	// the counts move over along with the subtrees, less those left behind
+	info->counts.nodes += sinfo->counts.nodes - lost.nodes;
+	info->counts.keys += sinfo->counts.keys - lost.keys;
+	info->counts.nodebytes += sinfo->counts.nodebytes - lost.nodebytes;
+	info->counts.valuebytes += sinfo->counts.valuebytes - lost.valuebytes;
+#ifdef _SYMTREE_INTERN_VALUES
+	sinfo->pools = NULL;
+#endif
+#ifdef _SYMTREE_USE_ARENA
+	// hand the blocks freed while building over to the loaded tree
+	for (unsigned i=0; i<=_SYMTREE_ARENA_FREE_LISTS; i++) {
+		while ((p = sinfo->free_lists[i]) != NULL) {
+			sinfo->free_lists[i] = *(void**)p;
+			*(void**)p = info->free_lists[i];
+			info->free_lists[i] = p;
+		}
+	}
+	// subtrees that failed to link stay behind in the arena, which free_symtree releases as a whole
+	_symtree_free_node(info, scratch);
+#else
+	info->counts.nodes--;
+	info->counts.nodebytes -= sizeof(symtree_t);
+	// by now the scratch tree only holds subtrees that failed to link
+	free_symtree(scratch);
+#endif
+	return success;
+}
+
+// Add the keys queued in a bulk load to its tree.
+// Groups of keys sharing a first key number are built in scratch trees by up to threads threads, then moved into the tree.
+// @returns False if failed to allocate memory.
+static bool _symtree_bulk_insert(_symtree_bulk_t *bulk, unsigned threads) {
+	symtree_t *tree = bulk->tree;
+	_symtree_bulk_worker_t *workers = NULL;
+	size_t fill[_SYMTREE_NUM_CHARS];
+	uint8_t serial[_SYMTREE_NUM_CHARS];
+	unsigned nserial = 0, n, c, i, j;
+	size_t k;
+	bool success = true;
+	if (threads == 0) {
+		threads = _symtree_cpu_count();
+	}
+	if (threads <= 1) {
+		// nothing to gain from grouping the keys
+		for (k=0; k<bulk->count; k++) {
+			if (!_symtree_bulk_add(bulk, tree, k, &bulk->invalid)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	// group the keys by first key number
+	memset(bulk->start, 0, sizeof(bulk->start));
+	for (k=0; k<bulk->count; k++) {
+		c = _symtree_bulk_group(bulk, k);
+		if (c == _SYMTREE_NUM_CHARS) {
+			_symtree_set_leaf(_SYMTREE_INFO(tree), &tree->leaf, bulk->values[k]);
+		} else if (_SYMTREE_INVALID_CHAR(c)) {
+			bulk->invalid = true;
+		} else {
+			bulk->start[c+1]++;
+		}
+	}
+	for (c=0; c<_SYMTREE_NUM_CHARS; c++) {
+		bulk->start[c+1] += bulk->start[c];
+	}
+	if ((bulk->order = (size_t*)malloc(bulk->start[_SYMTREE_NUM_CHARS] * sizeof(size_t) + 1)) == NULL) {
+		return false;
+	}
+	memcpy(fill, bulk->start, sizeof(fill));
+	for (k=0; k<bulk->count; k++) {
+		if (!_SYMTREE_INVALID_CHAR(c = _symtree_bulk_group(bulk, k))) {
+			bulk->order[fill[c]++] = k;
+		}
+	}
+	// groups that already have a subtree are added in place, the rest are queued largest first
+	bulk->queued = bulk->next = 0;
+	for (c=0; c<_SYMTREE_NUM_CHARS; c++) {
+		if (bulk->start[c+1] == bulk->start[c]) {
+			continue;
+		}
+		if (_symtree_child(tree, c) != NULL) {
+			serial[nserial++] = c;
+			continue;
+		}
+		for (i=bulk->queued++; i>0 && bulk->start[bulk->queue[i-1]+1] - bulk->start[bulk->queue[i-1]] < bulk->start[c+1] - bulk->start[c]; i--) {
+			bulk->queue[i] = bulk->queue[i-1];
+		}
+		bulk->queue[i] = c;
+	}
+	n = threads < bulk->queued ? threads : bulk->queued;
+	if (n > 1 && (workers = (_symtree_bulk_worker_t*)calloc(n, sizeof(_symtree_bulk_worker_t))) != NULL) {
+#ifdef _WIN32
+		InitializeCriticalSection(&bulk->lock);
+#else
+		pthread_mutex_init(&bulk->lock, NULL);
+#endif
+		for (i=0; i<n; i++) {
+			workers[i].bulk = bulk;
+		}
+		// the calling thread works too, and picks up the groups of any thread that failed to start
+		for (i=1; i<n; i++) {
+#ifdef _WIN32
+			workers[i].started = (workers[i].thread = CreateThread(NULL, 0, _symtree_bulk_thread, &workers[i], 0, NULL)) != NULL;
+#else
+			workers[i].started = pthread_create(&workers[i].thread, NULL, _symtree_bulk_thread, &workers[i]) == 0;
+#endif
+		}
+		_symtree_bulk_run(&workers[0]);
+		for (i=1; i<n; i++) {
+			if (workers[i].started) {
+#ifdef _WIN32
+				WaitForSingleObject(workers[i].thread, INFINITE);
+				CloseHandle(workers[i].thread);
+#else
+				pthread_join(workers[i].thread, NULL);
+#endif
+			}
+		}
+#ifdef _WIN32
+		DeleteCriticalSection(&bulk->lock);
+#else
+		pthread_mutex_destroy(&bulk->lock);
+#endif
+		for (i=0; i<n; i++) {
+			if (workers[i].tree != NULL && !_symtree_bulk_merge(bulk, workers[i].tree)) {
+				success = false;
+			}
+			if (workers[i].failed) {
+				success = false;
+			}
+			if (workers[i].invalid) {
+				bulk->invalid = true;
+			}
+		}
+		free(workers);
+	} else {
+		// not worth starting threads for, build everything in place
+		for (i=0; i<bulk->queued; i++) {
+			serial[nserial++] = bulk->queue[i];
+		}
+	}
+	for (j=0; j<nserial && success; j++) {
+		c = serial[j];
+		for (k=bulk->start[c]; k<bulk->start[c+1]; k++) {
+			if (!_symtree_bulk_add(bulk, tree, bulk->order[k], &bulk->invalid)) {
+				success = false;
+				break;
+			}
+		}
+	}
+	free(bulk->order);
+	bulk->order = NULL;
+	return success;
+}
+#endif
+
+#ifdef _SYMTREE_PARALLEL
+static bool new_syms_parallel(symtree_t *tree, const char *const *names, const size_t *namelens, VALUE_TYPE const *values, size_t count, unsigned threads) {
+	_symtree_bulk_t bulk;
+	memset(&bulk, 0, sizeof(bulk));
+	bulk.tree = tree;
+	// the arrays are only ever read
+	bulk.names = (const char**)names;
+	bulk.namelens = (size_t*)namelens;
+	bulk.values = (VALUE_TYPE*)values;
+	bulk.count = count;
+	return _symtree_bulk_insert(&bulk, threads) && !bulk.invalid;
+}
+
+static symtree_t *load_symtree_parallel(const char *data, size_t datalen, unsigned threads, size_t *error) {
+	symtree_t *tree = alloc_symtree();
+	if (tree == NULL) {
+		if (error != NULL) {
+			*error = 0;
+		}
+		return NULL;
+	}
+	if (append_symtree_parallel(tree, data, datalen, threads, error) == NULL) {
+		free_symtree(tree);
+		return NULL;
+	}
+	return tree;
+}
+
+static symtree_t *append_symtree_parallel(symtree_t *tree, const char *data, size_t datalen, unsigned threads, size_t *error) {
+	_symtree_bulk_t bulk;
+	bool success;
+	memset(&bulk, 0, sizeof(bulk));
+	bulk.tree = tree;
+	// keys with characters outside of the alphabet are skipped, as with append_symtree
+	if ((success = _symtree_append(tree, data, datalen, error, &bulk) != NULL)) {
+		if (!(success = _symtree_bulk_insert(&bulk, threads)) && error != NULL) {
+			*error = 0;
+		}
+	}
+	free(bulk.names);
+	free(bulk.namelens);
+	free(bulk.values);
+#ifdef _SYMTREE_INTERN_VALUES
+	free(bulk.scratch);
+#endif
+	return success ? tree : NULL;
+}
+#endif
+
+static symtree_t *alloc_symtree(void) {
+	symtree_t *tree;
+#ifdef _SYMTREE_USE_ARENA
+#ifdef _SYMTREE_USE_PAGED_NODES
+	// the first page starts at the arena base, and holds the info block and root node
+	symtree_info_t *info = _symtree_arena_create(_SYMTREE_PAGE_HEADER_SIZE);
+	symtree_page_t *page;
+	if (info == NULL) {
+		return NULL;
+	}
+	page = info->page = (symtree_page_t*)info->base;
+	memset(page, 0, sizeof(symtree_page_t));
+	page->base = info->base;
+	page->used = (_SYMTREE_PAGE_HEADER_SIZE + _SYMTREE_INFO_SIZE) / _SYMTREE_BLOCK_SIZE;
+	info->used = _SYMTREE_PAGE_SIZE;
+	tree = (symtree_t*)_symtree_page_alloc(info, sizeof(symtree_t));
+#else
+	symtree_info_t *info = _symtree_arena_create(0);
+	if (info == NULL) {
+		return NULL;
+	}
+	// the root node immediately follows the arena's info block
+	tree = (symtree_t*)_symtree_arena_alloc(info, sizeof(symtree_t));
+#endif
+#else
+	// the root node immediately follows the tree's info block
+	symtree_info_t *info = (symtree_info_t*)_malloc(_SYMTREE_INFO_SIZE + sizeof(symtree_t));
+	if (info == NULL) {
+		return NULL;
+	}
+	memset(info, 0, sizeof(symtree_info_t));
+	tree = (symtree_t*)((uint8_t*)info + _SYMTREE_INFO_SIZE);
+#endif
+	if (tree == NULL) {
+		return NULL;
+	}
+	memset(tree, 0, sizeof(symtree_t));
+#ifdef _SYMTREE_ADAPTIVE_NODES
+	// root nodes are always full-width so that they never need to move
+	tree->kind = _SYMTREE_NODE_FULL;
+#endif
+	info->counts.nodes = 1;
+	info->counts.nodebytes = sizeof(symtree_t);
+#ifdef _SYMTREE_COPY_ON_WRITE
+	tree->refs = 1;
+#endif
+#ifdef _SYMTREE_CONCURRENT
+	if ((info->epochsmem = _malloc(sizeof(_symtree_epochs_t) + _SYMTREE_CACHE_LINE)) == NULL) {
+		free_symtree(tree);
+		return NULL;
+	}
+	// keep each reader on its own cache line
+	info->epochs = (_symtree_epochs_t*)(((uintptr_t)info->epochsmem + _SYMTREE_CACHE_LINE - 1) & ~(uintptr_t)(_SYMTREE_CACHE_LINE - 1));
+	memset(info->epochs, 0, sizeof(_symtree_epochs_t));
+	info->epochs->epoch = 1;
+	for (unsigned i=0; i<_SYMTREE_MAX_READERS; i++) {
+		info->epochs->readers[i].global = &info->epochs->epoch;
+	}
+	info->reclaimat = _SYMTREE_RECLAIM_THRESHOLD;
+#endif
+	return tree;
+}
+
+#ifndef _SYMTREE_USE_ARENA
+// Recursive function used internally within free_symtree.
+static void _free_symtree(symtree_t *tree) {
+	symtree_t *st;
+#ifdef _SYMTREE_COPY_ON_WRITE
+	// subtrees shared with other trees are freed by the last tree dropping them
+	if (--tree->refs > 0) {
+		return;
+	}
+#endif
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+		_free_symtree(st);
+	}
+	_free(tree);
+}
+#endif
+
+static void free_symtree(symtree_t *tree) {
+	symtree_info_t *info = _SYMTREE_INFO(tree);
+	symtree_pool_t *pool;
+	// pools shared with clones are freed along with the last tree or pool linking to them
+	while ((pool = info->pools) != NULL && --pool->refs == 0) {
+		info->pools = pool->next;
+		free(pool);
+	}
+#ifdef _SYMTREE_INTERN_VALUES
+	free(info->interns);
+#endif
+#ifdef _SYMTREE_CONCURRENT
+	// there can be no readers left by now
+	for (size_t i=0; i<info->numretired; i++) {
+		if (info->retired[i].node) {
+			_symtree_free_node(info, (symtree_t*)info->retired[i].p);
+		} else {
+			free(info->retired[i].p);
+		}
+	}
+	free(info->retired);
+	_free(info->epochsmem);
+#endif
+#ifdef _SYMTREE_USE_ARENA
+	// every node lives in the tree's arena, so there is no need to walk the tree
+#ifdef _SYMTREE_USE_PAGED_NODES
+	for (size_t offset=0; offset<info->used; offset+=_SYMTREE_PAGE_SIZE) {
+		_free(((symtree_page_t*)(info->base + offset))->escapes);
+	}
+#endif
+	_symtree_arena_destroy(info);
+#else
+	symtree_t *st;
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+		_free_symtree(st);
+	}
+	_free(info);
+#endif
+}
+
+#ifdef _SYMTREE_CONCURRENT
+static symtree_reader_t *symtree_register_reader(symtree_t *tree) {
+	_symtree_epochs_t *epochs = _SYMTREE_INFO(tree)->epochs;
+	for (unsigned i=0; i<_SYMTREE_MAX_READERS; i++) {
+		if (!_SYMTREE_LOAD(&epochs->readers[i].used) && _SYMTREE_CLAIM(&epochs->readers[i].used)) {
+			return &epochs->readers[i];
+		}
+	}
+	return NULL;
+}
+
+static void symtree_unregister_reader(symtree_reader_t *reader) {
+	_SYMTREE_STORE(&reader->used, 0);
+}
+
+static inline void symtree_read_begin(symtree_reader_t *reader) {
+	_SYMTREE_STORE(&reader->epoch, _SYMTREE_LOAD(reader->global));
+	// the epoch has to be visible to the writer before any node is read
+	_SYMTREE_FULL_FENCE();
+}
+
+static inline void symtree_read_end(symtree_reader_t *reader) {
+	// every load of the read section has to be done before the writer sees it end
+	_SYMTREE_STORE(&reader->epoch, 0);
+}
+
+static size_t symtree_reclaim(symtree_t *tree) {
+	return _symtree_reclaim(_SYMTREE_INFO(tree));
+}
+#endif
+
+#ifndef _SYMTREE_COPY_ON_WRITE
+// Recursive function used internally within clone_symtree.
+// Copies of the subtrees are linked into the clone before their own subtrees are copied, so free_symtree can release a partial clone.
+// @param nt Node of the clone to copy the subtrees of tree into.
+// @returns True if succeeded, false if failed to allocate memory.
+static bool _symtree_clone_children(symtree_info_t *info, symtree_t *nt, symtree_t *tree) {
+	symtree_t *st, *ct;
+	size_t labellen = 0;
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+#ifdef _SYMTREE_PATH_COMPRESSION
+		labellen = st->labellen;
+#endif
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (st->kind == _SYMTREE_NODE_BURST) {
+			labellen = _symtree_bucket_capacity(st);
+		}
+#endif
+		_SYMTREE_ALLOC_NEAR(info, nt);
+		if ((ct = _alloc_symtree_node(info, _SYMTREE_NODE_KIND(st), labellen)) == NULL) {
+			return false;
+		}
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (st->kind == _SYMTREE_NODE_BURST) {
+			// entries are copied as they are, sharing their values like the rest of the clone
+			memcpy(_SYMTREE_BUCKET_HEADER(ct), _SYMTREE_BUCKET_HEADER(st), sizeof(_symtree_bucket_t));
+			memcpy(_SYMTREE_BUCKET_DATA(ct), _SYMTREE_BUCKET_DATA(st), _symtree_bucket_used(st));
+			ct->count = st->count;
+			labellen = 0;
+		}
+#endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+		memcpy(_SYMTREE_LABEL(ct), _SYMTREE_LABEL(st), labellen);
+#endif
+		ct->leaf = st->leaf;
+#ifdef _SYMTREE_WEIGHTS
+		ct->weight = st->weight;
+		ct->maxweight = st->maxweight;
+#endif
+		if (!_symtree_put_child(nt, c, ct)) {
+			_symtree_free_node(info, ct);
+			return false;
+		}
+		if (!_symtree_clone_children(info, ct, st)) {
+			return false;
+		}
+	}
+	return true;
+}
+#endif
+
+static symtree_t *clone_symtree(symtree_t *tree) {
+	symtree_info_t *info = _SYMTREE_INFO(tree), *cinfo;
+	symtree_t *clone;
+	if ((clone = alloc_symtree()) == NULL) {
+		return NULL;
+	}
+	cinfo = _SYMTREE_INFO(clone);
+	clone->leaf = tree->leaf;
+#ifdef _SYMTREE_WEIGHTS
+	clone->weight = tree->weight;
+	clone->maxweight = tree->maxweight;
+#endif
+#ifdef _SYMTREE_COPY_ON_WRITE
+	// the root of each tree is its own, since it sits behind the tree's info block, but everything below it is shared
+	symtree_t *st;
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+		if (!_symtree_put_child(clone, c, st)) {
+			free_symtree(clone);
+			return NULL;
+		}
+		st->refs++;
+	}
+#else
+	if (!_symtree_clone_children(cinfo, clone, tree)) {
+		free_symtree(clone);
+		return NULL;
+	}
+#endif
+	// values are shared rather than copied, including those in the original's pools
+	if ((cinfo->pools = info->pools) != NULL) {
+		info->pools->refs++;
+	}
+	info->cloned = cinfo->cloned = true;
+	cinfo->counts = info->counts;
+#ifdef _SYMTREE_INTERN_VALUES
+	// the clone shares the store's values, but starts its own table and pool for values interned after this
+	cinfo->internbytes = info->internbytes - info->interncapacity * sizeof(char*);
+	cinfo->counts.valuebytes -= info->interncapacity * sizeof(char*);
+#endif
+	return clone;
+}
+
+// Open node of symtree_build_sorted, which may still get more subtrees.
+typedef struct {
+	// number of key characters from the root to the end of the node's label
+	size_t depth;
+	// index of the node's first finished subtree on the subtree stack
+	size_t children;
+	VALUE_TYPE leaf;
+	// key numbers the node has subtrees for so far
+	uint64_t used[(_SYMTREE_NUM_CHARS + 63) / 64];
+} _symtree_build_frame_t;
+
+// Finished subtree of symtree_build_sorted, waiting for its parent node to be finished.
+typedef struct {
+	symtree_t *tree;
+	unsigned c;
+} _symtree_build_child_t;
+
+// State of symtree_build_sorted.
+typedef struct {
+	symtree_info_t *info;
+	_symtree_build_frame_t *frames;
+	size_t numframes;
+	size_t maxframes;
+	_symtree_build_child_t *children;
+	size_t numchildren;
+	size_t maxchildren;
+} _symtree_build_t;
+
+// Open a new node of symtree_build_sorted.
+// @returns False if failed to allocate memory.
+static bool _symtree_build_push(_symtree_build_t *b, size_t depth, VALUE_TYPE leaf) {
+	_symtree_build_frame_t *frames;
+	size_t max;
+	if (b->numframes >= b->maxframes) {
+		max = b->maxframes < 64 ? 64 : b->maxframes * 2;
+		if ((frames = (_symtree_build_frame_t*)realloc(b->frames, max * sizeof(_symtree_build_frame_t))) == NULL) {
+			return false;
+		}
+		b->frames = frames;
+		b->maxframes = max;
+	}
+	frames = &b->frames[b->numframes++];
+	memset(frames, 0, sizeof(_symtree_build_frame_t));
+	frames->depth = depth;
+	frames->children = b->numchildren;
+	frames->leaf = leaf;
+	return true;
+}
+
+// Allocate the node for a finished open node of symtree_build_sorted, and put it on the subtree stack in place of its subtrees.
+// Labels too long for a single node (or every character, without path compression) are split into a chain of nodes.
+// @param frame Finished node, already removed from the open nodes.
+// @param parentdepth Depth of the node's parent.
+// @param name Key passing through the node.
+// @returns False if failed to allocate memory or encode a subtree reference.
+static bool _symtree_build_finish(_symtree_build_t *b, _symtree_build_frame_t *frame, size_t parentdepth, const char *name) {
+	_symtree_build_child_t *children;
+	size_t count = b->numchildren - frame->children, end = frame->depth, m = 0, max;
+	VALUE_TYPE leaf = frame->leaf;
+	symtree_t *tree;
+	if (frame->children >= b->maxchildren) {
+		max = b->maxchildren < 64 ? 64 : b->maxchildren * 2;
+		if ((children = (_symtree_build_child_t*)realloc(b->children, max * sizeof(_symtree_build_child_t))) == NULL) {
+			return false;
+		}
+		b->children = children;
+		b->maxchildren = max;
+	}
+	children = &b->children[frame->children];
+	for (;;) {
+#ifdef _SYMTREE_PATH_COMPRESSION
+		if ((m = end - parentdepth - 1) > _SYMTREE_MAX_LABEL_LEN) {
+			m = _SYMTREE_MAX_LABEL_LEN;
+		}
+#endif
+		// subtrees are finished first, so each node lands right after them
+		if (count > 0) {
+			_SYMTREE_ALLOC_NEAR(b->info, children[0].tree);
+		}
+#ifdef _SYMTREE_ADAPTIVE_NODES
+		tree = _alloc_symtree_node(b->info, _symtree_fit_kind(count), m);
+#else
+		tree = _alloc_symtree_node(b->info, 0, m);
+#endif
+		if (tree == NULL) {
+			return false;
+		}
+#ifdef _SYMTREE_PATH_COMPRESSION
+		_symtree_set_label(tree, &name[end - m]);
+#endif
+		_symtree_set_leaf(b->info, &tree->leaf, leaf);
+		for (size_t i=0; i<count; i++) {
+			if (!_symtree_put_child(tree, children[i].c, children[i].tree)) {
+				_symtree_free_node(b->info, tree);
+				return false;
+			}
+		}
+		end -= m + 1;
+		children[0].tree = tree;
+		children[0].c = _PARSE_SYM_NAME_CHAR((uint8_t)name[end]);
+		b->numchildren = frame->children + 1;
+		if (end == parentdepth) {
+			return true;
+		}
+		// the rest of the edge becomes a node with just this subtree
+		count = 1;
+		leaf = NULL;
+	}
+}
+
+// Finish the open nodes of symtree_build_sorted deeper than depth, making sure there is an open node at depth.
+// @param name Previous key, which passes through every open node.
+// @returns False if failed to allocate memory or encode a subtree reference.
+static bool _symtree_build_close(_symtree_build_t *b, size_t depth, const char *name) {
+	_symtree_build_frame_t frame, *top;
+	unsigned c;
+	while (b->frames[b->numframes - 1].depth > depth) {
+		frame = b->frames[--b->numframes];
+		top = &b->frames[b->numframes - 1];
+		if (top->depth < depth) {
+			// the next key branches off partway through the node's edge, which splits it
+			if (!_symtree_build_finish(b, &frame, depth, name)) {
+				return false;
+			}
+			c = _PARSE_SYM_NAME_CHAR((uint8_t)name[depth]);
+			// can't fail, since a node was just removed
+			_symtree_build_push(b, depth, NULL);
+			top = &b->frames[b->numframes - 1];
+			top->children = frame.children;
+			top->used[c / 64] |= (uint64_t)1 << (c % 64);
+			return true;
+		}
+		if (!_symtree_build_finish(b, &frame, top->depth, name)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static symtree_t *symtree_build_sorted(const char *const *names, const size_t *namelens, VALUE_TYPE const *values, size_t count) {
+	symtree_t *tree = alloc_symtree();
+	_symtree_build_t b;
+	_symtree_build_frame_t *top;
+	const char *name, *prev = "";
+	size_t namelen, prevlen = 0, i, j = 0, l;
+	unsigned c;
+	if (tree == NULL) {
+		return NULL;
+	}
+	memset(&b, 0, sizeof(b));
+	b.info = _SYMTREE_INFO(tree);
+	if (!_symtree_build_push(&b, 0, NULL)) {
+		goto fail;
+	}
+	for (i=0; i<count; i++) {
+		name = names[i];
+		namelen = (namelens == NULL || namelens[i] == 0) ? strlen(name) : namelens[i];
+		// the prefix shared with the previous key is already known to be valid
+		l = _symtree_match_chars((const uint8_t*)prev, prevlen, name, namelen);
+		if (!_symtree_valid_key(&name[l], namelen - l)) {
+			continue;
+		}
+		// everything past the shared prefix is finished
+		if (!_symtree_build_close(&b, l, prev)) {
+			goto fail;
+		}
+		top = &b.frames[b.numframes - 1];
+		if (namelen == l) {
+			top->leaf = values[i];
+		} else {
+			c = _PARSE_SYM_NAME_CHAR((uint8_t)name[l]);
+			if (top->used[c / 64] & ((uint64_t)1 << (c % 64))) {
+				// the keys are out of order, so the rest are added one at a time
+				break;
+			}
+			top->used[c / 64] |= (uint64_t)1 << (c % 64);
+			if (!_symtree_build_push(&b, namelen, values[i])) {
+				goto fail;
+			}
+		}
+		prev = name;
+		prevlen = namelen;
+	}
+	if (!_symtree_build_close(&b, 0, prev)) {
+		goto fail;
+	}
+	_symtree_set_leaf(b.info, &tree->leaf, b.frames[0].leaf);
+	for (; j<b.numchildren; j++) {
+		if (!_symtree_put_child(tree, b.children[j].c, b.children[j].tree)) {
+			goto fail;
+		}
+	}
+	free(b.frames);
+	free(b.children);
+	for (; i<count; i++) {
+		namelen = namelens == NULL ? 0 : namelens[i];
+		if (new_sym(tree, names[i], namelen, values[i]) == NULL && _symtree_valid_key(names[i], namelen == 0 ? strlen(names[i]) : namelen)) {
+			free_symtree(tree);
+			return NULL;
+		}
+	}
+	return tree;
+fail:
+#ifndef _SYMTREE_USE_ARENA
+	// subtrees not yet linked into the tree
+	for (; j<b.numchildren; j++) {
+		_free_symtree(b.children[j].tree);
+	}
+#endif
+	free(b.frames);
+	free(b.children);
+	free_symtree(tree);
+	return NULL;
+}
+
+static bool debug_dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len) {
+	size_t curlen = 0;
+	size_t i = 0;
+	symtree_t *st;
+	if (curlen + 1 >= bufferlen) {
+		*len = bufferlen;
+		return false;
+	}
+	buffer[curlen++] = '[';
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+		size_t newlen;
+		if (curlen + 2 >= bufferlen) {
+			*len = bufferlen;
+			return false;
+		}
+		buffer[curlen++] = _UNPARSE_SYM_NAME_CHAR(c);
+#ifdef _SYMTREE_PATH_COMPRESSION
+		if (curlen + st->labellen + 1 >= bufferlen) {
+			*len = bufferlen;
+			return false;
+		}
+		memcpy(&buffer[curlen], _SYMTREE_LABEL(st), st->labellen);
+		curlen += st->labellen;
+#endif
+		buffer[curlen++] = '{';
+		if (curlen + 1 >= bufferlen) {
+			*len = bufferlen;
+			return false;
+		}
+		buffer[curlen++] = '\n';
+		if (!debug_dump_symtree(st, &buffer[curlen], bufferlen-curlen, &newlen)) {
+			return false;
+		}
+		curlen += newlen;
+		if (curlen + 3 >= bufferlen) {
+			*len = bufferlen;
+			return false;
+		}
+		buffer[curlen++] = '}';
+		buffer[curlen++] = ',';
+		buffer[curlen++] = '\n';
+	}
+	if (curlen + 1 >= bufferlen) {
+		*len = bufferlen;
+		return false;
+	}
+	buffer[curlen++] = ']';
+	if (tree->leaf != NULL) {
+		char c;
+		if (curlen + 3 >= bufferlen) {
+			*len = bufferlen;
+			return false;
+		}
+		buffer[curlen++] = '=';
+		buffer[curlen++] = '"';
+		i = 0;
+		while ((c = tree->leaf[i++]) != 0) {
+			if (c == '\n' || c == '\t' || c == '"') {
+				if (curlen + 2 >= bufferlen) {
+					*len = bufferlen;
+					return false;
+				}
+				buffer[curlen++] = '\\';
+				if (c == '\n') {
+					buffer[curlen++] = 'n';
+				} else if (c == '\t') {
+					buffer[curlen++] = 't';
+				} else {
+					buffer[curlen++] = c;
+				}
+			} else {
+				if (curlen + 1 >= bufferlen) {
+					*len = bufferlen;
+					return false;
+				}
+				buffer[curlen++] = c;
+			}
+		}
+		buffer[curlen++] = '"';
+	}
+	*len = curlen;
+	return true;
+}
+
+static size_t symtree_size(symtree_t *tree, bool include_value_strings) {
+	symtree_counts_t *counts = &_SYMTREE_INFO(tree)->counts;
+	return counts->nodebytes + counts->keys * sizeof(VALUE_TYPE) + (include_value_strings ? counts->valuebytes : 0);
+}
+
+static symtree_counts_t symtree_counts(symtree_t *tree) {
+	return _SYMTREE_INFO(tree)->counts;
+}
+
+#ifdef _SYMTREE_INTERN_VALUES
+// Hash the bytes of a value for the value store's table (FNV-1a).
+static inline size_t _symtree_intern_hash(const char *value, size_t len) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i=0; i<len; i++) {
+		hash = (hash ^ (uint8_t)value[i]) * 1099511628211ull;
+	}
+	return (size_t)(hash ^ (hash >> 32));
+}
+
+// Used internally by symtree_intern to double the slots of the value store's table.
+// @returns False if failed to allocate memory.
+static bool _symtree_intern_grow(symtree_info_t *info) {
+	size_t capacity = info->interncapacity > 0 ? info->interncapacity * 2 : _SYMTREE_INTERN_TABLE_SIZE, i;
+	char **interns = (char**)calloc(capacity, sizeof(char*));
+	char *value;
+	if (interns == NULL) {
+		return false;
+	}
+	for (size_t j=0; j<info->interncapacity; j++) {
+		if ((value = info->interns[j]) != NULL) {
+			for (i = _symtree_intern_hash(value, symtree_interned_len(value)) & (capacity - 1); interns[i] != NULL; i = (i + 1) & (capacity - 1));
+			interns[i] = value;
+		}
+	}
+	free(info->interns);
+	info->internbytes += (capacity - info->interncapacity) * sizeof(char*);
+	info->counts.valuebytes += (capacity - info->interncapacity) * sizeof(char*);
+	info->interns = interns;
+	info->interncapacity = capacity;
+	return true;
+}
+
+static VALUE_TYPE symtree_intern(symtree_t *tree, const char *value, size_t len) {
+	symtree_info_t *info = _SYMTREE_INFO(tree);
+	symtree_pool_t *pool;
+	size_t i, mask, size;
+	uint32_t len32;
+	char *v;
+	if (len == 0) {
+		len = strlen(value);
+	}
+	if (len >= UINT32_MAX) {
+		return NULL;
+	}
+	// the table is kept at most half full, so that probe runs stay short
+	if ((info->numinterns + 1) * 2 > info->interncapacity && !_symtree_intern_grow(info)) {
+		return NULL;
+	}
+	mask = info->interncapacity - 1;
+	for (i = _symtree_intern_hash(value, len) & mask; (v = info->interns[i]) != NULL; i = (i + 1) & mask) {
+		if (symtree_interned_len(v) == len && memcmp(v, value, len) == 0) {
+			return v;
+		}
+	}
+	size = sizeof(uint32_t) + len + 1;
+	if ((pool = info->internpool) == NULL || info->internused + size > pool->size) {
+		// each pool is twice the size of the last, so that there are few pools for _symtree_in_pool to search
+		size_t poolsize = pool != NULL ? pool->size * 2 : _SYMTREE_INTERN_POOL_SIZE;
+		if (poolsize < size) {
+			poolsize = size;
+		}
+		if ((pool = (symtree_pool_t*)malloc(sizeof(symtree_pool_t) + poolsize)) == NULL) {
+			return NULL;
+		}
+		pool->next = info->pools;
+		pool->size = poolsize;
+		pool->refs = 1;
+		info->pools = info->internpool = pool;
+		info->internused = 0;
+		info->internbytes += sizeof(symtree_pool_t) + poolsize;
+		info->counts.valuebytes += sizeof(symtree_pool_t) + poolsize;
+	}
+	// each value follows its length, which need not be aligned
+	v = (char*)(pool + 1) + info->internused + sizeof(uint32_t);
+	len32 = (uint32_t)len;
+	memcpy(v - sizeof(uint32_t), &len32, sizeof(uint32_t));
+	memcpy(v, value, len);
+	v[len] = 0;
+	info->internused += size;
+	info->interns[i] = v;
+	info->numinterns++;
+	return v;
+}
+#endif
+
+// Used internally by symtree_stats to add a node to the measurements.
+// @param level Number of nodes above the node.
+static void _symtree_stats_node(symtree_info_t *info, symtree_stats_t *stats, symtree_t *tree, size_t level) {
+	size_t size = _symtree_node_size(tree);
+	unsigned fanout = 0;
+	symtree_t *st;
+	_SYMTREE_FOREACH_CHILD(tree, c, st) {
+		fanout++;
+	}
+	if (level > stats->depth) {
+		stats->depth = level;
+	}
+	if (level >= _SYMTREE_STATS_DEPTH) {
+		level = _SYMTREE_STATS_DEPTH - 1;
+	}
+	stats->counts.nodes++;
+	stats->counts.nodebytes += size;
+	stats->levelnodes[level]++;
+	stats->levelbytes[level] += size;
+	stats->fanout[fanout]++;
+	if (tree->leaf != NULL) {
+		stats->counts.keys++;
+		stats->counts.valuebytes += _symtree_value_size(info, tree->leaf);
+		stats->levelkeys[level]++;
+	}
+#ifdef _SYMTREE_BURST_CONTAINERS
+	if (tree->kind == _SYMTREE_NODE_BURST) {
+		stats->containers++;
+		_SYMTREE_FOREACH_ENTRY(tree, e) {
+			if (*_SYMTREE_ENTRY_VALUE(e) != NULL) {
+				stats->counts.keys++;
+				stats->counts.valuebytes += _symtree_value_size(info, *_SYMTREE_ENTRY_VALUE(e));
+				stats->levelkeys[level + _SYMTREE_ENTRY_LEN(e) < _SYMTREE_STATS_DEPTH ? level + _SYMTREE_ENTRY_LEN(e) : _SYMTREE_STATS_DEPTH - 1]++;
+				stats->containerkeys++;
+			}
+		}
+	}
+#endif
+}
+
+static bool symtree_stats(symtree_t *tree, symtree_stats_t *stats) {
+	symtree_info_t *info = _SYMTREE_INFO(tree);
+	_symtree_walk_frame_t stackframes[64];
+	_symtree_walk_frame_t *frames = stackframes, *frame;
+	size_t numframes = 64, depth = 0;
+	bool success = true;
+	symtree_t *st;
+	int c;
+	memset(stats, 0, sizeof(symtree_stats_t));
+	_symtree_stats_node(info, stats, tree, 0);
+	// the frames' prefix lengths hold their levels
+	frames[depth++] = (_symtree_walk_frame_t){tree, 0, 0};
+	while (depth > 0) {
+		frame = &frames[depth-1];
+		if ((c = _symtree_next_child(frame->tree, frame->next, &st)) < 0) {
+			depth--;
+			continue;
+		}
+		frame->next = c + 1;
+		_symtree_stats_node(info, stats, st, depth);
+		if (depth == numframes && !_symtree_walk_grow((void**)&frames, &numframes, depth + 1, depth, sizeof(_symtree_walk_frame_t), stackframes)) {
+			success = false;
+			break;
+		}
+		frames[depth] = (_symtree_walk_frame_t){st, depth, 0};
+		depth++;
+	}
+	if (frames != stackframes) {
+		free(frames);
+	}
+#ifdef _SYMTREE_INTERN_VALUES
+	stats->counts.valuebytes += info->internbytes;
+#endif
+	stats->singlechild = (double)stats->fanout[1] / stats->counts.nodes;
+	return success;
+}
+
+#ifdef _SYMTREE_INSTRUMENT
+static void _symtree_metrics_add(symtree_metrics_t *metrics, const symtree_metrics_t *add) {
+	uint64_t *dst = (uint64_t*)metrics;
+	const uint64_t *src = (const uint64_t*)add;
+	// the counters are all uint64_t, so they can be added up as an array
+	for (size_t i=0; i<sizeof(symtree_metrics_t)/sizeof(uint64_t); i++) {
+		dst[i] += src[i];
+	}
+}
+
+static void symtree_metrics(symtree_metrics_t *metrics) {
+	memset(metrics, 0, sizeof(symtree_metrics_t));
+	_symtree_metrics_add(metrics, &_symtree_metrics_shared.metrics);
+	for (_symtree_metrics_block_t *block = _symtree_metrics_blocks; block != NULL; block = block->next) {
+		_symtree_metrics_add(metrics, &block->metrics);
+	}
+}
+
+static void symtree_metrics_reset(void) {
+	memset(&_symtree_metrics_shared.metrics, 0, sizeof(symtree_metrics_t));
+	for (_symtree_metrics_block_t *block = _symtree_metrics_blocks; block != NULL; block = block->next) {
+		memset(&block->metrics, 0, sizeof(symtree_metrics_t));
+	}
+}
+
+static void symtree_metrics_thread_exit(void) {
+	_symtree_metrics_block_t *block = _symtree_metrics_self;
+	_symtree_metrics_self = NULL;
+	if (block != NULL && block != &_symtree_metrics_shared) {
+		_SYMTREE_METRICS_RELEASE(&block->owned);
+	}
+}
+
+static void symtree_metrics_sample_every(unsigned every) {
+	_symtree_sample_every = every;
+}
+
+static uint64_t symtree_metrics_percentile(const symtree_metrics_t *metrics, unsigned op, double percentile) {
+	uint64_t total = 0, rank;
+	for (unsigned b=0; b<_SYMTREE_LATENCY_BUCKETS; b++) {
+		total += metrics->latency[op][b];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	// rank of the sample the percentile falls on, counting from 1
+	rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	} else if (rank > total) {
+		rank = total;
+	}
+	for (unsigned b=0; b<_SYMTREE_LATENCY_BUCKETS; b++) {
+		if (metrics->latency[op][b] >= rank) {
+			return (uint64_t)1 << (b + 1);
+		}
+		rank -= metrics->latency[op][b];
+	}
+	return (uint64_t)1 << _SYMTREE_LATENCY_BUCKETS;
+}
+
+static bool symtree_add_trace_hook(symtree_trace_hook_t hook, void *context) {
+	if (_symtree_num_trace_hooks >= _SYMTREE_MAX_TRACE_HOOKS) {
+		return false;
+	}
+	_symtree_trace_hooks[_symtree_num_trace_hooks] = hook;
+	_symtree_trace_contexts[_symtree_num_trace_hooks] = context;
+	_symtree_num_trace_hooks++;
+	return true;
+}
+
+static bool symtree_remove_trace_hook(symtree_trace_hook_t hook, void *context) {
+	for (unsigned i=0; i<_symtree_num_trace_hooks; i++) {
+		if (_symtree_trace_hooks[i] == hook && _symtree_trace_contexts[i] == context) {
+			// keep the hooks in the order they were added
+			_symtree_num_trace_hooks--;
+			memmove(&_symtree_trace_hooks[i], &_symtree_trace_hooks[i+1], (_symtree_num_trace_hooks - i) * sizeof(symtree_trace_hook_t));
+			memmove(&_symtree_trace_contexts[i], &_symtree_trace_contexts[i+1], (_symtree_num_trace_hooks - i) * sizeof(void*));
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+// Recursive function used internally within symtree_compact.
+// @param parent Node referencing tree, or NULL if tree is a root node.
+// @param pc Key number of tree within parent.
+// @returns Number of nodes freed.
+static size_t _symtree_compact(symtree_info_t *info, symtree_t *parent, unsigned pc, symtree_t *tree) {
+	size_t freed = 0;
+	symtree_t *st, *nt;
+#ifdef _SYMTREE_BURST_CONTAINERS
+	if (tree->kind == _SYMTREE_NODE_BURST) {
+		_symtree_bucket_compact(info, parent, pc, tree);
+		return 0;
+	}
+#endif
+	for (int c = _symtree_next_child(tree, 0, &st); c >= 0; c = _symtree_next_child(tree, c+1, &st)) {
+#ifdef _SYMTREE_COPY_ON_WRITE
+		// shared subtrees are left for whichever tree drops them last
+		if (st->refs > 1) {
+			continue;
+		}
+#endif
+		freed += _symtree_compact(info, tree, c, st);
+		// st may have been replaced while compacting its subtrees
+		st = _symtree_child(tree, c);
+		if (st->leaf == NULL && _symtree_is_empty(st) && (nt = _symtree_remove_child(info, parent, pc, tree, c)) != NULL) {
+			tree = nt;
+			_symtree_retire_node(info, st);
+			freed++;
+		}
+	}
+#ifdef _SYMTREE_PATH_COMPRESSION
+	if (parent != NULL && tree->leaf == NULL && !_symtree_is_empty(tree)) {
+		_symtree_merge_child(info, parent, pc, tree);
+	}
+#endif
+	return freed;
+}
+
+static size_t symtree_compact(symtree_t *tree) {
+	return _symtree_compact(_SYMTREE_INFO(tree), NULL, 0, tree);
+}
+
+static VALUE_TYPE new_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
+	_SYMTREE_OP_BEGIN(SYMTREE_OP_NEW);
+	value = _new_sym(tree, name, namelen, value);
+	_SYMTREE_OP_END(SYMTREE_OP_NEW, tree, name, namelen, value != NULL);
+	return value;
+}
+
+static VALUE_TYPE _new_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
+	symtree_info_t *info = _SYMTREE_INFO(tree);
+#ifdef _SYMTREE_WEIGHTS
+	symtree_t *root = tree;
+#endif
+	symtree_t *parent = NULL, *st;
+	unsigned c, pc = 0;
+	size_t i = 0, m = 0;
+#ifdef _SYMTREE_BURST_CONTAINERS
+	uint8_t suffix[_SYMTREE_BURST_MAX_SUFFIX];
+#endif
+	if (namelen == 0) {
+		namelen = strlen(name);
+	}
+#ifdef _SYMTREE_PATH_COMPRESSION
+	// validate the whole key first so that a bad key never leaves a split label behind
+	if (!_symtree_valid_key(name, namelen)) {
+		_SYMTREE_COUNT(invalidchars, 1);
+		return NULL;
+	}
+#endif
+	while (i < namelen) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		i++;
+		if (_SYMTREE_INVALID_CHAR(c)) {
+			_SYMTREE_COUNT(invalidchars, 1);
+			return NULL;
+		}
+		if ((st = _symtree_child(tree, c)) == NULL) {
+			_SYMTREE_ALLOC_NEAR(info, tree);
+#ifdef _SYMTREE_BURST_CONTAINERS
+			// the rest of the key goes into a new container, unless it is too long for one
+			if (namelen - i <= _SYMTREE_BURST_MAX_SUFFIX) {
+				if (!_symtree_parse_key(suffix, &name[i], namelen - i)) {
+					_SYMTREE_COUNT(invalidchars, 1);
+					return NULL;
+				}
+				return _symtree_bucket_new(info, parent, pc, tree, c, suffix, namelen - i, value);
+			}
+#endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+			// the rest of the key goes into the new subtree's label
+			if ((m = namelen - i) > _SYMTREE_MAX_LABEL_LEN) {
+				m = _SYMTREE_MAX_LABEL_LEN;
+			}
+#endif
+			if ((st = _alloc_symtree_node(info, _SYMTREE_NEW_NODE_KIND, m)) == NULL) {
+				return NULL;
+			}
+#ifdef _SYMTREE_PATH_COMPRESSION
+			_symtree_set_label(st, &name[i]);
+#endif
+			if ((tree = _symtree_add_child(info, parent, pc, tree, c, st)) == NULL) {
+				_symtree_free_node(info, st);
+				return NULL;
+			}
+#ifdef _SYMTREE_BURST_CONTAINERS
+		} else if (st->kind == _SYMTREE_NODE_BURST && i < namelen) {
+			if (namelen - i <= _SYMTREE_BURST_MAX_SUFFIX) {
+				if (!_symtree_parse_key(suffix, &name[i], namelen - i)) {
+					_SYMTREE_COUNT(invalidchars, 1);
+					return NULL;
+				}
+				if (_symtree_bucket_put(info, tree, c, st, suffix, namelen - i, &value)) {
+					return value;
+				}
+			}
+			// the container is full, or the key is too long for it
+			if ((st = _symtree_burst(info, tree, c, st)) == NULL) {
+				return NULL;
+			}
+#endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+		} else if ((m = _symtree_match_label(st, &name[i], namelen - i)) < st->labellen) {
+			// key diverges from (or ends within) the label
+			if ((st = _symtree_split_label(info, tree, c, st, m)) == NULL) {
+				return NULL;
+			}
+#endif
+#ifdef _SYMTREE_COPY_ON_WRITE
+		} else if ((st = _symtree_unshare(info, tree, c, st)) == NULL) {
+			return NULL;
+#endif
+		}
+		i += m;
+		parent = tree;
+		pc = c;
+		tree = st;
+		_SYMTREE_COUNT(nodesvisited, 1);
+	}
+	_SYMTREE_RELEASE_FENCE();
+#ifdef _SYMTREE_WEIGHTS
+	// a key without a value no longer counts towards the largest weights
+	if (value == NULL && _SYMTREE_LEAF_WEIGHT(tree) != 0) {
+		_symtree_set_leaf(info, &tree->leaf, NULL);
+		_symtree_reweigh(root, name, namelen, true, 0);
+		return NULL;
+	}
+#endif
+	return _symtree_set_leaf(info, &tree->leaf, value);
+}
+
+#ifdef _SYMTREE_ATOMIC_INSERT
+static VALUE_TYPE new_sym_atomic(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
+	_SYMTREE_OP_BEGIN(SYMTREE_OP_NEW);
+	value = _new_sym_atomic(tree, name, namelen, value);
+	_SYMTREE_OP_END(SYMTREE_OP_NEW, tree, name, namelen, value != NULL);
+	return value;
+}
+
+static VALUE_TYPE _new_sym_atomic(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
+	symtree_info_t *info = _SYMTREE_INFO(tree);
+	symtree_t *st;
+	VALUE_TYPE old;
+	unsigned c;
+	if (namelen == 0) {
+		namelen = strlen(name);
+	}
+	for (size_t i=0; i<namelen; i++) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		if (_SYMTREE_INVALID_CHAR(c)) {
+			_SYMTREE_COUNT(invalidchars, 1);
 			return NULL;
 		}
-		memcpy(str, data, i-1);
-		str[i-1] = 0;
+		while ((st = _symtree_child(tree, c)) == NULL) {
+			// the tree's counts are shared with the other inserting threads, so the node is counted once it is linked
+#ifdef _SYMTREE_USE_ARENA
+			st = (symtree_t*)_symtree_arena_alloc_atomic(info, sizeof(symtree_t));
+#else
+			if ((st = (symtree_t*)_malloc(sizeof(symtree_t))) != NULL) {
+				memset(st, 0, sizeof(symtree_t));
+			}
+#endif
+			if (st == NULL) {
+				_SYMTREE_COUNT(allocfailures, 1);
+				return NULL;
+			}
+			// the swap is a full barrier, so the zeroed node is visible before it is reachable
+			if (_SYMTREE_CAS_REF(&tree->symbols[c], _SYM_NULL, _SYMTREE_ENCODE_REF(tree, st))) {
+				_SYMTREE_COUNT(nodesallocated, 1);
+				_SYMTREE_FETCH_ADD(&info->counts.nodes, 1);
+				_SYMTREE_FETCH_ADD(&info->counts.nodebytes, sizeof(symtree_t));
+				break;
+			}
+			// another thread linked a subtree first, so carry on down the winner's instead
+			// (an arena block is simply left unused until the arena is released)
+#ifndef _SYMTREE_USE_ARENA
+			_free(st);
+#endif
+		}
+		tree = st;
+		_SYMTREE_COUNT(nodesvisited, 1);
+	}
+	if ((old = _SYMTREE_SWAP(&tree->leaf, value)) != NULL) {
+		_SYMTREE_FETCH_ADD(&info->counts.keys, (size_t)0 - 1);
+		_SYMTREE_FETCH_ADD(&info->counts.valuebytes, (size_t)0 - _symtree_value_size(info, old));
+	}
+	if (value != NULL) {
+		_SYMTREE_FETCH_ADD(&info->counts.keys, 1);
+		_SYMTREE_FETCH_ADD(&info->counts.valuebytes, _symtree_value_size(info, value));
+	}
+	return value;
+}
+#endif
+
+static VALUE_TYPE find_sym(symtree_t *tree, const char *name, size_t namelen) {
+	VALUE_TYPE *sym = find_sym_addr(tree, name, namelen);
+	if (sym == NULL) {
+		return NULL;
+	}
+	return _SYMTREE_LOAD_LEAF(sym);
+}
+
+static bool del_sym(symtree_t *tree, const char *name, size_t namelen, bool free_value) {
+	_SYMTREE_OP_BEGIN(SYMTREE_OP_DEL);
+	bool deleted = _del_sym(tree, name, namelen, free_value);
+	_SYMTREE_OP_END(SYMTREE_OP_DEL, tree, name, namelen, deleted);
+	return deleted;
+}
+
+static bool _del_sym(symtree_t *tree, const char *name, size_t namelen, bool free_value) {
+	symtree_info_t *info = _SYMTREE_INFO(tree);
+#ifdef _SYMTREE_WEIGHTS
+	symtree_t *root = tree;
+#endif
+	symtree_t *parent = NULL, *keep = NULL, *keepparent = NULL, *st;
+	VALUE_TYPE value;
+	unsigned c, pc = 0, keepc = 0, keeppc = 0;
+	size_t i;
+	if (namelen == 0) {
+		namelen = strlen(name);
+	}
+	if (namelen == 0) {
+		return false;
+	}
+#ifdef _SYMTREE_COPY_ON_WRITE
+	// don't copy any shared nodes unless the key is actually there
+	if (_find_sym_addr(tree, name, namelen) == NULL) {
+		return false;
+	}
+#endif
+	for (i=0; i<namelen; ) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		i++;
+		if (_SYMTREE_INVALID_CHAR(c)) {
+			_SYMTREE_COUNT(invalidchars, 1);
+			return false;
+		}
+		if ((st = _symtree_child(tree, c)) == NULL) {
+			_SYMTREE_COUNT(earlymisses, 1);
+			return false;
+		}
+		_SYMTREE_COUNT(nodesvisited, 1);
+#ifdef _SYMTREE_COPY_ON_WRITE
+		if ((st = _symtree_unshare(info, tree, c, st)) == NULL) {
+			return false;
+		}
+#endif
+		// remember the deepest node that is still needed without this key
+		if (parent == NULL || tree->leaf != NULL || _symtree_has_other_child(tree, c)) {
+			keepparent = parent;
+			keeppc = pc;
+			keep = tree;
+			keepc = c;
+		}
+		parent = tree;
+		pc = c;
+		tree = st;
+#ifdef _SYMTREE_PATH_COMPRESSION
+		if (tree->labellen > 0) {
+			if (_symtree_match_label(tree, &name[i], namelen - i) < tree->labellen) {
+				_SYMTREE_COUNT(earlymisses, 1);
+				return false;
+			}
+			i += tree->labellen;
+		}
+#endif
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (tree->kind == _SYMTREE_NODE_BURST) {
+			break;
+		}
+#endif
+	}
+	// values of cloned trees may still be used by other trees
+	if (info->cloned) {
+		free_value = false;
+	}
+#ifdef _SYMTREE_BURST_CONTAINERS
+	if (i < namelen) {
+		// the rest of the key is in the container the walk stopped at
+		if (!_symtree_bucket_remove(info, tree, &name[i], namelen - i, &value)) {
+			return false;
+		}
+	} else {
+		value = tree->leaf;
+		_symtree_set_leaf(info, &tree->leaf, NULL);
+	}
+#else
+	value = tree->leaf;
+	_symtree_set_leaf(info, &tree->leaf, NULL);
+#endif
+	if (free_value && value != NULL) {
+		_symtree_free_value(info, value);
+	}
+#ifdef _SYMTREE_WEIGHTS
+	tree->weight = 0;
+#endif
+	if (tree->leaf == NULL && _symtree_is_empty(tree)) {
+		// unlink the branch below the last needed node and release it
+		st = _symtree_child(keep, keepc);
+		// if that fails, the branch stays linked without any values, for symtree_compact to prune later
+		if ((keep = _symtree_remove_child(info, keepparent, keeppc, keep, keepc)) != NULL) {
+			_symtree_free_chain(info, st);
+#ifdef _SYMTREE_PATH_COMPRESSION
+			if (keepparent != NULL) {
+				_symtree_merge_child(info, keepparent, keeppc, keep);
+			}
+#endif
+		}
+#ifdef _SYMTREE_PATH_COMPRESSION
+	} else {
+		_symtree_merge_child(info, parent, pc, tree);
+#endif
+	}
+#ifdef _SYMTREE_WEIGHTS
+	_symtree_reweigh(root, name, namelen, false, 0);
+#endif
+	return true;
+}
+
+static VALUE_TYPE set_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
+	_SYMTREE_OP_BEGIN(SYMTREE_OP_SET);
+	value = _set_sym(tree, name, namelen, value);
+	_SYMTREE_OP_END(SYMTREE_OP_SET, tree, name, namelen, value != NULL);
+	return value;
+}
+
+static VALUE_TYPE _set_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
+	VALUE_TYPE *sym = _find_sym_addr(tree, name, namelen);
+	if (sym == NULL) {
+		return NULL;
+	}
+#ifdef _SYMTREE_COPY_ON_WRITE
+	// the key's nodes may be shared with other trees, which new_sym copies before setting the value
+	return _new_sym(tree, name, namelen, value);
+#else
+	_SYMTREE_RELEASE_FENCE();
+#ifdef _SYMTREE_WEIGHTS
+	if (value == NULL && *sym != NULL) {
+		_symtree_set_leaf(_SYMTREE_INFO(tree), sym, NULL);
+		_symtree_reweigh(tree, name, namelen, true, 0);
+		return NULL;
+	}
+#endif
+	return _symtree_set_leaf(_SYMTREE_INFO(tree), sym, value);
+#endif
+}
+
+#ifdef _SYMTREE_WEIGHTS
+static bool _symtree_reweigh(symtree_t *tree, const char *name, size_t namelen, bool set, uint32_t weight) {
+	symtree_t *stackpath[64];
+	symtree_t **path = stackpath, *st;
+	size_t numpath = 64, depth = 0, i = 0;
+	uint32_t old, prev, max;
+	bool found = true;
+	unsigned c;
+	if (namelen == 0) {
+		namelen = strlen(name);
+	}
+	// collect the nodes that still exist along the key
+	path[depth++] = tree;
+	while (i < namelen) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		i++;
+		if (_SYMTREE_INVALID_CHAR(c) || (st = _symtree_child(tree, c)) == NULL) {
+			found = false;
+			break;
+		}
+#ifdef _SYMTREE_PATH_COMPRESSION
+		if (st->labellen > 0) {
+			if (_symtree_match_label(st, &name[i], namelen - i) < st->labellen) {
+				found = false;
+				break;
+			}
+			i += st->labellen;
+		}
+#endif
+		if (depth == numpath && !_symtree_walk_grow((void**)&path, &numpath, depth + 1, depth, sizeof(symtree_t*), stackpath)) {
+			found = false;
+			break;
+		}
+		path[depth++] = tree = st;
+	}
+	if (set) {
+		if (!found) {
+			goto done;
+		}
+		tree->weight = weight;
+	}
+	// the deepest node is counted from scratch, and each node above it only when its largest weight came from the changed subtree
+	old = tree->maxweight;
+	max = _SYMTREE_LEAF_WEIGHT(tree);
+	_SYMTREE_FOREACH_CHILD(tree, k, st) {
+		if (st->maxweight > max) {
+			max = st->maxweight;
+		}
+	}
+	tree->maxweight = max;
+	while (--depth > 0 && path[depth]->maxweight != old) {
+		st = path[depth];
+		tree = path[depth-1];
+		prev = tree->maxweight;
+		if (st->maxweight >= prev) {
+			tree->maxweight = st->maxweight;
+		} else if (old < prev) {
+			// the largest weight is in another subtree
+			break;
+		} else {
+			max = _SYMTREE_LEAF_WEIGHT(tree);
+			_SYMTREE_FOREACH_CHILD(tree, k, st) {
+				if (st->maxweight > max) {
+					max = st->maxweight;
+				}
+			}
+			tree->maxweight = max;
+		}
+		old = prev;
+	}
+done:
+	if (path != stackpath) {
+		free(path);
+	}
+	return found;
+}
+
+static VALUE_TYPE new_sym_weighted(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value, uint32_t weight) {
+	if (new_sym(tree, name, namelen, value) == NULL) {
+		return NULL;
+	}
+	_symtree_reweigh(tree, name, namelen, true, weight);
+	return value;
+}
+
+// Node or value waiting to be visited by symtree_complete_topk.
+typedef struct {
+	symtree_t *tree;
+	// entry of the node's parent, or SIZE_MAX for the node the prefix leads to
+	size_t parent;
+	uint32_t weight;
+	uint8_t c;
+	// set for the node's own value, as opposed to its subtree
+	bool leaf;
+} _symtree_topk_entry_t;
+
+// State of symtree_complete_topk.
+typedef struct {
+	// every entry ever queued, so that keys can be rebuilt by following parents
+	_symtree_topk_entry_t *entries;
+	size_t numentries;
+	// max-heap of entry numbers
+	size_t *heap;
+	size_t heapsize;
+	size_t maxentries;
+	// entry numbers of the values found, heaviest first
+	size_t *found;
+	size_t numfound;
+	size_t maxfound;
+} _symtree_topk_t;
+
+// Returns true if entry a is to be visited before entry b.
+static inline bool _symtree_topk_before(const _symtree_topk_entry_t *a, const _symtree_topk_entry_t *b) {
+	// values go before subtrees of the same weight, which can't hold anything heavier
+	return a->weight > b->weight || (a->weight == b->weight && a->leaf && !b->leaf);
+}
+
+// Queue a node or value.
+// @returns False if failed to allocate memory.
+static bool _symtree_topk_push(_symtree_topk_t *q, symtree_t *tree, size_t parent, unsigned c, uint32_t weight, bool leaf) {
+	_symtree_topk_entry_t *entries;
+	size_t *heap, max, i, j;
+	if (q->numentries >= q->maxentries) {
+		max = q->maxentries < 64 ? 64 : q->maxentries * 2;
+		if ((entries = (_symtree_topk_entry_t*)realloc(q->entries, max * sizeof(_symtree_topk_entry_t))) == NULL) {
+			return false;
+		}
+		q->entries = entries;
+		if ((heap = (size_t*)realloc(q->heap, max * sizeof(size_t))) == NULL) {
+			return false;
+		}
+		q->heap = heap;
+		q->maxentries = max;
+	}
+	q->entries[q->numentries] = (_symtree_topk_entry_t){tree, parent, weight, (uint8_t)c, leaf};
+	for (i = q->heapsize++; i > 0; i = j) {
+		j = (i - 1) / 2;
+		if (!_symtree_topk_before(&q->entries[q->numentries], &q->entries[q->heap[j]])) {
+			break;
+		}
+		q->heap[i] = q->heap[j];
+	}
+	q->heap[i] = q->numentries++;
+	return true;
+}
+
+// Take the heaviest entry off the queue.
+// @returns Entry number.
+static size_t _symtree_topk_pop(_symtree_topk_t *q) {
+	size_t top = q->heap[0], last = q->heap[--q->heapsize], i = 0, j;
+	while ((j = 2 * i + 1) < q->heapsize) {
+		if (j + 1 < q->heapsize && _symtree_topk_before(&q->entries[q->heap[j+1]], &q->entries[q->heap[j]])) {
+			j++;
+		}
+		if (!_symtree_topk_before(&q->entries[q->heap[j]], &q->entries[last])) {
+			break;
+		}
+		q->heap[i] = q->heap[j];
+		i = j;
 	}
-	return str;
+	q->heap[i] = last;
+	return top;
 }
 
-static symtree_t *append_symtree(symtree_t *tree, const char *data, size_t datalen) {
-	char c;
-	size_t i = 0;
-	char *key = NULL;
-	if (i+1 >= datalen) {
-		return NULL;
+// Returns the length of the key of an entry, given the length of the key of the node the prefix leads to.
+static size_t _symtree_topk_keylen(_symtree_topk_t *q, size_t e, size_t startlen) {
+	for (; q->entries[e].parent != SIZE_MAX; e = q->entries[e].parent) {
+		startlen += 1 + _SYMTREE_LABEL_LEN(q->entries[e].tree);
 	}
-	if (data[i++] != '{') {
+	return startlen;
+}
+
+static symtree_completion_t *symtree_complete_topk(symtree_t *tree, const char *prefix, size_t prefixlen, size_t k, size_t *count) {
+	_symtree_topk_t q;
+	_symtree_topk_entry_t entry;
+	symtree_completion_t *results = NULL;
+	symtree_iter_t it;
+	symtree_t *st;
+	size_t e, size, len, pos, n, *found;
+	char *keys, *key;
+	bool success = true;
+	*count = 0;
+	memset(&q, 0, sizeof(q));
+	// the iterator finds the node the prefix leads to, along with its key
+	if (!symtree_iter_init(&it, tree, prefix, prefixlen)) {
 		return NULL;
 	}
-	while (i < datalen) {
-		c = data[i++];
-		if (c == ' ' || c == '\t' || c == '\n' || c == ':' || c == ',') {
-			continue;
-		} else if (c == '"') {
-			size_t read;
-			if (key == NULL) {
-				key = _read_until(&data[i], datalen-i, '"', &read);	
-				if (key == NULL) {
-					return NULL;
+	if (it.start != NULL && k > 0) {
+		success = _symtree_topk_push(&q, it.start, SIZE_MAX, 0, it.start->maxweight, false);
+	}
+	while (success && q.heapsize > 0 && q.numfound < k) {
+		e = _symtree_topk_pop(&q);
+		entry = q.entries[e];
+		if (entry.leaf) {
+			if (q.numfound >= q.maxfound) {
+				n = q.maxfound < 16 ? 16 : q.maxfound * 2;
+				if (n > k) {
+					n = k;
 				}
-				// printf("Got key %s\n", key);
-			} else {
-				char *value = _read_until(&data[i], datalen-i, '"', &read);
-				if (value == NULL) {
-					return NULL;
+				if ((found = (size_t*)realloc(q.found, n * sizeof(size_t))) == NULL) {
+					success = false;
+					break;
 				}
-				if (strcmp(key, symtree_root_node_key)) {
-					// if not the root node, add to the tree normally
-					new_sym(tree, key, 0, value);
-				} else {
-					// if the root node, add manually to the tree
-					tree->leaf = value;
+				q.found = found;
+				q.maxfound = n;
+			}
+			q.found[q.numfound++] = e;
+			continue;
+		}
+		// a node's value is queued under the node's own entry, so that both share a key
+		if (entry.tree->leaf != NULL) {
+			success = _symtree_topk_push(&q, entry.tree, entry.parent, entry.c, entry.tree->weight, true);
+		}
+		_SYMTREE_FOREACH_CHILD(entry.tree, c, st) {
+			if (!success) {
+				break;
+			}
+			success = _symtree_topk_push(&q, st, e, c, st->maxweight, false);
+		}
+	}
+	if (success) {
+		// the completions are followed by their keys in the same block
+		size = q.numfound * sizeof(symtree_completion_t);
+		for (n=0; n<q.numfound; n++) {
+			size += _symtree_topk_keylen(&q, q.found[n], it.startlen) + 1;
+		}
+		if ((results = (symtree_completion_t*)malloc(size > 0 ? size : sizeof(symtree_completion_t))) != NULL) {
+			keys = (char*)&results[q.numfound];
+			for (n=0; n<q.numfound; n++) {
+				e = q.found[n];
+				len = _symtree_topk_keylen(&q, e, it.startlen);
+				key = keys;
+				memcpy(key, _SYMTREE_ITER_KEY(&it), it.startlen);
+				key[len] = 0;
+				// the key is rebuilt from the value's node upwards
+				for (pos = len; q.entries[e].parent != SIZE_MAX; e = q.entries[e].parent) {
+#ifdef _SYMTREE_PATH_COMPRESSION
+					pos -= q.entries[e].tree->labellen;
+					memcpy(&key[pos], _SYMTREE_LABEL(q.entries[e].tree), q.entries[e].tree->labellen);
+#endif
+					key[--pos] = _UNPARSE_SYM_NAME_CHAR(q.entries[e].c);
 				}
-				free(key);
-				key = NULL;
+				e = q.found[n];
+				results[n] = (symtree_completion_t){key, len, q.entries[e].tree->leaf, q.entries[e].weight};
+				keys += len + 1;
 			}
-			i += read;
-		} else if (c == '}') {
-			break;
-		} else {
-			return NULL;
+			*count = q.numfound;
 		}
 	}
-	return tree;
+	symtree_iter_free(&it);
+	free(q.entries);
+	free(q.heap);
+	free(q.found);
+	return results;
 }
+#endif
 
-static symtree_t *alloc_symtree(void) {
-	symtree_t *tree = _malloc(sizeof(symtree_t));
-	if (tree == NULL) {
+static VALUE_TYPE *find_sym_addr(symtree_t *tree, const char *name, size_t namelen) {
+	_SYMTREE_OP_BEGIN(SYMTREE_OP_FIND);
+	VALUE_TYPE *sym = _find_sym_addr(tree, name, namelen);
+	_SYMTREE_OP_END(SYMTREE_OP_FIND, tree, name, namelen, sym != NULL && *sym != NULL);
+	return sym;
+}
+
+static VALUE_TYPE *_find_sym_addr(symtree_t *tree, const char *name, size_t namelen) {
+	unsigned c;
+	size_t i, visited = 0;
+	if (namelen == 0) {
+		namelen = strlen(name);
+	}
+	if (namelen == 0) {
 		return NULL;
 	}
-	memset(tree, 0, sizeof(symtree_t));
-	return tree;
+	for (i=0; i<namelen; ) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		i++;
+		if (_SYMTREE_INVALID_CHAR(c)) {
+			_SYMTREE_COUNT(invalidchars, 1);
+			_SYMTREE_COUNT(nodesvisited, visited);
+			return NULL;
+		}
+		if ((tree = _symtree_child(tree, c)) == NULL) {
+			_SYMTREE_COUNT(earlymisses, 1);
+			_SYMTREE_COUNT(nodesvisited, visited);
+			return NULL;
+		}
+		visited++;
+#ifdef _SYMTREE_BURST_CONTAINERS
+		if (tree->kind == _SYMTREE_NODE_BURST) {
+			_SYMTREE_COUNT(nodesvisited, visited);
+			return _symtree_bucket_find(tree, &name[i], namelen - i);
+		}
+#endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+		if (tree->labellen > 0) {
+			if (_symtree_match_label(tree, &name[i], namelen - i) < tree->labellen) {
+				_SYMTREE_COUNT(earlymisses, 1);
+				_SYMTREE_COUNT(nodesvisited, visited);
+				return NULL;
+			}
+			i += tree->labellen;
+		}
+#endif
+	}
+	_SYMTREE_COUNT(nodesvisited, visited);
+	return &tree->leaf;
 }
 
-static void free_symtree(symtree_t *tree) {
-	for (uint8_t c=0; c<_SYMTREE_NUM_CHARS; c++) {
-		if (tree->symbols[c] != _SYM_NULL) {
-			free_symtree(_READ_SYMBOL_TREE(tree, c));
+// Lookup in flight within find_sym_batch.
+typedef struct {
+	symtree_t *tree;
+	const char *name;
+	size_t namelen;
+	size_t i;
+	size_t index;
+} _symtree_lookup_t;
+
+// Prefetch the parts of a node that the next step of a lookup will read.
+static inline void _symtree_lookup_prefetch(symtree_t *tree, const char *name, size_t i, size_t namelen) {
+	_SYMTREE_PREFETCH(tree);
+#if defined(_SYMTREE_ADAPTIVE_NODES)
+	// small nodes keep their slots, key table and label within the first couple of lines
+	_SYMTREE_PREFETCH((uint8_t*)tree + 64);
+#elif defined(_SYMTREE_PATH_COMPRESSION)
+	_SYMTREE_PREFETCH(_SYMTREE_LABEL(tree));
+#else
+	unsigned c;
+	if (i < namelen) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
+		if (!_SYMTREE_INVALID_CHAR(c)) {
+			_SYMTREE_PREFETCH(&tree->symbols[c]);
 		}
 	}
-	_free(tree);
+#endif
 }
 
-static symtree_t *clone_symtree(symtree_t *tree) {
-	return NULL;
+// Start the next lookup of find_sym_batch, finishing empty keys right away.
+// @returns False if there are no keys left.
+static inline bool _symtree_lookup_start(_symtree_lookup_t *l, symtree_t *tree, const char *const *names, const size_t *namelens, VALUE_TYPE *values, size_t *next, size_t count) {
+	size_t k;
+	while ((k = *next) < count) {
+		*next = k + 1;
+		l->name = names[k];
+		l->namelen = namelens == NULL ? 0 : namelens[k];
+		if (l->namelen == 0) {
+			l->namelen = strlen(l->name);
+		}
+		if (l->namelen == 0) {
+			values[k] = NULL;
+			continue;
+		}
+		l->tree = tree;
+		l->i = 0;
+		l->index = k;
+		return true;
+	}
+	return false;
 }
 
-static bool debug_dump_symtree(symtree_t *tree, char *buffer, size_t bufferlen, size_t *len) {
-	size_t curlen = 0;
-	size_t i = 0;
-	if (curlen + 1 >= bufferlen) {
-		*len = bufferlen;
-		return false;
+// Advance a lookup of find_sym_batch by one subtree.
+// @returns True if the lookup is finished, with its result stored in values.
+static inline bool _symtree_lookup_step(_symtree_lookup_t *l, VALUE_TYPE *values) {
+	symtree_t *tree = l->tree;
+	unsigned c;
+#ifdef _SYMTREE_BURST_CONTAINERS
+	VALUE_TYPE *value;
+	if (tree->kind == _SYMTREE_NODE_BURST) {
+		value = _symtree_bucket_find(tree, &l->name[l->i], l->namelen - l->i);
+		values[l->index] = value != NULL ? *value : NULL;
+		return true;
 	}
-	buffer[curlen++] = '[';
-	for (i=0; i<_SYMTREE_NUM_CHARS; i++) {
-		if (tree->symbols[i] != _SYM_NULL) {
-			size_t newlen;
-			if (curlen + 2 >= bufferlen) {
-				*len = bufferlen;
-				return false;
-			}
-			buffer[curlen++] = _UNPARSE_SYM_NAME_CHAR(i);
-			buffer[curlen++] = '{';
-			if (curlen + 1 >= bufferlen) {
-				*len = bufferlen;
-				return false;
+#endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+	if (tree->labellen > 0) {
+		if (_symtree_match_label(tree, &l->name[l->i], l->namelen - l->i) < tree->labellen) {
+			values[l->index] = NULL;
+			return true;
+		}
+		l->i += tree->labellen;
+	}
+#endif
+	if (l->i >= l->namelen) {
+		values[l->index] = _SYMTREE_LOAD_LEAF(&tree->leaf);
+		return true;
+	}
+	c = _PARSE_SYM_NAME_CHAR((uint8_t)l->name[l->i]);
+	l->i++;
+	if (_SYMTREE_INVALID_CHAR(c) || (tree = _symtree_child(tree, c)) == NULL) {
+		values[l->index] = NULL;
+		return true;
+	}
+	_symtree_lookup_prefetch(tree, l->name, l->i, l->namelen);
+	l->tree = tree;
+	return false;
+}
+
+static size_t find_sym_batch(symtree_t *tree, const char *const *names, const size_t *namelens, VALUE_TYPE *values, size_t count) {
+	_symtree_lookup_t lookups[_SYMTREE_BATCH_WIDTH];
+	size_t next = 0, found = 0, visited = 0;
+	unsigned active = 0, j;
+	_SYMTREE_OP_BEGIN(SYMTREE_OP_BATCH);
+	while (active < _SYMTREE_BATCH_WIDTH && _symtree_lookup_start(&lookups[active], tree, names, namelens, values, &next, count)) {
+		active++;
+	}
+	// advance every lookup by one subtree per round, so each one's prefetch has a round to land
+	while (active > 0) {
+		for (j=0; j<active; ) {
+			if (!_symtree_lookup_step(&lookups[j], values)) {
+				visited++;
+				j++;
+				continue;
 			}
-			buffer[curlen++] = '\n';
-			if (!debug_dump_symtree(_READ_SYMBOL_TREE(tree, i), &buffer[curlen], bufferlen-curlen, &newlen)) {
-				return false;
+			if (values[lookups[j].index] != NULL) {
+				found++;
 			}
-			curlen += newlen;
-			if (curlen + 3 >= bufferlen) {
-				*len = bufferlen;
-				return false;
+			if (_symtree_lookup_start(&lookups[j], tree, names, namelens, values, &next, count)) {
+				j++;
+			} else {
+				lookups[j] = lookups[--active];
 			}
-			buffer[curlen++] = '}';
-			buffer[curlen++] = ',';
-			buffer[curlen++] = '\n';
 		}
 	}
-	if (curlen + 1 >= bufferlen) {
-		*len = bufferlen;
+	_SYMTREE_COUNT(nodesvisited, visited);
+	_SYMTREE_OP_END(SYMTREE_OP_BATCH, tree, NULL, count, found > 0);
+	return found;
+}
+
+#ifdef _SYMTREE_SNAPSHOTS
+// Write bytes to a snapshot file, keeping track of the position.
+static bool _symtree_snapshot_write(FILE *fd, uint64_t *pos, const void *data, size_t len) {
+	if (len > 0 && fwrite(data, 1, len, fd) != len) {
 		return false;
 	}
-	buffer[curlen++] = ']';
-	if (tree->leaf != NULL) {
-		char c;
-		if (curlen + 3 >= bufferlen) {
-			*len = bufferlen;
+	*pos += len;
+	return true;
+}
+
+// Pad a snapshot file to the next unit boundary.
+static bool _symtree_snapshot_pad(FILE *fd, uint64_t *pos) {
+	static const uint8_t zeroes[_SYMTREE_SNAPSHOT_UNIT] = {0};
+	return _symtree_snapshot_write(fd, pos, zeroes, (_SYMTREE_SNAPSHOT_UNIT - *pos % _SYMTREE_SNAPSHOT_UNIT) % _SYMTREE_SNAPSHOT_UNIT);
+}
+
+// Write a value to a snapshot file after its size, and set the node's value offset to it.
+static bool _symtree_snapshot_write_value(FILE *fd, uint64_t *pos, VALUE_TYPE value, symtree_snapshot_node_t *node) {
+	uint64_t size = _SYMTREE_SNAPSHOT_VALUE_SIZE(value);
+	node->value = *pos / _SYMTREE_SNAPSHOT_UNIT;
+	return _symtree_snapshot_write(fd, pos, &size, sizeof(size)) && _symtree_snapshot_write(fd, pos, (const void*)value, size) && _symtree_snapshot_pad(fd, pos);
+}
+
+// Returns the only subtree of a node, or NULL if it has none or more than one.
+static inline symtree_t *_symtree_only_child(symtree_t *tree, int *c) {
+	symtree_t *st, *other;
+	if ((*c = _symtree_next_child(tree, 0, &st)) < 0 || _symtree_next_child(tree, *c+1, &other) >= 0) {
+		return NULL;
+	}
+	return st;
+}
+
+#ifdef _SYMTREE_BURST_CONTAINERS
+// Recursive function used internally within save_symtree_snapshot to write the entries of a container as snapshot nodes.
+// Entries are grouped by their key number at depth, and runs of key numbers shared by a whole group without a value become labels.
+// @param entries Entries with values, in key order, all of them longer than depth.
+// @param n Number of entries.
+// @param leaf Value of the key ending at depth.
+// @param offset Pointer to the unit offset of the written node.
+static bool _save_symtree_snapshot_entries(FILE *fd, uint64_t *pos, const uint8_t **entries, size_t n, size_t depth, VALUE_TYPE leaf, uint32_t *offset) {
+	uint32_t children[_SYMTREE_BURST_THRESHOLD];
+	uint8_t keys[_SYMTREE_BURST_THRESHOLD];
+	symtree_snapshot_node_t node = {0};
+	const uint8_t *label = n > 0 ? _SYMTREE_ENTRY_KEY(entries[0]) + depth : NULL;
+	size_t labellen = 0, lo, hi, first;
+	VALUE_TYPE value;
+	uint8_t ch;
+	while (leaf == NULL && n > 0 && _SYMTREE_ENTRY_KEY(entries[0])[depth] == _SYMTREE_ENTRY_KEY(entries[n-1])[depth]) {
+		labellen++;
+		// the first entry may end after the run
+		if (_SYMTREE_ENTRY_LEN(entries[0]) == ++depth) {
+			leaf = *_SYMTREE_ENTRY_VALUE(entries[0]);
+			entries++;
+			n--;
+		}
+	}
+	for (lo=0; lo<n; lo=hi) {
+		ch = _SYMTREE_ENTRY_KEY(entries[lo])[depth];
+		for (hi=lo+1; hi<n && _SYMTREE_ENTRY_KEY(entries[hi])[depth] == ch; hi++);
+		value = NULL;
+		first = lo;
+		if (_SYMTREE_ENTRY_LEN(entries[lo]) == depth + 1) {
+			value = *_SYMTREE_ENTRY_VALUE(entries[lo]);
+			first++;
+		}
+		if (!_save_symtree_snapshot_entries(fd, pos, &entries[first], hi - first, depth + 1, value, &children[node.count])) {
 			return false;
 		}
-		buffer[curlen++] = '=';
-		buffer[curlen++] = '"';
-		i = 0;
-		while ((c = tree->leaf[i++]) != 0) {
-			if (c == '\n' || c == '\t' || c == '"') {
-				if (curlen + 2 >= bufferlen) {
-					*len = bufferlen;
-					return false;
-				}
-				buffer[curlen++] = '\\';
-				if (c == '\n') {
-					buffer[curlen++] = 'n';
-				} else if (c == '\t') {
-					buffer[curlen++] = 't';
-				} else {
-					buffer[curlen++] = c;
-				}
-			} else {
-				if (curlen + 1 >= bufferlen) {
-					*len = bufferlen;
-					return false;
-				}
-				buffer[curlen++] = c;
-			}
+		keys[node.count++] = ch;
+	}
+	if (leaf != NULL) {
+		if (!_symtree_snapshot_write_value(fd, pos, leaf, &node)) {
+			return false;
 		}
-		buffer[curlen++] = '"';
 	}
-	*len = curlen;
-	return true;
+	if (*pos / _SYMTREE_SNAPSHOT_UNIT > UINT32_MAX) {
+		return false;
+	}
+	*offset = *pos / _SYMTREE_SNAPSHOT_UNIT;
+	node.labellen = labellen;
+	if (!_symtree_snapshot_write(fd, pos, &node, sizeof(node)) ||
+		!_symtree_snapshot_write(fd, pos, children, node.count * sizeof(uint32_t)) ||
+		!_symtree_snapshot_write(fd, pos, keys, node.count)) {
+		return false;
+	}
+	for (size_t i=0; i<labellen; i++) {
+		ch = _UNPARSE_SYM_NAME_CHAR(label[i]);
+		if (!_symtree_snapshot_write(fd, pos, &ch, 1)) {
+			return false;
+		}
+	}
+	return _symtree_snapshot_pad(fd, pos);
 }
+#endif
 
-static size_t symtree_size(symtree_t *tree, bool include_value_strings) {
-	size_t len = sizeof(symtree_t);
-	for (uint8_t i=0; i<_SYMTREE_NUM_CHARS; i++) {
-		if (tree->symbols[i] != _SYM_NULL) {
-			len += symtree_size(_READ_SYMBOL_TREE(tree, i), include_value_strings);
+// Recursive function used internally within save_symtree_snapshot.
+// Children and values are written before the node that references them.
+// @param root Whether tree is the root node, which never has a label.
+// @param offset Pointer to the unit offset of the written node.
+static bool _save_symtree_snapshot(FILE *fd, uint64_t *pos, symtree_t *tree, bool root, uint32_t *offset) {
+	uint32_t children[_SYMTREE_NUM_CHARS];
+	uint8_t keys[_SYMTREE_NUM_CHARS];
+	symtree_snapshot_node_t node = {0};
+	symtree_t *end = tree, *st;
+	size_t labellen = 0;
+	int c;
+	uint8_t ch;
+#ifdef _SYMTREE_BURST_CONTAINERS
+	if (tree->kind == _SYMTREE_NODE_BURST) {
+		const uint8_t *entries[_SYMTREE_BURST_THRESHOLD];
+		size_t n = 0;
+		_SYMTREE_FOREACH_ENTRY(tree, e) {
+			if (*_SYMTREE_ENTRY_VALUE(e) != NULL && n < _SYMTREE_BURST_THRESHOLD) {
+				entries[n++] = e;
+			}
 		}
+		return _save_symtree_snapshot_entries(fd, pos, entries, n, 0, tree->leaf, offset);
 	}
-	if (tree->leaf != NULL) {
-		len += sizeof(VALUE_TYPE);
-		if (include_value_strings) {
-			len += strlen(tree->leaf) + 1;
+#endif
+	// fold chains of subtrees without values into the label
+	if (!root) {
+		labellen = _SYMTREE_LABEL_LEN(tree);
+		while (end->leaf == NULL && (st = _symtree_only_child(end, &c)) != NULL && !_SYMTREE_IS_CONTAINER(st) && labellen + 1 + _SYMTREE_LABEL_LEN(st) <= 65535) {
+			labellen += 1 + _SYMTREE_LABEL_LEN(st);
+			end = st;
 		}
 	}
-	return len;
-}
-
-static VALUE_TYPE new_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
-	symtree_t *st;
-	int8_t c;
-	size_t i = 0;
-	if (namelen == 0) {
-		namelen = strlen(name);
+	_SYMTREE_FOREACH_CHILD(end, k, st) {
+		if (!_save_symtree_snapshot(fd, pos, st, false, &children[node.count])) {
+			return false;
+		}
+		keys[node.count++] = k;
 	}
-	if (namelen > 1) {
-		while (i < namelen) {
-			c = _PARSE_SYM_NAME_CHAR(name[i]);
-			if (c == _PARSE_SYM_NAME_CHAR_INVALID)
-				return NULL;
-			if (tree->symbols[c] == _SYM_NULL) {
-				while (i < namelen) {
-					if ((st = alloc_symtree()) == NULL) {
-						return NULL;
-					}
-					c = _PARSE_SYM_NAME_CHAR(name[i]);
-					if (c == _PARSE_SYM_NAME_CHAR_INVALID) {
-						free_symtree(st);
-						return NULL;
-					}
-					i++;
-					_WRITE_SYMBOL_TREE(tree, c, st);
-					tree = st;
-				}
-				return (tree->leaf = value);
-			} else {
-				tree = _READ_SYMBOL_TREE(tree, c);
-				i++;
-			}
+	if (end->leaf != NULL) {
+		if (!_symtree_snapshot_write_value(fd, pos, end->leaf, &node)) {
+			return false;
 		}
-	} else if (namelen > 0) {
-		c = _PARSE_SYM_NAME_CHAR(name[0]);
-		if (c == _PARSE_SYM_NAME_CHAR_INVALID)
-			return NULL;
-	} else {
-		return (tree->leaf = value);
 	}
-	if (tree->symbols[c] == _SYM_NULL) {
-		if ((st = alloc_symtree()) == NULL) {
-			return NULL;
+	if (*pos / _SYMTREE_SNAPSHOT_UNIT > UINT32_MAX) {
+		return false;
+	}
+	*offset = *pos / _SYMTREE_SNAPSHOT_UNIT;
+	node.labellen = labellen;
+	if (!_symtree_snapshot_write(fd, pos, &node, sizeof(node)) ||
+		!_symtree_snapshot_write(fd, pos, children, node.count * sizeof(uint32_t)) ||
+		!_symtree_snapshot_write(fd, pos, keys, node.count)) {
+		return false;
+	}
+	// write the label by walking the chain again
+	for (st = tree; labellen > 0; ) {
+#ifdef _SYMTREE_PATH_COMPRESSION
+		if (!_symtree_snapshot_write(fd, pos, _SYMTREE_LABEL(st), st->labellen)) {
+			return false;
+		}
+#endif
+		if (st == end) {
+			break;
+		}
+		st = _symtree_only_child(st, &c);
+		ch = _UNPARSE_SYM_NAME_CHAR(c);
+		if (!_symtree_snapshot_write(fd, pos, &ch, 1)) {
+			return false;
 		}
-		_WRITE_SYMBOL_TREE(tree, c, st);
-	} else {
-		st = _READ_SYMBOL_TREE(tree, c);
 	}
-	return (st->leaf = value);
+	return _symtree_snapshot_pad(fd, pos);
 }
 
-static VALUE_TYPE find_sym(symtree_t *tree, const char *name, size_t namelen) {
-	VALUE_TYPE *sym = find_sym_addr(tree, name, namelen);
-	if (sym == NULL) {
+static bool save_symtree_snapshot(symtree_t *tree, FILE *fd) {
+	symtree_snapshot_header_t header = {_SYMTREE_SNAPSHOT_MAGIC, _SYMTREE_SNAPSHOT_VERSION, _SYMTREE_NUM_CHARS, 0x0102, 0, 0, 0};
+	uint64_t pos = 0;
+	uint32_t root;
+	// the header is rewritten once the root's offset is known
+	if (!_symtree_snapshot_write(fd, &pos, &header, sizeof(header)) || !_symtree_snapshot_pad(fd, &pos)) {
+		return false;
+	}
+	if (!_save_symtree_snapshot(fd, &pos, tree, true, &root)) {
+		return false;
+	}
+	header.size = pos;
+	header.root = root;
+	if (fseek(fd, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fd) != 1 || fseek(fd, 0, SEEK_END) != 0) {
+		return false;
+	}
+	return fflush(fd) == 0;
+}
+
+// Get the node at a unit offset of a snapshot, checking that the whole node lies within the image.
+// @returns Node, or NULL if the offset is out of range.
+static inline const symtree_snapshot_node_t *_symtree_snapshot_node(const symtree_snapshot_t *snap, uint32_t offset) {
+	const symtree_snapshot_node_t *node;
+	uint64_t start = (uint64_t)offset * _SYMTREE_SNAPSHOT_UNIT;
+	if (offset == 0 || start + sizeof(symtree_snapshot_node_t) > snap->size) {
+		return NULL;
+	}
+	node = (const symtree_snapshot_node_t*)(snap->data + start);
+	if (start + sizeof(symtree_snapshot_node_t) + (uint64_t)node->count * (sizeof(uint32_t) + 1) + node->labellen > snap->size) {
 		return NULL;
 	}
-	return *sym;
+	return node;
 }
 
-static bool del_sym(symtree_t *tree, const char *name, size_t namelen, bool free_value) {
-	VALUE_TYPE *sym = find_sym_addr(tree, name, namelen);
-	if (sym == NULL) {
+// Get the value of a snapshot node, checking that it lies within the image.
+// @returns Value, or NULL if the node has none or its value is out of range.
+static inline VALUE_TYPE _symtree_snapshot_value(const symtree_snapshot_t *snap, const symtree_snapshot_node_t *node) {
+	uint64_t start = (uint64_t)node->value * _SYMTREE_SNAPSHOT_UNIT, size;
+	if (node->value == 0 || start + sizeof(uint64_t) > snap->size) {
+		return NULL;
+	}
+	memcpy(&size, snap->data + start, sizeof(size));
+	start += sizeof(uint64_t);
+	if (size > snap->size - start) {
+		return NULL;
+	}
+#ifdef _SYMTREE_SNAPSHOT_STRING_VALUES
+	if (size == 0 || snap->data[start + size - 1] != 0) {
+		return NULL;
+	}
+#endif
+	return (VALUE_TYPE)(snap->data + start);
+}
+
+static bool init_symtree_snapshot(symtree_snapshot_t *snap, const void *data, size_t size) {
+	const symtree_snapshot_header_t *header = (const symtree_snapshot_header_t*)data;
+	memset(snap, 0, sizeof(symtree_snapshot_t));
+	if (size < sizeof(symtree_snapshot_header_t) || memcmp(header->magic, _SYMTREE_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+		return false;
+	}
+	if (header->version != _SYMTREE_SNAPSHOT_VERSION || header->num_chars != _SYMTREE_NUM_CHARS || header->byte_order != 0x0102) {
+		return false;
+	}
+	if (header->size > size) {
 		return false;
 	}
-	if (free_value && *sym != NULL) {
-		free(*sym);
+	snap->data = (const uint8_t*)data;
+	snap->size = header->size;
+	if ((snap->root = _symtree_snapshot_node(snap, header->root)) == NULL) {
+		memset(snap, 0, sizeof(symtree_snapshot_t));
+		return false;
 	}
-	*sym = NULL;
 	return true;
 }
 
-static VALUE_TYPE set_sym(symtree_t *tree, const char *name, size_t namelen, VALUE_TYPE value) {
-	VALUE_TYPE *sym = find_sym_addr(tree, name, namelen);
-	if (sym == NULL) {
-		return NULL;
+static bool open_symtree_snapshot(symtree_snapshot_t *snap, const char *path) {
+	void *data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER filesize;
+	if ((file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	if (!GetFileSizeEx(file, &filesize) || (mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+	size = filesize.QuadPart;
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	// the view keeps the file mapped after the handles are closed
+	CloseHandle(mapping);
+	CloseHandle(file);
+	if (data == NULL) {
+		return false;
+	}
+	if (!init_symtree_snapshot(snap, data, size)) {
+		UnmapViewOfFile(data);
+		return false;
+	}
+#else
+	struct stat st;
+	int fd;
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return false;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	size = st.st_size;
+	data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
 	}
-	return (*sym = value);
+	if (!init_symtree_snapshot(snap, data, size)) {
+		munmap(data, size);
+		return false;
+	}
+	// keep the mapped size for munmap, as the image may be shorter than the file
+	snap->size = size;
+#endif
+	snap->mapped = true;
+	return true;
 }
 
-static VALUE_TYPE *find_sym_addr(symtree_t *tree, const char *name, size_t namelen) {
-	int8_t c;
-	size_t i = 0;
+static void close_symtree_snapshot(symtree_snapshot_t *snap) {
+	if (snap->mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile((void*)snap->data);
+#else
+		munmap((void*)snap->data, snap->size);
+#endif
+	}
+	memset(snap, 0, sizeof(symtree_snapshot_t));
+}
+
+static VALUE_TYPE find_sym_snapshot(const symtree_snapshot_t *snap, const char *name, size_t namelen) {
+	const symtree_snapshot_node_t *node = snap->root;
+	const uint8_t *keys;
+	unsigned c;
+	size_t i;
 	if (namelen == 0) {
 		namelen = strlen(name);
 	}
-	while (i < namelen) {
-		c = _PARSE_SYM_NAME_CHAR(name[i]);
+	if (namelen == 0 || node == NULL) {
+		return NULL;
+	}
+	for (i=0; i<namelen; ) {
+		c = _PARSE_SYM_NAME_CHAR((uint8_t)name[i]);
 		i++;
-		if (c == _PARSE_SYM_NAME_CHAR_INVALID) {
+		if (_SYMTREE_INVALID_CHAR(c)) {
 			return NULL;
-		} else {
-			if (tree->symbols[c] == _SYM_NULL) {
+		}
+		keys = _SYMTREE_SNAPSHOT_KEYS(node);
+		if ((keys = (const uint8_t*)memchr(keys, c, node->count)) == NULL) {
+			return NULL;
+		}
+		// offsets come from the file, so each one is checked before it is followed
+		if ((node = _symtree_snapshot_node(snap, _SYMTREE_SNAPSHOT_CHILDREN(node)[keys - _SYMTREE_SNAPSHOT_KEYS(node)])) == NULL) {
+			return NULL;
+		}
+		if (node->labellen > 0) {
+			if (_symtree_match_chars(_SYMTREE_SNAPSHOT_LABEL(node), node->labellen, &name[i], namelen - i) < node->labellen) {
 				return NULL;
-			} else {
-				tree = _READ_SYMBOL_TREE(tree, c);
-				if (i >= namelen) {
-					return &tree->leaf;
-				}
 			}
+			i += node->labellen;
 		}
 	}
-	return NULL;
+	return _symtree_snapshot_value(snap, node);
 }
+#endif
 
 #ifdef __cplusplus
 }
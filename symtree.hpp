@@ -0,0 +1,594 @@
+/**
+ * symtree.hpp
+ * Author:       Adam "beckadamtheinventor" Beckingham
+ * Description:  Fast string:value dictionary structure, as a C++17 class template.
+ * License:      GPL3
+ *
+ * Unlike symtree.h, nothing here is configured with macros: each instantiation of symtree<Alphabet, Value, OffsetT>
+ * has its own alphabet, value type and subtree reference type, so any number of differently configured trees can be used
+ * within one program, and the header can be included by any number of translation units.
+ * It is a standalone implementation sharing no code, node layout or file format with symtree.h.
+ */
+
+#ifndef __SYMTREE_HPP__
+#define __SYMTREE_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace symtree_detail {
+	constexpr size_t length(const char *s) {
+		size_t n = 0;
+		while (s[n] != 0) {
+			n++;
+		}
+		return n;
+	}
+
+	// Letter of the other case, or the same character if it isn't a letter.
+	constexpr char other_case(char c) {
+		if (c >= 'A' && c <= 'Z') {
+			return c - 'A' + 'a';
+		}
+		if (c >= 'a' && c <= 'z') {
+			return c - 'a' + 'A';
+		}
+		return c;
+	}
+
+	// Reads Def::fold_case, which is optional.
+	template <typename Def, typename = void>
+	struct fold_case : std::false_type {};
+	template <typename Def>
+	struct fold_case<Def, std::void_t<decltype(Def::fold_case)>> : std::bool_constant<Def::fold_case> {};
+}
+
+// Alphabet of dictionary keys, with its character tables generated at compile time.
+// Def must have a static constexpr char array named chars, holding the allowed characters in key number order.
+// Def may also have a static constexpr bool named fold_case, to accept each letter's other case as the same key number.
+template <typename Def>
+struct symtree_alphabet {
+	// Number of allowed characters, and the width of every node.
+	static constexpr unsigned size = symtree_detail::length(Def::chars);
+	static_assert(size > 0 && size < 255, "alphabets must have from 1 to 254 characters");
+
+	static constexpr bool fold_case = symtree_detail::fold_case<Def>::value;
+
+	// Entry of parse_table for characters outside of the alphabet.
+	static constexpr uint8_t invalid = 255;
+
+	// Key number of every character.
+	static constexpr std::array<uint8_t, 256> parse_table = [] {
+		std::array<uint8_t, 256> table{};
+		for (auto &entry : table) {
+			entry = invalid;
+		}
+		for (unsigned i=0; i<size; i++) {
+			table[(uint8_t)Def::chars[i]] = i;
+		}
+		if (fold_case) {
+			for (unsigned i=0; i<size; i++) {
+				uint8_t c = symtree_detail::other_case(Def::chars[i]);
+				if (table[c] == invalid) {
+					table[c] = i;
+				}
+			}
+		}
+		return table;
+	}();
+
+	static constexpr bool unique = [] {
+		unsigned count = 0;
+		for (unsigned c=0; c<256; c++) {
+			count += parse_table[c] != invalid && (uint8_t)Def::chars[parse_table[c]] == c;
+		}
+		return count == size;
+	}();
+	static_assert(unique, "alphabets must not repeat characters");
+
+	// Whether the characters are a single run, such as a-z, so that they can be converted by subtracting the first one.
+	static constexpr bool contiguous = [] {
+		for (unsigned i=1; i<size; i++) {
+			if ((uint8_t)Def::chars[i] != (uint8_t)Def::chars[0] + i) {
+				return false;
+			}
+		}
+		return !fold_case;
+	}();
+
+	// Convert a character to its key number.
+	// @returns Key number, which is size or more if the character isn't in the alphabet.
+	static constexpr unsigned parse(char c) noexcept {
+		if constexpr (contiguous) {
+			return (unsigned)((uint8_t)c - (uint8_t)Def::chars[0]);
+		} else {
+			return parse_table[(uint8_t)c];
+		}
+	}
+
+	// Convert a key number to its character.
+	static constexpr char unparse(unsigned c) noexcept {
+		return Def::chars[c];
+	}
+};
+
+// Characters of the default alphabet of symtree.h.
+struct symtree_default_chars {
+	static constexpr char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_";
+};
+
+// Lowercase letters only.
+struct symtree_lowercase_chars {
+	static constexpr char chars[] = "abcdefghijklmnopqrstuvwxyz";
+};
+
+// Letters of either case, spaces and dashes, as used by tests/dictionarytest.c.
+struct symtree_dictionary_chars {
+	static constexpr char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ -";
+	static constexpr bool fold_case = true;
+};
+
+using symtree_default_alphabet = symtree_alphabet<symtree_default_chars>;
+using symtree_lowercase_alphabet = symtree_alphabet<symtree_lowercase_chars>;
+using symtree_dictionary_alphabet = symtree_alphabet<symtree_dictionary_chars>;
+
+// Symbol tree mapping keys of an alphabet to values.
+// If OffsetT is a pointer type, every node is allocated on its own and owns its subtrees through std::unique_ptr.
+// If OffsetT is an integer type, nodes are stored in one array and reference their subtrees by index,
+// which limits the tree to as many nodes as OffsetT has positive values, but makes each reference OffsetT sized.
+// In that case, pointers to values are invalidated by adding keys, as with std::vector.
+// Allocation failures throw std::bad_alloc.
+template <typename Alphabet = symtree_default_alphabet, typename Value = std::string, typename OffsetT = void*>
+class symtree {
+	static_assert(std::is_pointer_v<OffsetT> || (std::is_integral_v<OffsetT> && !std::is_same_v<OffsetT, bool>), "OffsetT must be a pointer type or an integer type");
+
+public:
+	using alphabet_type = Alphabet;
+	using value_type = Value;
+
+	// Whether nodes reference their subtrees by index rather than by pointer.
+	static constexpr bool by_index = std::is_integral_v<OffsetT>;
+
+	symtree() noexcept = default;
+
+	symtree(const symtree &other) : size_(other.size_) {
+		if constexpr (by_index) {
+			store_ = other.store_;
+		} else {
+			if (other.store_.root != nullptr) {
+				store_.root = clone(*other.store_.root);
+			}
+			store_.count = other.store_.count;
+		}
+	}
+
+	symtree(symtree &&other) noexcept : store_(std::move(other.store_)), size_(other.size_) {
+		other.store_ = storage();
+		other.size_ = 0;
+	}
+
+	symtree &operator=(const symtree &other) {
+		if (this != &other) {
+			symtree copy(other);
+			*this = std::move(copy);
+		}
+		return *this;
+	}
+
+	symtree &operator=(symtree &&other) noexcept {
+		if (this != &other) {
+			store_ = std::move(other.store_);
+			size_ = other.size_;
+			other.store_ = storage();
+			other.size_ = 0;
+		}
+		return *this;
+	}
+
+	// Find the value of a key.
+	// @returns Pointer to the value, or nullptr if the key has no value.
+	Value *find(std::string_view key) noexcept {
+		node *n = find_node(key);
+		return n != nullptr && n->value ? &*n->value : nullptr;
+	}
+
+	const Value *find(std::string_view key) const noexcept {
+		const node *n = const_cast<symtree*>(this)->find_node(key);
+		return n != nullptr && n->value ? &*n->value : nullptr;
+	}
+
+	bool contains(std::string_view key) const noexcept {
+		return find(key) != nullptr;
+	}
+
+	// Add a key if it doesn't exist, and set its value. (as with new_sym)
+	// @returns Pointer to the stored value, or nullptr if the key has a character outside of the alphabet or the tree has run out of node indices.
+	template <typename V>
+	Value *insert(std::string_view key, V &&value) {
+		return emplace(key, std::forward<V>(value));
+	}
+
+	// Add a key if it doesn't exist, and construct its value in place from args.
+	// @returns Pointer to the stored value, or nullptr if the key has a character outside of the alphabet or the tree has run out of node indices.
+	template <typename... Args>
+	Value *emplace(std::string_view key, Args &&...args) {
+		node *n = make_path(key);
+		if (n == nullptr) {
+			return nullptr;
+		}
+		if (!n->value) {
+			size_++;
+		}
+		n->value.emplace(std::forward<Args>(args)...);
+		return &*n->value;
+	}
+
+	// Set the value of a key that already has one. (as with set_sym)
+	// @returns Pointer to the stored value, or nullptr if the key has no value.
+	template <typename V>
+	Value *set(std::string_view key, V &&value) {
+		Value *found = find(key);
+		if (found != nullptr) {
+			*found = std::forward<V>(value);
+		}
+		return found;
+	}
+
+	// Remove a key and its value, along with the nodes that no other key needs. (as with del_sym)
+	// @returns False if the key has no value.
+	bool erase(std::string_view key) noexcept {
+		node *n = root(), *keep = n, *next;
+		unsigned c, keepc = 0;
+		if (n == nullptr) {
+			return false;
+		}
+		for (size_t i=0; i<key.size(); i++) {
+			c = Alphabet::parse(key[i]);
+			if (c >= Alphabet::size || (next = child(*n, c)) == nullptr) {
+				return false;
+			}
+			// remember the deepest node that is still needed without this key
+			if (i == 0 || n->value || has_other_child(*n, c)) {
+				keep = n;
+				keepc = c;
+			}
+			n = next;
+		}
+		if (!n->value) {
+			return false;
+		}
+		n->value.reset();
+		size_--;
+		if (key.size() > 0 && is_empty(*n)) {
+			free_branch(*keep, keepc);
+		}
+		return true;
+	}
+
+	// Call f(key, value) for every key beginning with prefix, in key number order.
+	// The key is passed as a std::string_view valid until f returns, with each character as it is in the alphabet.
+	// f may return bool to stop early by returning false. The tree must not be modified meanwhile.
+	// @returns False if stopped early.
+	template <typename F>
+	bool for_each(F &&f, std::string_view prefix = {}) {
+		return walk(*this, f, prefix);
+	}
+
+	template <typename F>
+	bool for_each(F &&f, std::string_view prefix = {}) const {
+		return walk(*this, f, prefix);
+	}
+
+	// Remove every key, and free every node.
+	void clear() noexcept {
+		store_ = storage();
+		size_ = 0;
+	}
+
+	// Number of keys with a value.
+	size_t size() const noexcept {
+		return size_;
+	}
+
+	bool empty() const noexcept {
+		return size_ == 0;
+	}
+
+	// Number of nodes, including the root node once any key has been added.
+	size_t node_count() const noexcept {
+		if constexpr (by_index) {
+			return store_.nodes.size() - store_.freed.size();
+		} else {
+			return store_.count;
+		}
+	}
+
+	// Number of nodes an integer OffsetT can reference, which bounds the size of the tree.
+	static constexpr size_t max_nodes() noexcept {
+		if constexpr (by_index) {
+			if constexpr ((uintmax_t)std::numeric_limits<OffsetT>::max() >= (uintmax_t)std::numeric_limits<size_t>::max()) {
+				return std::numeric_limits<size_t>::max();
+			} else {
+				return (size_t)std::numeric_limits<OffsetT>::max() + 1;
+			}
+		} else {
+			return std::numeric_limits<size_t>::max();
+		}
+	}
+
+private:
+	struct node;
+	// Reference to a subtree, which is empty if it is nullptr or 0. Index 0 is the root node, which is never a subtree.
+	using ref = std::conditional_t<by_index, OffsetT, std::unique_ptr<node>>;
+
+	struct node {
+		ref children[Alphabet::size] = {};
+		std::optional<Value> value;
+	};
+
+	struct pointer_storage {
+		std::unique_ptr<node> root;
+		size_t count = 0;
+	};
+
+	struct index_storage {
+		// root node first, once any key has been added
+		std::vector<node> nodes;
+		// freed nodes, with room for every node so that freeing never allocates
+		std::vector<OffsetT> freed;
+	};
+
+	using storage = std::conditional_t<by_index, index_storage, pointer_storage>;
+
+	storage store_;
+	size_t size_ = 0;
+
+	node *root() noexcept {
+		if constexpr (by_index) {
+			return store_.nodes.empty() ? nullptr : &store_.nodes[0];
+		} else {
+			return store_.root.get();
+		}
+	}
+
+	node *child(node &n, unsigned c) noexcept {
+		if constexpr (by_index) {
+			return n.children[c] != 0 ? &store_.nodes[n.children[c]] : nullptr;
+		} else {
+			return n.children[c].get();
+		}
+	}
+
+	static bool is_empty(const node &n) noexcept {
+		for (unsigned c=0; c<Alphabet::size; c++) {
+			if (n.children[c]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool has_other_child(const node &n, unsigned c) noexcept {
+		for (unsigned k=0; k<Alphabet::size; k++) {
+			if (k != c && n.children[k]) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Find the node of a key.
+	// @returns Node of the key, or nullptr if it has none.
+	node *find_node(std::string_view key) noexcept {
+		node *n = root();
+		unsigned c;
+		if (n == nullptr) {
+			return nullptr;
+		}
+		for (char ch : key) {
+			c = Alphabet::parse(ch);
+			if (c >= Alphabet::size || (n = child(*n, c)) == nullptr) {
+				return nullptr;
+			}
+		}
+		return n;
+	}
+
+	// Find the node of a key, adding the nodes it is missing.
+	// @returns Node of the key, or nullptr if the key has a character outside of the alphabet or there aren't enough node indices left.
+	node *make_path(std::string_view key) {
+		node *n = root(), *next;
+		size_t i = 0;
+		if (n != nullptr) {
+			for (; i<key.size(); i++) {
+				unsigned c = Alphabet::parse(key[i]);
+				if (c >= Alphabet::size) {
+					return nullptr;
+				}
+				if ((next = child(*n, c)) == nullptr) {
+					break;
+				}
+				n = next;
+			}
+			if (i == key.size()) {
+				return n;
+			}
+		}
+		// check the rest of the key before adding any nodes, so that a bad key never leaves an empty branch behind
+		for (size_t j=i; j<key.size(); j++) {
+			if (Alphabet::parse(key[j]) >= Alphabet::size) {
+				return nullptr;
+			}
+		}
+		if constexpr (by_index) {
+			// nodes move as the array grows, so keep hold of the index rather than the node
+			size_t at = n != nullptr ? (size_t)(n - store_.nodes.data()) : 0;
+			if (!reserve(key.size() - i + (n == nullptr))) {
+				return nullptr;
+			}
+			if (n == nullptr) {
+				store_.nodes.emplace_back();
+			}
+			for (; i<key.size(); i++) {
+				OffsetT r = alloc();
+				store_.nodes[at].children[Alphabet::parse(key[i])] = r;
+				at = r;
+			}
+			return &store_.nodes[at];
+		} else {
+			if (n == nullptr) {
+				store_.root = std::make_unique<node>();
+				store_.count++;
+				n = store_.root.get();
+			}
+			for (; i<key.size(); i++) {
+				ref &slot = n->children[Alphabet::parse(key[i])];
+				slot = std::make_unique<node>();
+				store_.count++;
+				n = slot.get();
+			}
+			return n;
+		}
+	}
+
+	// Make sure n more nodes can be allocated without moving the nodes again, growing the array geometrically.
+	// @returns False if there aren't enough node indices left.
+	bool reserve(size_t n) {
+		size_t used = store_.nodes.size(), more = n > store_.freed.size() ? n - store_.freed.size() : 0, capacity;
+		if (more > max_nodes() - used) {
+			return false;
+		}
+		if (used + more > store_.nodes.capacity()) {
+			capacity = store_.nodes.capacity() * 2;
+			if (capacity < used + more) {
+				capacity = used + more;
+			}
+			if (capacity > max_nodes()) {
+				capacity = max_nodes();
+			}
+			store_.nodes.reserve(capacity);
+			store_.freed.reserve(capacity);
+		}
+		return true;
+	}
+
+	// Allocate a node from space made by reserve.
+	OffsetT alloc() noexcept {
+		OffsetT r;
+		if (!store_.freed.empty()) {
+			r = store_.freed.back();
+			store_.freed.pop_back();
+			return r;
+		}
+		store_.nodes.emplace_back();
+		return (OffsetT)(store_.nodes.size() - 1);
+	}
+
+	// Unlink and free subtree c of a node, which has at most one subtree at each level.
+	void free_branch(node &n, unsigned c) noexcept {
+		if constexpr (by_index) {
+			OffsetT r = n.children[c], next;
+			n.children[c] = 0;
+			while (r != 0) {
+				node &st = store_.nodes[r];
+				next = 0;
+				for (unsigned k=0; k<Alphabet::size; k++) {
+					if (st.children[k] != 0) {
+						next = st.children[k];
+						break;
+					}
+				}
+				st = node();
+				store_.freed.push_back(r);
+				r = next;
+			}
+		} else {
+			for (node *st = n.children[c].get(); st != nullptr; ) {
+				store_.count--;
+				node *next = nullptr;
+				for (unsigned k=0; k<Alphabet::size && next == nullptr; k++) {
+					next = st->children[k].get();
+				}
+				st = next;
+			}
+			n.children[c].reset();
+		}
+	}
+
+	// Deep copy a node and its subtrees.
+	static std::unique_ptr<node> clone(const node &n) {
+		std::unique_ptr<node> copy = std::make_unique<node>();
+		copy->value = n.value;
+		for (unsigned c=0; c<Alphabet::size; c++) {
+			if (n.children[c] != nullptr) {
+				copy->children[c] = clone(*n.children[c]);
+			}
+		}
+		return copy;
+	}
+
+	// Function used internally within for_each, for both const and non-const trees.
+	template <typename Self, typename F>
+	static bool walk(Self &self, F &f, std::string_view prefix) {
+		// stack of nodes being walked, and the key number to carry on from within each one
+		std::vector<std::pair<node*, unsigned>> stack;
+		std::string key;
+		node *n = const_cast<symtree&>(self).find_node(prefix), *st;
+		if (n == nullptr) {
+			return true;
+		}
+		// keys are passed as they are in the alphabet, even if the prefix was given in another case
+		for (char ch : prefix) {
+			key.push_back(Alphabet::unparse(Alphabet::parse(ch)));
+		}
+		stack.emplace_back(n, 0);
+		if (n->value && !visit(f, key, *n->value, self)) {
+			return false;
+		}
+		while (!stack.empty()) {
+			auto &top = stack.back();
+			st = nullptr;
+			while (top.second < Alphabet::size && (st = const_cast<symtree&>(self).child(*top.first, top.second)) == nullptr) {
+				top.second++;
+			}
+			if (st == nullptr) {
+				stack.pop_back();
+				if (!stack.empty()) {
+					key.pop_back();
+				}
+				continue;
+			}
+			key.push_back(Alphabet::unparse(top.second));
+			top.second++;
+			if (st->value && !visit(f, key, *st->value, self)) {
+				return false;
+			}
+			stack.emplace_back(st, 0);
+		}
+		return true;
+	}
+
+	// Call a for_each callback, with a const value if the tree is const.
+	// @returns False if the callback asked to stop.
+	template <typename F, typename Self>
+	static bool visit(F &f, const std::string &key, Value &value, Self &) {
+		using V = std::conditional_t<std::is_const_v<Self>, const Value&, Value&>;
+		if constexpr (std::is_same_v<std::invoke_result_t<F&, std::string_view, V>, bool>) {
+			return f(std::string_view(key), static_cast<V>(value));
+		} else {
+			f(std::string_view(key), static_cast<V>(value));
+			return true;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * symtreeconcurrenttest.c
+ * Author:       Adam "beckadamtheinventor" Beckingham
+ * Description:  Fast string:string dictionary structure concurrent reader and writer test.
+ * License:      GPL3
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define _SYMTREE_CONCURRENT
+// #define _SYMTREE_ADAPTIVE_NODES
+// #define _SYMTREE_USE_INT32_OFFSETS
+// #define _SYMTREE_USE_ARENA
+#include "symtree.h"
+
+#ifndef NUM_KEYS
+#define NUM_KEYS 4096
+#endif
+#ifndef NUM_ROUNDS
+#define NUM_ROUNDS 16
+#endif
+#ifndef NUM_READERS
+#define NUM_READERS 4
+#endif
+#define TEST_KEY_STR "var%X"
+#define TEST_KEY_LEN 12
+
+typedef struct {
+	symtree_t *tree;
+	char *varnames;
+	char *altnames;
+	volatile int *done;
+	long lookups;
+	long failed;
+} test_thread_t;
+
+// Readers look every key up over and over while the writer churns the tree.
+// A key may be missing, but when found its value has to be one of the two strings spelling it.
+void *read_thread(void *arg) {
+	test_thread_t *t = arg;
+	symtree_reader_t *reader = symtree_register_reader(t->tree);
+	VALUE_TYPE value;
+	if (reader == NULL) {
+		t->failed++;
+		return NULL;
+	}
+	while (!__atomic_load_n(t->done, __ATOMIC_ACQUIRE)) {
+		for (int test=0; test<NUM_KEYS; test++) {
+			char *name = &t->varnames[test * TEST_KEY_LEN];
+			// short read sections let the writer reclaim as it goes
+			if (test % 64 == 0) {
+				symtree_read_begin(reader);
+			}
+			if ((value = find_sym(t->tree, name, 0)) != NULL && value != name && value != &t->altnames[test * TEST_KEY_LEN]) {
+				t->failed++;
+			}
+			t->lookups++;
+			if (test % 64 == 63 || test == NUM_KEYS - 1) {
+				symtree_read_end(reader);
+			}
+		}
+	}
+	symtree_unregister_reader(reader);
+	return NULL;
+}
+
+// The writer adds every key, sets every other key to another value, then deletes every third key, so that nodes are grown, shrunk and retired under the readers.
+long write_rounds(test_thread_t *t) {
+	long failed = 0;
+	for (int round=0; round<NUM_ROUNDS; round++) {
+		for (int test=0; test<NUM_KEYS; test++) {
+			char *name = &t->varnames[test * TEST_KEY_LEN];
+			if (new_sym(t->tree, name, 0, name) != name) {
+				failed++;
+			}
+		}
+		for (int test=round%2; test<NUM_KEYS; test+=2) {
+			char *alt = &t->altnames[test * TEST_KEY_LEN];
+			if (set_sym(t->tree, &t->varnames[test * TEST_KEY_LEN], 0, alt) != alt) {
+				failed++;
+			}
+		}
+		for (int test=round%3; test<NUM_KEYS; test+=3) {
+			if (!del_sym(t->tree, &t->varnames[test * TEST_KEY_LEN], 0, false)) {
+				failed++;
+			}
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char *argv[]) {
+	pthread_t handles[NUM_READERS];
+	test_thread_t args[NUM_READERS], writer;
+	volatile int done = 0;
+	char *varnames, *altnames;
+	long failed, lookups = 0;
+	int rv = 0;
+
+	if ((varnames = malloc(NUM_KEYS * TEST_KEY_LEN)) == NULL || (altnames = malloc(NUM_KEYS * TEST_KEY_LEN)) == NULL) {
+		printf("Failed to malloc test symbol names\n");
+		return 1;
+	}
+	for (int test=0; test<NUM_KEYS; test++) {
+		sprintf(&varnames[test * TEST_KEY_LEN], TEST_KEY_STR, test);
+		varnames[test * TEST_KEY_LEN + TEST_KEY_LEN - 1] = 0;
+		memcpy(&altnames[test * TEST_KEY_LEN], &varnames[test * TEST_KEY_LEN], TEST_KEY_LEN);
+	}
+
+	writer.tree = alloc_symtree();
+	writer.varnames = varnames;
+	writer.altnames = altnames;
+	writer.done = &done;
+	writer.lookups = writer.failed = 0;
+	if (writer.tree == NULL) {
+		printf("Failed to allocate tree.\n");
+		return 1;
+	}
+	for (int i=0; i<NUM_READERS; i++) {
+		args[i] = writer;
+		if (pthread_create(&handles[i], NULL, read_thread, &args[i])) {
+			printf("Failed to start reader thread.\n");
+			return 1;
+		}
+	}
+	failed = write_rounds(&writer);
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	if (failed != 0) {
+		printf("Writer failed %ld operations.\n", failed);
+		rv = 1;
+	}
+	failed = 0;
+	for (int i=0; i<NUM_READERS; i++) {
+		pthread_join(handles[i], NULL);
+		failed += args[i].failed;
+		lookups += args[i].lookups;
+	}
+	if (failed != 0) {
+		printf("Readers found %ld wrong values in %ld lookups.\n", failed, lookups);
+		rv = 1;
+	}
+	// with the readers gone, everything retired can be freed
+	if (symtree_reclaim(writer.tree) != 0) {
+		printf("Failed to reclaim retired nodes and values.\n");
+		rv = 1;
+	}
+	free_symtree(writer.tree);
+	free(varnames);
+	free(altnames);
+	if (rv == 0) {
+		printf("Success. %ld lookups made by %d readers alongside the writer.\n", lookups, NUM_READERS);
+	}
+	return rv;
+}
@@ -1,96 +1,905 @@
+
 /**
- * symtreetest.c
+ * symtreeperftest.c
  * Author:       Adam "beckadamtheinventor" Beckingham
- * Description:  Fast string:string dictionary structure test file.
+ * Description:  Fast string:string dictionary structure benchmark suite.
  * License:      GPL3
+ *
+ * Runs each workload against a symbol tree and an open addressing hash map, and writes the results to stdout as json.
+ * Usage: symtreeperftest [-n keys] [-o ops] [-w workload] [-s structure] [corpus.json]
  */
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
 #include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 // #define _SYMTREE_USE_INT32_OFFSETS
+// #define _SYMTREE_ADAPTIVE_NODES
+// #define _SYMTREE_PATH_COMPRESSION
+// #define _SYMTREE_USE_ARENA
+// #define _SYMTREE_USE_INT16_OFFSETS
+// #define _SYMTREE_USE_PAGED_NODES
+// #define _SYMTREE_SNAPSHOTS
+
+// Define this to benchmark the 28-character alphabet of tests/dictionarytest.c, which folds case and allows spaces and dashes.
+// #define PERFTEST_DICTIONARY_ALPHABET
+#ifdef PERFTEST_DICTIONARY_ALPHABET
+#define _PARSE_SYM_NAME_CHAR(c) ((c)=='-' ? 27 : ((c)==' ' ? 26 : ((unsigned)(c)-'A'<26 ? (c)-'A' : ((unsigned)(c)-'a'<26 ? (c)-'a' : -1))))
+#define _UNPARSE_SYM_NAME_CHAR(c) ((c)==27 ? '-' : ((c)==26 ? ' ' : ((unsigned)(c)<26 ? (c)+'A' : -1)))
+#define _SYMTREE_NUM_CHARS 28
+#endif
 #include "symtree.h"
 
-#define NUM_TESTS (65536*128)
-#define TEST_KEY_STR "var%X"
-#define TEST_KEY_LEN 12
+// Default number of keys per workload.
+#ifndef NUM_TESTS
+#define NUM_TESTS (65536*16)
+#endif
 
-int main(int argc, char *argv[]) {
+// Only every this many operations is timed on its own, to keep the cost of reading the clock out of the throughput.
+#define BENCH_SAMPLE_EVERY 8
+#define BENCH_BATCH_SIZE 256
+#define BENCH_NUM_VALUES 256
+#define BENCH_FUZZY_QUERIES 1000
+#define BENCH_ZIPF_THETA 0.99
+#define BENCH_CORPUS "tests/WebstersEnglishDictionary/dictionary_compact.json"
+
+// Keys of a workload, along with the order they are accessed in.
+typedef struct {
+	const char *name;
+	char **keys;
+	size_t *keylens;
+	VALUE_TYPE *values;
+	size_t numkeys;
+	char **misses;
+	size_t *misslens;
+	size_t nummisses;
+	// index of the key used by each operation
+	size_t *order;
+	size_t numops;
+	// storage for the keys and misses
+	char *strings;
+} bench_workload_t;
+
+// Slot of the hash map baseline. Keys are not copied, but are counted in its size since any hash map has to keep them.
+typedef struct {
+	const char *key;
+	size_t keylen;
+	uint64_t hash;
+	VALUE_TYPE value;
+} bench_slot_t;
+
+// Open addressing hash map with linear probing, used as a baseline.
+typedef struct {
+	bench_slot_t *slots;
+	size_t mask;
+	size_t count;
+	// live and deleted slots
+	size_t used;
+	size_t keybytes;
+} bench_map_t;
+
+// Structure under test.
+typedef struct {
+	bool map;
+	symtree_t *tree;
+	bench_map_t hashmap;
+} bench_target_t;
+
+// Latencies of the sampled operations of a phase.
+typedef struct {
+	uint32_t *samples;
+	size_t count;
+	size_t max;
+} bench_latency_t;
+
+static const char bench_tombstone[1] = {0};
+static char bench_valuepool[BENCH_NUM_VALUES][64];
+static uint64_t bench_rng = 0x9E3779B97F4A7C15ull;
+static uint64_t bench_overhead;
+static bool bench_first_result = true;
+
+static uint64_t bench_random(void) {
+	// xorshift64*
+	bench_rng ^= bench_rng >> 12;
+	bench_rng ^= bench_rng << 25;
+	bench_rng ^= bench_rng >> 27;
+	return bench_rng * 0x2545F4914F6CDD1Dull;
+}
+
+static double bench_random01(void) {
+	return (bench_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Returns a monotonic time in nanoseconds.
+static inline uint64_t bench_now(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// Returns the current resident set size of the process in bytes, or 0 if it can't be read.
+static size_t bench_rss(void) {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.WorkingSetSize;
+	}
+	return 0;
+#elif defined(__APPLE__)
+	struct mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+		return 0;
+	}
+	return info.resident_size;
+#else
 	FILE *fd;
-	size_t treesize;
-	char *varnames;
-	char *sym;
-	clock_t start, end;
-	symtree_t *tree = alloc_symtree();
-
-	if ((varnames = malloc(NUM_TESTS * TEST_KEY_LEN)) == NULL) {
-		printf("Failed to malloc test symbol names\n");
-		return 1;
+	unsigned long size, resident;
+	bool read;
+	if ((fd = fopen("/proc/self/statm", "r")) == NULL) {
+		return 0;
 	}
-	for (int test=0; test<NUM_TESTS; test++) {
-		sprintf(&varnames[test * TEST_KEY_LEN], TEST_KEY_STR, test);
-		varnames[test * TEST_KEY_LEN + TEST_KEY_LEN - 1] = 0;
+	read = fscanf(fd, "%lu %lu", &size, &resident) == 2;
+	fclose(fd);
+	return read ? (size_t)resident * sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+// Measure the smallest time between two reads of the clock, which is taken off each sampled latency.
+static void bench_calibrate(void) {
+	uint64_t t, least = UINT64_MAX;
+	for (int i=0; i<1000; i++) {
+		t = bench_now();
+		t = bench_now() - t;
+		if (t < least) {
+			least = t;
+		}
+	}
+	bench_overhead = least;
+}
+
+static uint64_t bench_hash(const char *key, size_t keylen) {
+	// FNV-1a
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i=0; i<keylen; i++) {
+		hash = (hash ^ (uint8_t)key[i]) * 0x100000001B3ull;
 	}
+	return hash;
+}
 
-	if ((fd = fopen("symtreeperftest.txt", "wb"))) {
-		bool success = true;
-		start = clock();
-		for (int test=0; test<NUM_TESTS; test++) {
-			if (new_sym(tree, &varnames[test * TEST_KEY_LEN], 0, "abcdefgh") == NULL) {
-				fprintf(fd, "Failed to locate symbol \"%s\".\n", &varnames[test * TEST_KEY_LEN]);
-				success = false;
-				break;
+static bool bench_map_init(bench_map_t *map, size_t capacity) {
+	size_t size = 16;
+	while (size < capacity) {
+		size *= 2;
+	}
+	memset(map, 0, sizeof(bench_map_t));
+	if ((map->slots = calloc(size, sizeof(bench_slot_t))) == NULL) {
+		return false;
+	}
+	map->mask = size - 1;
+	return true;
+}
+
+// Returns the slot holding a key, or the empty slot it would go in.
+static bench_slot_t *bench_map_slot(bench_map_t *map, const char *key, size_t keylen, uint64_t hash, bool insert) {
+	bench_slot_t *slot, *free = NULL;
+	for (size_t i=hash & map->mask; ; i=(i + 1) & map->mask) {
+		slot = &map->slots[i];
+		if (slot->key == NULL) {
+			return (insert && free != NULL) ? free : slot;
+		}
+		if (slot->key == bench_tombstone) {
+			if (free == NULL) {
+				free = slot;
 			}
+		} else if (slot->hash == hash && slot->keylen == keylen && memcmp(slot->key, key, keylen) == 0) {
+			return slot;
 		}
-		if (success) {
-			end = clock();
-			fprintf(fd, "Took %f seconds to add %d symbols to tree.\n", (end-start) / (float)CLOCKS_PER_SEC, NUM_TESTS);
-			start = clock();
-			for (int test=0; test<NUM_TESTS; test++) {
-				if (find_sym(tree, &varnames[test * TEST_KEY_LEN], 0) == NULL) {
-					fprintf(fd, "Failed to locate symbol \"%s\".\n", &varnames[test * TEST_KEY_LEN]);
-					success = false;
-					break;
-				}
+	}
+}
+
+static bool bench_map_grow(bench_map_t *map) {
+	bench_map_t grown;
+	bench_slot_t *slot;
+	// only grow if deleted slots aren't what filled it up
+	if (!bench_map_init(&grown, map->count * 2 < (map->mask + 1) / 2 ? map->mask + 1 : (map->mask + 1) * 2)) {
+		return false;
+	}
+	for (size_t i=0; i<=map->mask; i++) {
+		slot = &map->slots[i];
+		if (slot->key != NULL && slot->key != bench_tombstone) {
+			*bench_map_slot(&grown, slot->key, slot->keylen, slot->hash, true) = *slot;
+		}
+	}
+	grown.count = grown.used = map->count;
+	grown.keybytes = map->keybytes;
+	free(map->slots);
+	*map = grown;
+	return true;
+}
+
+static VALUE_TYPE bench_map_put(bench_map_t *map, const char *key, size_t keylen, VALUE_TYPE value) {
+	uint64_t hash = bench_hash(key, keylen);
+	bench_slot_t *slot;
+	if ((map->used + 1) * 10 > (map->mask + 1) * 7 && !bench_map_grow(map)) {
+		return NULL;
+	}
+	slot = bench_map_slot(map, key, keylen, hash, true);
+	if (slot->key == NULL || slot->key == bench_tombstone) {
+		if (slot->key == NULL) {
+			map->used++;
+		}
+		map->count++;
+		map->keybytes += keylen + 1;
+		slot->key = key;
+		slot->keylen = keylen;
+		slot->hash = hash;
+	}
+	return (slot->value = value);
+}
+
+static VALUE_TYPE bench_map_get(bench_map_t *map, const char *key, size_t keylen) {
+	bench_slot_t *slot = bench_map_slot(map, key, keylen, bench_hash(key, keylen), false);
+	return slot->key != NULL ? slot->value : NULL;
+}
+
+static bool bench_map_del(bench_map_t *map, const char *key, size_t keylen) {
+	bench_slot_t *slot = bench_map_slot(map, key, keylen, bench_hash(key, keylen), false);
+	if (slot->key == NULL) {
+		return false;
+	}
+	slot->key = bench_tombstone;
+	map->count--;
+	map->keybytes -= keylen + 1;
+	return true;
+}
+
+static inline VALUE_TYPE bench_put(bench_target_t *target, const char *key, size_t keylen, VALUE_TYPE value) {
+	if (target->map) {
+		return bench_map_put(&target->hashmap, key, keylen, value);
+	}
+#ifdef _SYMTREE_INTERN_VALUES
+	// the tree keeps its own copy of each distinct value
+	return new_sym(target->tree, key, keylen, symtree_intern(target->tree, value, 0));
+#else
+	return new_sym(target->tree, key, keylen, value);
+#endif
+}
+
+static inline VALUE_TYPE bench_get(bench_target_t *target, const char *key, size_t keylen) {
+	if (target->map) {
+		return bench_map_get(&target->hashmap, key, keylen);
+	}
+	return find_sym(target->tree, key, keylen);
+}
+
+static inline bool bench_del(bench_target_t *target, const char *key, size_t keylen) {
+	if (target->map) {
+		return bench_map_del(&target->hashmap, key, keylen);
+	}
+	return del_sym(target->tree, key, keylen, false);
+}
+
+static inline void bench_sample(bench_latency_t *latency, uint64_t start) {
+	uint64_t t = bench_now() - start;
+	t = t > bench_overhead ? t - bench_overhead : 0;
+	if (latency->count < latency->max) {
+		latency->samples[latency->count++] = t > UINT32_MAX ? UINT32_MAX : (uint32_t)t;
+	}
+}
+
+static int bench_compare_samples(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// Compare keys in the order of their character numbers, which is the order symtree_build_sorted expects.
+static int bench_compare_names(const void *a, const void *b) {
+	const char *x = *(char *const*)a, *y = *(char *const*)b;
+	unsigned cx, cy;
+	for (; *x && *y; x++, y++) {
+		cx = _PARSE_SYM_NAME_CHAR((uint8_t)*x);
+		cy = _PARSE_SYM_NAME_CHAR((uint8_t)*y);
+		if (cx != cy) {
+			return cx < cy ? -1 : 1;
+		}
+	}
+	return *x ? 1 : (*y ? -1 : 0);
+}
+
+// Write the result of a phase as a json object. Latency percentiles are null if no operations were sampled.
+static void bench_report_phase(const char *phase, size_t ops, size_t found, uint64_t elapsed, bench_latency_t *latency, bool *first) {
+	printf("%s\n\t\t\t\t{\"phase\": \"%s\", \"ops\": %zu, \"found\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f", *first ? "" : ",", phase, ops, found, elapsed / 1e9, elapsed > 0 ? ops * 1e9 / elapsed : 0.0);
+	if (latency != NULL && latency->count > 0) {
+		qsort(latency->samples, latency->count, sizeof(uint32_t), bench_compare_samples);
+		printf(", \"p50_ns\": %u, \"p99_ns\": %u, \"p999_ns\": %u, \"max_ns\": %u}",
+			latency->samples[latency->count * 50 / 100], latency->samples[latency->count * 99 / 100],
+			latency->samples[latency->count * 999 / 1000], latency->samples[latency->count - 1]);
+	} else {
+		printf(", \"p50_ns\": null, \"p99_ns\": null, \"p999_ns\": null, \"max_ns\": null}");
+	}
+	*first = false;
+	if (latency != NULL) {
+		latency->count = 0;
+	}
+}
+
+// Run the lookups and updates of a phase, with a share of writes between 0 and 1.
+// @returns Number of lookups that found a value.
+static size_t bench_mixed(bench_target_t *target, bench_workload_t *w, double writes, bool misses, bench_latency_t *latency) {
+	size_t found = 0, k;
+	uint64_t threshold = (uint64_t)(writes * (double)UINT64_MAX), start = 0;
+	const char *key;
+	size_t keylen;
+	for (size_t i=0; i<w->numops; i++) {
+		bool sampled = i % BENCH_SAMPLE_EVERY == 0;
+		k = w->order[i];
+		if (misses) {
+			k %= w->nummisses;
+			key = w->misses[k];
+			keylen = w->misslens[k];
+		} else {
+			key = w->keys[k];
+			keylen = w->keylens[k];
+		}
+		// draw before starting the clock
+		bool write = writes > 0 && bench_random() < threshold;
+		if (sampled) {
+			start = bench_now();
+		}
+		if (write) {
+			bench_put(target, key, keylen, w->values[(k + i) % w->numkeys]);
+		} else if (bench_get(target, key, keylen) != NULL) {
+			found++;
+		}
+		if (sampled) {
+			bench_sample(latency, start);
+		}
+	}
+	return found;
+}
+
+// Callback for the fuzzy phase.
+static bool bench_count_fuzzy(void *context, const char *key, size_t keylen, VALUE_TYPE value, unsigned dist) {
+	(*(size_t*)context)++;
+	return true;
+}
+
+// Run every phase of a workload against a structure, writing its results as a json object.
+static bool bench_run(bench_workload_t *w, bool map, bench_latency_t *latency) {
+	bench_target_t target;
+	bool first = true;
+	size_t found, bytes, valuebytes, keys, rss, rssgrowth;
+	uint64_t start, elapsed, t;
+	memset(&target, 0, sizeof(target));
+	// measured from here rather than as a peak, which would carry over from earlier runs
+	rss = bench_rss();
+	target.map = map;
+	if (map) {
+		if (!bench_map_init(&target.hashmap, 16)) {
+			return false;
+		}
+	} else if ((target.tree = alloc_symtree()) == NULL) {
+		return false;
+	}
+	fprintf(stderr, "Running workload \"%s\" on %s...\n", w->name, map ? "hashmap" : "symtree");
+	printf("%s\n\t\t{\"workload\": \"%s\", \"structure\": \"%s\", \"phases\": [", bench_first_result ? "" : ",", w->name, map ? "hashmap" : "symtree");
+	bench_first_result = false;
+
+	// insertion, in the order the keys were generated
+	found = 0;
+	elapsed = bench_now();
+	for (size_t i=0; i<w->numkeys; i++) {
+		if (i % BENCH_SAMPLE_EVERY == 0) {
+			t = bench_now();
+			found += bench_put(&target, w->keys[i], w->keylens[i], w->values[i]) != NULL;
+			bench_sample(latency, t);
+		} else {
+			found += bench_put(&target, w->keys[i], w->keylens[i], w->values[i]) != NULL;
+		}
+	}
+	elapsed = bench_now() - elapsed;
+	bench_report_phase("insert", w->numkeys, found, elapsed, latency, &first);
+	if (map) {
+		bytes = (target.hashmap.mask + 1) * sizeof(bench_slot_t) + target.hashmap.keybytes;
+		// the hash map points at the workload's values without copying them
+		valuebytes = 0;
+		keys = target.hashmap.count;
+	} else {
+		bytes = symtree_size(target.tree, false);
+		valuebytes = symtree_counts(target.tree).valuebytes;
+		keys = symtree_counts(target.tree).keys;
+	}
+	rssgrowth = bench_rss();
+	rssgrowth = rssgrowth > rss ? rssgrowth - rss : 0;
+
+	start = bench_now();
+	found = bench_mixed(&target, w, 0, false, latency);
+	bench_report_phase("lookup_hit", w->numops, found, bench_now() - start, latency, &first);
+	start = bench_now();
+	found = bench_mixed(&target, w, 0, true, latency);
+	bench_report_phase("lookup_miss", w->numops, found, bench_now() - start, latency, &first);
+
+	if (!map) {
+		const char *names[BENCH_BATCH_SIZE];
+		size_t namelens[BENCH_BATCH_SIZE];
+		VALUE_TYPE values[BENCH_BATCH_SIZE];
+		size_t count;
+		found = 0;
+		start = bench_now();
+		for (size_t i=0; i<w->numops; i+=BENCH_BATCH_SIZE) {
+			count = w->numops - i < BENCH_BATCH_SIZE ? w->numops - i : BENCH_BATCH_SIZE;
+			for (size_t j=0; j<count; j++) {
+				names[j] = w->keys[w->order[i + j]];
+				namelens[j] = w->keylens[w->order[i + j]];
 			}
-			if (success) {
-				end = clock();
-				fprintf(fd, "Took %f seconds to locate %d symbols in tree.\n", (end-start) / (float)CLOCKS_PER_SEC, NUM_TESTS);
-				start = clock();
-				for (int test=0; test<NUM_TESTS; test++) {
-					if (set_sym(tree, &varnames[test * TEST_KEY_LEN], 0, "abcdefgh") == NULL) {
-						fprintf(fd, "Failed to locate symbol \"%s\".\n", &varnames[test * TEST_KEY_LEN]);
-						success = false;
-						break;
-					}
-				}
-				if (success) {
-					end = clock();
-					fprintf(fd, "Took %f seconds to locate and set %d symbols in tree.\n", (end-start) / (float)CLOCKS_PER_SEC, NUM_TESTS);
-					treesize = symtree_size(tree, false);
-					fprintf(fd, "Tree size: %d kb. (%f gb)\n", treesize/1024, treesize/(1024*1024*1024.0f));
-					treesize = symtree_size(tree, true);
-					fprintf(fd, "Tree size +values: %d kb. (%f gb)\n", treesize/1024, treesize/(1024*1024*1024.0f));
-					start = clock();
-					for (int test=0; test<NUM_TESTS; test++) {
-						if (del_sym(tree, &varnames[test * TEST_KEY_LEN], 0, false) == false) {
-							fprintf(fd, "Failed to delete symbol \"%s\".\n", &varnames[test * TEST_KEY_LEN]);
-							success = false;
-							break;
-						}
+			found += find_sym_batch(target.tree, names, namelens, values, count);
+		}
+		bench_report_phase("lookup_batch", w->numops, found, bench_now() - start, NULL, &first);
+	}
+
+	start = bench_now();
+	found = bench_mixed(&target, w, 0.05, false, latency);
+	bench_report_phase("mixed_95_5", w->numops, found, bench_now() - start, latency, &first);
+	start = bench_now();
+	found = bench_mixed(&target, w, 0.5, false, latency);
+	bench_report_phase("mixed_50_50", w->numops, found, bench_now() - start, latency, &first);
+
+	if (!map) {
+		symtree_iter_t it;
+		const char *key;
+		size_t keylen;
+		VALUE_TYPE value;
+		found = 0;
+		start = bench_now();
+		if (symtree_iter_init(&it, target.tree, NULL, 0)) {
+			while (symtree_iter_next(&it, &key, &keylen, &value)) {
+				found++;
+			}
+			symtree_iter_free(&it);
+		}
+		bench_report_phase("scan", found, found, bench_now() - start, NULL, &first);
+
+		found = 0;
+		start = bench_now();
+		for (size_t i=0; i<BENCH_FUZZY_QUERIES && i<w->numops; i++) {
+			size_t k = w->order[i];
+			t = bench_now();
+			find_sym_fuzzy(target.tree, w->keys[k], w->keylens[k], 1, bench_count_fuzzy, &found);
+			bench_sample(latency, t);
+		}
+		bench_report_phase("fuzzy_1", BENCH_FUZZY_QUERIES < w->numops ? BENCH_FUZZY_QUERIES : w->numops, found, bench_now() - start, latency, &first);
+
+#ifdef _SYMTREE_SNAPSHOTS
+		FILE *fd;
+		symtree_snapshot_t snap;
+		if ((fd = fopen("symtreeperftest.bin", "wb+")) != NULL) {
+			bool saved = save_symtree_snapshot(target.tree, fd);
+			fclose(fd);
+			if (saved && open_symtree_snapshot(&snap, "symtreeperftest.bin")) {
+				found = 0;
+				start = bench_now();
+				for (size_t i=0; i<w->numops; i++) {
+					size_t k = w->order[i];
+					if (i % BENCH_SAMPLE_EVERY == 0) {
+						t = bench_now();
+						found += find_sym_snapshot(&snap, w->keys[k], w->keylens[k]) != NULL;
+						bench_sample(latency, t);
+					} else {
+						found += find_sym_snapshot(&snap, w->keys[k], w->keylens[k]) != NULL;
 					}
-					end = clock();
-					fprintf(fd, "Took %f seconds to delete %d symbols in tree.\n", (end-start) / (float)CLOCKS_PER_SEC, NUM_TESTS);
 				}
+				bench_report_phase("snapshot_lookup", w->numops, found, bench_now() - start, latency, &first);
+				close_symtree_snapshot(&snap);
 			}
+			remove("symtreeperftest.bin");
 		}
-		free_symtree(tree);
+#endif
+	}
+
+	found = 0;
+	elapsed = bench_now();
+	for (size_t i=0; i<w->numkeys; i++) {
+		if (i % BENCH_SAMPLE_EVERY == 0) {
+			t = bench_now();
+			found += bench_del(&target, w->keys[i], w->keylens[i]);
+			bench_sample(latency, t);
+		} else {
+			found += bench_del(&target, w->keys[i], w->keylens[i]);
+		}
+	}
+	elapsed = bench_now() - elapsed;
+	bench_report_phase("delete", w->numkeys, found, elapsed, latency, &first);
+
+	if (map) {
+		free(target.hashmap.slots);
+	} else {
+		free_symtree(target.tree);
+		char **sorted = malloc(w->numkeys * sizeof(char*));
+		if (sorted != NULL) {
+			memcpy(sorted, w->keys, w->numkeys * sizeof(char*));
+			qsort(sorted, w->numkeys, sizeof(char*), bench_compare_names);
+			start = bench_now();
+			target.tree = symtree_build_sorted((const char *const*)sorted, NULL, w->values, w->numkeys);
+			elapsed = bench_now() - start;
+			if (target.tree != NULL) {
+				bench_report_phase("build_sorted", w->numkeys, symtree_counts(target.tree).keys, elapsed, NULL, &first);
+				free_symtree(target.tree);
+			}
+			free(sorted);
+		}
+	}
+#ifdef __GLIBC__
+	// give the freed memory back, so that the next run's growth isn't hidden by reusing it
+	malloc_trim(0);
+#endif
+	printf("\n\t\t], \"keys\": %zu, \"bytes\": %zu, \"bytes_per_key\": %.2f, \"value_bytes\": %zu, \"rss_growth\": %zu}", keys, bytes, keys > 0 ? (double)bytes / keys : 0.0, valuebytes, rssgrowth);
+	fflush(stdout);
+	return true;
+}
+
+// Append a key to a workload's string storage.
+static char *bench_store(char **cursor, const char *key, size_t keylen) {
+	char *s = *cursor;
+	memcpy(s, key, keylen);
+	s[keylen] = 0;
+	*cursor += keylen + 1;
+	return s;
+}
+
+// Write the key for a number as hexadecimal, with the digits written as the letters A-P so that it is valid in any alphabet.
+static size_t bench_sequential_key(char *buffer, size_t n) {
+	char digits[16];
+	size_t len = 3, d = 0;
+	memcpy(buffer, "var", 3);
+	do {
+		digits[d++] = 'A' + (n & 15);
+		n >>= 4;
+	} while (n > 0);
+	while (d > 0) {
+		buffer[len++] = digits[--d];
+	}
+	return len;
+}
+
+// Allocate the arrays of a workload, with room for strings of up to stringbytes bytes in total.
+static bool bench_alloc_workload(bench_workload_t *w, const char *name, size_t numkeys, size_t numops, size_t stringbytes) {
+	memset(w, 0, sizeof(bench_workload_t));
+	w->name = name;
+	w->numkeys = numkeys;
+	w->nummisses = numkeys;
+	w->numops = numops;
+	w->keys = malloc(numkeys * sizeof(char*));
+	w->keylens = malloc(numkeys * sizeof(size_t));
+	w->values = malloc(numkeys * sizeof(VALUE_TYPE));
+	w->misses = malloc(numkeys * sizeof(char*));
+	w->misslens = malloc(numkeys * sizeof(size_t));
+	w->order = malloc(numops * sizeof(size_t));
+	// misses are one character longer than the keys they are made from
+	w->strings = malloc(stringbytes * 2 + numkeys);
+	return w->keys != NULL && w->keylens != NULL && w->values != NULL && w->misses != NULL && w->misslens != NULL && w->order != NULL && w->strings != NULL;
+}
+
+static void bench_free_workload(bench_workload_t *w) {
+	free(w->keys);
+	free(w->keylens);
+	free(w->values);
+	free(w->misses);
+	free(w->misslens);
+	free(w->order);
+	free(w->strings);
+}
+
+// Make a miss for each key, half of them extending the key past its end and half of them diverging at the first character.
+static void bench_make_misses(bench_workload_t *w, char *cursor) {
+	char buffer[1024];
+	size_t len;
+	for (size_t i=0; i<w->numkeys; i++) {
+		len = w->keylens[i] < sizeof(buffer) - 1 ? w->keylens[i] : sizeof(buffer) - 2;
+		if (i % 2 == 0) {
+			memcpy(buffer, w->keys[i], len);
+			buffer[len] = 'Q';
+		} else {
+			buffer[0] = 'Q';
+			memcpy(&buffer[1], w->keys[i], len);
+		}
+		w->misses[i] = bench_store(&cursor, buffer, len + 1);
+		w->misslens[i] = len + 1;
+	}
+}
+
+// Fill the order of a workload with key indices, uniformly at random or following a zipfian distribution.
+// Zipfian ranks are drawn as in YCSB, and scattered over the keys so that the popular ones aren't next to each other in the tree.
+static void bench_make_order(bench_workload_t *w, bool zipfian) {
+	double zetan = 0, zeta2, alpha, eta, u, uz;
+	size_t n = w->numkeys, rank;
+	if (!zipfian) {
+		for (size_t i=0; i<w->numops; i++) {
+			w->order[i] = bench_random() % n;
+		}
+		return;
+	}
+	for (size_t i=1; i<=n; i++) {
+		zetan += 1.0 / pow((double)i, BENCH_ZIPF_THETA);
+	}
+	zeta2 = 1.0 + 1.0 / pow(2.0, BENCH_ZIPF_THETA);
+	alpha = 1.0 / (1.0 - BENCH_ZIPF_THETA);
+	eta = (1.0 - pow(2.0 / n, 1.0 - BENCH_ZIPF_THETA)) / (1.0 - zeta2 / zetan);
+	for (size_t i=0; i<w->numops; i++) {
+		u = bench_random01();
+		uz = u * zetan;
+		if (uz < 1.0) {
+			rank = 0;
+		} else if (uz < zeta2) {
+			rank = 1;
+		} else {
+			rank = (size_t)(n * pow(eta * u - eta + 1.0, alpha));
+		}
+		if (rank >= n) {
+			rank = n - 1;
+		}
+		w->order[i] = bench_hash((const char*)&rank, sizeof(rank)) % n;
+	}
+}
+
+// Sequential keys, inserted and accessed in order.
+static bool bench_sequential(bench_workload_t *w, size_t numkeys, size_t numops) {
+	char buffer[32], *cursor;
+	size_t len;
+	if (!bench_alloc_workload(w, "sequential", numkeys, numops, numkeys * 20)) {
+		return false;
+	}
+	cursor = w->strings;
+	for (size_t i=0; i<numkeys; i++) {
+		len = bench_sequential_key(buffer, i);
+		w->keys[i] = bench_store(&cursor, buffer, len);
+		w->keylens[i] = len;
+		w->values[i] = bench_valuepool[i % BENCH_NUM_VALUES];
+	}
+	bench_make_misses(w, cursor);
+	for (size_t i=0; i<numops; i++) {
+		w->order[i] = i % numkeys;
+	}
+	return true;
+}
+
+// Random keys of 6 to 24 capital letters, accessed uniformly at random or following a zipfian distribution.
+static bool bench_random_keys(bench_workload_t *w, const char *name, size_t numkeys, size_t numops, bool zipfian) {
+	char buffer[32], *cursor;
+	size_t len;
+	if (!bench_alloc_workload(w, name, numkeys, numops, numkeys * 25)) {
+		return false;
+	}
+	cursor = w->strings;
+	for (size_t i=0; i<numkeys; i++) {
+		len = 6 + bench_random() % 19;
+		for (size_t j=0; j<len; j++) {
+			buffer[j] = 'A' + bench_random() % 26;
+		}
+		w->keys[i] = bench_store(&cursor, buffer, len);
+		w->keylens[i] = len;
+		w->values[i] = bench_valuepool[bench_random() % BENCH_NUM_VALUES];
+	}
+	bench_make_misses(w, cursor);
+	bench_make_order(w, zipfian);
+	return true;
+}
+
+// Keys and values of a json file such as the Webster's dictionary, accessed uniformly at random.
+// Keys with characters outside of the alphabet are left out.
+static bool bench_corpus(bench_workload_t *w, const char *path, size_t numops) {
+	FILE *fd;
+	char *data, *cursor;
+	size_t len, numkeys = 0, bytes = 0;
+	symtree_t *tree;
+	symtree_iter_t it;
+	const char *key;
+	size_t keylen;
+	VALUE_TYPE value;
+	memset(w, 0, sizeof(bench_workload_t));
+	if ((fd = fopen(path, "rb")) == NULL) {
+		return false;
+	}
+	fseek(fd, 0, SEEK_END);
+	len = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	if ((data = malloc(len)) == NULL || fread(data, 1, len, fd) != len) {
+		free(data);
 		fclose(fd);
+		return false;
 	}
-	printf("Success. Results in \"symtreeperftest.txt\".\n");
-	return 0;
+	fclose(fd);
+	tree = load_symtree(data, len);
+	free(data);
+	if (tree == NULL) {
+		return false;
+	}
+	if (symtree_iter_init(&it, tree, NULL, 0)) {
+		while (symtree_iter_next(&it, &key, &keylen, &value)) {
+			numkeys++;
+			bytes += keylen + 1 + strlen(value) + 1;
+		}
+		symtree_iter_free(&it);
+	}
+	if (numkeys == 0 || !bench_alloc_workload(w, "corpus", numkeys, numops, bytes)) {
+		free_symtree(tree);
+		return false;
+	}
+	cursor = w->strings;
+	if (symtree_iter_init(&it, tree, NULL, 0)) {
+		for (size_t i=0; i<numkeys && symtree_iter_next(&it, &key, &keylen, &value); i++) {
+			w->keys[i] = bench_store(&cursor, key, keylen);
+			w->keylens[i] = keylen;
+			w->values[i] = bench_store(&cursor, value, strlen(value));
+		}
+		symtree_iter_free(&it);
+	}
+	free_symtree(tree);
+	// the keys come out sorted, so shuffle them to insert them in no particular order
+	for (size_t i=numkeys-1; i>0; i--) {
+		size_t j = bench_random() % (i + 1);
+		char *k = w->keys[i];
+		size_t l = w->keylens[i];
+		VALUE_TYPE v = w->values[i];
+		w->keys[i] = w->keys[j];
+		w->keylens[i] = w->keylens[j];
+		w->values[i] = w->values[j];
+		w->keys[j] = k;
+		w->keylens[j] = l;
+		w->values[j] = v;
+	}
+	bench_make_misses(w, w->strings + bytes);
+	bench_make_order(w, false);
+	return true;
 }
 
+int main(int argc, char *argv[]) {
+	size_t numkeys = NUM_TESTS, numops = 0;
+	const char *workload = NULL, *structure = NULL, *corpus = BENCH_CORPUS;
+	const char *names[] = {"sequential", "random", "zipfian", "corpus"};
+	bench_workload_t w;
+	bench_latency_t latency;
+	bool built;
+
+	for (int i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "/h")) {
+			printf("Usage: %s [-n keys] [-o ops] [-w sequential|random|zipfian|corpus] [-s symtree|hashmap] [corpus.json]\n", argv[0]);
+			return 0;
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			numkeys = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			numops = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			workload = argv[++i];
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			structure = argv[++i];
+		} else {
+			corpus = argv[i];
+		}
+	}
+	if (numkeys == 0) {
+		numkeys = 1;
+	}
+	if (numops == 0) {
+		numops = numkeys;
+	}
+	// values vary in length, rather than all being the same string
+	for (int i=0; i<BENCH_NUM_VALUES; i++) {
+		int len = 1 + bench_random() % (sizeof(bench_valuepool[i]) - 1);
+		for (int j=0; j<len; j++) {
+			bench_valuepool[i][j] = 'a' + bench_random() % 26;
+		}
+		bench_valuepool[i][len] = 0;
+	}
+	// the phase with the most sampled operations bounds the number of samples
+	latency.max = (numkeys > numops ? numkeys : numops) / BENCH_SAMPLE_EVERY + BENCH_FUZZY_QUERIES + 1;
+	latency.count = 0;
+	if ((latency.samples = malloc(latency.max * sizeof(uint32_t))) == NULL) {
+		fprintf(stderr, "Failed to malloc latency samples\n");
+		return 1;
+	}
+	bench_calibrate();
+
+	printf("{\n\t\"config\": {\"offsets\": \"%s\", \"adaptive_nodes\": %s, \"path_compression\": %s, \"arena\": %s, \"paged_nodes\": %s, \"burst_containers\": %s, \"intern_values\": %s, \"alphabet\": \"%s\", \"num_chars\": %d, \"keys\": %zu, \"ops\": %zu, \"sample_every\": %d, \"timer_overhead_ns\": %u},\n\t\"results\": [",
+#if defined(_SYMTREE_USE_INT32_OFFSETS)
+		"int32",
+#elif defined(_SYMTREE_USE_INT16_OFFSETS)
+		"int16",
+#else
+		"pointer",
+#endif
+#ifdef _SYMTREE_ADAPTIVE_NODES
+		"true",
+#else
+		"false",
+#endif
+#ifdef _SYMTREE_PATH_COMPRESSION
+		"true",
+#else
+		"false",
+#endif
+#ifdef _SYMTREE_USE_ARENA
+		"true",
+#else
+		"false",
+#endif
+#ifdef _SYMTREE_USE_PAGED_NODES
+		"true",
+#else
+		"false",
+#endif
+#ifdef _SYMTREE_BURST_CONTAINERS
+		"true",
+#else
+		"false",
+#endif
+#ifdef _SYMTREE_INTERN_VALUES
+		"true",
+#else
+		"false",
+#endif
+#ifdef PERFTEST_DICTIONARY_ALPHABET
+		"dictionary",
+#elif defined(_SYMTREE_BINARY_KEYS)
+		"binary",
+#else
+		"default",
+#endif
+		_SYMTREE_NUM_CHARS, numkeys, numops, BENCH_SAMPLE_EVERY, (unsigned)bench_overhead);
+
+	for (int n=0; n<4; n++) {
+		if (workload != NULL && strcmp(workload, names[n]) != 0) {
+			continue;
+		}
+		switch (n) {
+			case 0: built = bench_sequential(&w, numkeys, numops); break;
+			case 1: built = bench_random_keys(&w, "random", numkeys, numops, false); break;
+			case 2: built = bench_random_keys(&w, "zipfian", numkeys, numops, true); break;
+			default: built = bench_corpus(&w, corpus, numops); break;
+		}
+		if (!built) {
+			fprintf(stderr, "Skipping workload \"%s\"%s.\n", names[n], n == 3 ? ", since the corpus could not be loaded" : " due to insufficient memory");
+			bench_free_workload(&w);
+			continue;
+		}
+		if (structure == NULL || !strcmp(structure, "symtree")) {
+			if (!bench_run(&w, false, &latency)) {
+				fprintf(stderr, "Failed to allocate symtree.\n");
+			}
+		}
+		if (structure == NULL || !strcmp(structure, "hashmap")) {
+			if (!bench_run(&w, true, &latency)) {
+				fprintf(stderr, "Failed to allocate hashmap.\n");
+			}
+		}
+		bench_free_workload(&w);
+	}
+	printf("\n\t]\n}\n");
+	free(latency.samples);
+	return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * symtreestresstest.c
+ * Author:       Adam "beckadamtheinventor" Beckingham
+ * Description:  Fast string:string dictionary structure multi-threaded stress test and benchmark.
+ * License:      GPL3
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#define _SYMTREE_CONCURRENT
+// #define _SYMTREE_USE_INT32_OFFSETS
+// #define _SYMTREE_USE_ARENA
+#include "symtree.h"
+
+#ifndef NUM_TESTS
+#define NUM_TESTS (65536*32)
+#endif
+#ifndef MAX_THREADS
+#define MAX_THREADS 8
+#endif
+#define TEST_KEY_STR "var%X"
+#define TEST_KEY_LEN 12
+
+typedef struct {
+	symtree_t *tree;
+	char *varnames;
+	int first;
+	int step;
+	long failed;
+} test_thread_t;
+
+double seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Threads take every step'th key, so that neighbouring keys race for the same subtrees.
+void *add_thread(void *arg) {
+	test_thread_t *t = arg;
+	for (int test=t->first; test<NUM_TESTS; test+=t->step) {
+		char *name = &t->varnames[test * TEST_KEY_LEN];
+		if (new_sym_atomic(t->tree, name, 0, name) != name) {
+			t->failed++;
+		}
+	}
+	return NULL;
+}
+
+void *find_thread(void *arg) {
+	test_thread_t *t = arg;
+	symtree_reader_t *reader = symtree_register_reader(t->tree);
+	if (reader == NULL) {
+		t->failed++;
+		return NULL;
+	}
+	// lookups are made in read sections of 256 at a time
+	int count = 0;
+	for (int test=t->first; test<NUM_TESTS; test+=t->step) {
+		char *name = &t->varnames[test * TEST_KEY_LEN];
+		if (count == 0) {
+			symtree_read_begin(reader);
+		}
+		if (find_sym(t->tree, name, 0) != name) {
+			t->failed++;
+		}
+		if (++count == 256) {
+			symtree_read_end(reader);
+			count = 0;
+		}
+	}
+	if (count != 0) {
+		symtree_read_end(reader);
+	}
+	symtree_unregister_reader(reader);
+	return NULL;
+}
+
+// Run a test function on a number of threads, returning the number of failures.
+long run_threads(void *(*func)(void*), symtree_t *tree, char *varnames, int threads) {
+	pthread_t handles[MAX_THREADS];
+	test_thread_t args[MAX_THREADS];
+	long failed = 0;
+	for (int i=0; i<threads; i++) {
+		args[i].tree = tree;
+		args[i].varnames = varnames;
+		args[i].first = i;
+		args[i].step = threads;
+		args[i].failed = 0;
+		if (pthread_create(&handles[i], NULL, func, &args[i])) {
+			return -1;
+		}
+	}
+	for (int i=0; i<threads; i++) {
+		pthread_join(handles[i], NULL);
+		failed += args[i].failed;
+	}
+	return failed;
+}
+
+int main(int argc, char *argv[]) {
+	FILE *fd;
+	char *varnames;
+	symtree_t *tree;
+	double start, end;
+	long failed;
+	int rv = 0;
+
+	if ((varnames = malloc(NUM_TESTS * TEST_KEY_LEN)) == NULL) {
+		printf("Failed to malloc test symbol names\n");
+		return 1;
+	}
+	for (int test=0; test<NUM_TESTS; test++) {
+		sprintf(&varnames[test * TEST_KEY_LEN], TEST_KEY_STR, test);
+		varnames[test * TEST_KEY_LEN + TEST_KEY_LEN - 1] = 0;
+	}
+
+	if ((fd = fopen("symtreestresstest.txt", "wb")) == NULL) {
+		printf("Failed to open \"symtreestresstest.txt\"\n");
+		return 1;
+	}
+	for (int threads=1; threads<=MAX_THREADS; threads*=2) {
+		if ((tree = alloc_symtree()) == NULL) {
+			fprintf(fd, "Failed to allocate tree.\n");
+			rv = 1;
+			break;
+		}
+		start = seconds();
+		failed = run_threads(add_thread, tree, varnames, threads);
+		end = seconds();
+		if (failed != 0) {
+			fprintf(fd, "Failed to add %ld symbols with %d threads.\n", failed, threads);
+			rv = 1;
+		}
+		fprintf(fd, "Took %f seconds to add %d symbols to tree with %d threads.\n", end - start, NUM_TESTS, threads);
+		// every key has to have come out exactly once, whichever thread won each race
+		start = seconds();
+		failed = run_threads(find_thread, tree, varnames, threads);
+		end = seconds();
+		if (failed != 0) {
+			fprintf(fd, "Failed to locate %ld symbols with %d threads.\n", failed, threads);
+			rv = 1;
+		}
+		fprintf(fd, "Took %f seconds to locate %d symbols in tree with %d threads.\n", end - start, NUM_TESTS, threads);
+		free_symtree(tree);
+	}
+	fclose(fd);
+	free(varnames);
+	if (rv != 0) {
+		printf("Failed. Results in \"symtreestresstest.txt\".\n");
+	} else {
+		printf("Success. Results in \"symtreestresstest.txt\".\n");
+	}
+	return rv;
+}
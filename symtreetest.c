@@ -11,11 +11,14 @@
 #include <string.h>
 #include <stdbool.h>
 
+#define _SYMTREE_SNAPSHOTS
+#define _SYMTREE_PARALLEL
+#define _SYMTREE_INSTRUMENT
 #include "symtree.h"
 
-const char *str_HelloWorld = "$Hello World!";
-const char *str_HowAreYou = "$How are you?";
-const char *str_IAmWell = "$I am well.";
+char str_HelloWorld[] = "$Hello World!";
+char str_HowAreYou[] = "$How are you?";
+char str_IAmWell[] = "$I am well.";
 
 const char *var_HelloWorld = "HelloWorld";
 const char *var_HowAreYou = "HowAreYou";
@@ -24,6 +27,49 @@ const char *var_NumStrings = "NumStrings";
 
 char buffer[256];
 
+// Count the keys found by find_sym_fuzzy, checking that they are the key expected.
+bool count_fuzzy(void *context, const char *key, size_t keylen, VALUE_TYPE value, unsigned dist) {
+	size_t *count = context;
+	if (strcmp(key, var_HowAreYou) == 0 && dist == 2) {
+		(*count)++;
+	} else {
+		*count += 100;
+	}
+	return true;
+}
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t size;
+} dump_buffer_t;
+
+// Append a chunk of a streamed dump to a buffer, failing if it doesn't fit.
+bool append_dump(void *context, const char *data, size_t len) {
+	dump_buffer_t *dump = context;
+	if (len > dump->size - dump->len) {
+		return false;
+	}
+	memcpy(&dump->data[dump->len], data, len);
+	dump->len += len;
+	return true;
+}
+
+// Count the nodes of a tree, leaving out nodes that are retired but not yet reclaimed.
+size_t live_nodes(symtree_t *tree) {
+#ifdef _SYMTREE_CONCURRENT
+	symtree_reclaim(tree);
+#endif
+	return symtree_counts(tree).nodes;
+}
+
+// Count the lookups passed to the trace hook.
+void count_traced(void *context, symtree_t *tree, unsigned op, const char *name, size_t namelen, bool found, uint64_t nanoseconds) {
+	if (op == SYMTREE_OP_FIND) {
+		(*(size_t*)context)++;
+	}
+}
+
 int main(int argc, char *argv[]) {
 	int rv = 0;
 	FILE *fd, *fd2;
@@ -31,6 +77,7 @@ int main(int argc, char *argv[]) {
 	char *sym;
 	char *allocatedbuffer;
 	symtree_t *tree = alloc_symtree();
+	symtree_t *tree2, *tree3;
 
 	sym = new_sym(tree, var_HelloWorld, 0, str_HelloWorld);
 	if (sym != NULL) {
@@ -53,9 +100,9 @@ int main(int argc, char *argv[]) {
 		rv = 1;
 	}
 
-	if (dump_symtree(tree, &buffer, sizeof(buffer), &bufferlen)) {
+	if (dump_symtree(tree, buffer, sizeof(buffer), &bufferlen)) {
 		if ((fd = fopen("symtreedump1.json", "w"))) {
-			fwrite(&buffer, bufferlen, 1, fd);
+			fwrite(buffer, bufferlen, 1, fd);
 			fclose(fd);
 		}
 	} else if (bufferlen > 0) {
@@ -94,9 +141,9 @@ int main(int argc, char *argv[]) {
 							} else {
 								fprintf(fd, "Set symbol \"%s\" in symtree to \"%s\" successfuly.\n", var_NumStrings, "#4");
 								treesize = symtree_size(tree, false);
-								fprintf(fd, "Symtree size = %u bytes.\n", treesize);
+								fprintf(fd, "Symtree size = %zu bytes.\n", treesize);
 								treesize = symtree_size(tree, true);
-								fprintf(fd, "Symtree size (+values) = %u bytes.\n", treesize);
+								fprintf(fd, "Symtree size (+values) = %zu bytes.\n", treesize);
 								if (del_sym(tree, var_HelloWorld, 0, false)) {
 									fprintf(fd, "Deleted symbol \"%s\" successfuly.\n", var_HelloWorld);
 								} else {
@@ -111,13 +158,13 @@ int main(int argc, char *argv[]) {
 		}
 		
 		treesize = symtree_size(tree, false);
-		fprintf(fd, "Final symtree size = %u bytes.\n", treesize);
+		fprintf(fd, "Final symtree size = %zu bytes.\n", treesize);
 		treesize = symtree_size(tree, true);
-		fprintf(fd, "Final symtree size (+values) = %u bytes.\n", treesize);
+		fprintf(fd, "Final symtree size (+values) = %zu bytes.\n", treesize);
 
-		if (dump_symtree(tree, &buffer, sizeof(buffer), &bufferlen)) {
+		if (dump_symtree(tree, buffer, sizeof(buffer), &bufferlen)) {
 			if ((fd2 = fopen("symtreedump2.json", "w"))) {
-				fwrite(&buffer, bufferlen, 1, fd2);
+				fwrite(buffer, bufferlen, 1, fd2);
 				fclose(fd2);
 			}
 		} else if (bufferlen > 0) {
@@ -126,8 +173,584 @@ int main(int argc, char *argv[]) {
 			printf("Failed to dump symtree!\n");
 		}
 
+		if ((fd2 = fopen("symtreesnapshot.bin", "wb"))) {
+			symtree_snapshot_t snap;
+			bool saved = save_symtree_snapshot(tree, fd2);
+			fclose(fd2);
+			if (saved && open_symtree_snapshot(&snap, "symtreesnapshot.bin")) {
+				if ((sym = find_sym_snapshot(&snap, var_HowAreYou, 0)) != NULL && strcmp(sym, str_HowAreYou) == 0) {
+					fprintf(fd, "Found symbol \"%s\" with value \"%s\" in snapshot.\n", var_HowAreYou, sym);
+				} else {
+					fprintf(fd, "Failed to locate symbol \"%s\" in snapshot.\n", var_HowAreYou);
+					rv = 11;
+				}
+				close_symtree_snapshot(&snap);
+			} else {
+				fprintf(fd, "Failed to save and map snapshot symtreesnapshot.bin.\n");
+				rv = 12;
+			}
+		}
+
+		// corrupt offsets in a snapshot must be refused instead of followed
+		if ((fd2 = fopen("symtreesnapshot.bin", "rb"))) {
+			symtree_snapshot_t snap;
+			uint64_t image[512] = {0};
+			size_t size = fread(image, 1, sizeof(image), fd2), i;
+			fclose(fd2);
+			if (!init_symtree_snapshot(&snap, image, size) || init_symtree_snapshot(&snap, image, size / 2)) {
+				fprintf(fd, "Failed to check the size of snapshot symtreesnapshot.bin.\n");
+				rv = 12;
+			}
+			// point every child and value offset far out of the image
+			for (i=sizeof(symtree_snapshot_header_t); i+sizeof(uint32_t)<=size; i+=sizeof(uint32_t)) {
+				uint32_t offset;
+				memcpy(&offset, (uint8_t*)image + i, sizeof(offset));
+				if (offset > 0 && offset < size / 8) {
+					offset = 0x7FFFFFFF;
+					memcpy((uint8_t*)image + i, &offset, sizeof(offset));
+				}
+			}
+			if (init_symtree_snapshot(&snap, image, size) && find_sym_snapshot(&snap, var_HowAreYou, 0) != NULL) {
+				fprintf(fd, "Followed a corrupt offset in snapshot symtreesnapshot.bin.\n");
+				rv = 12;
+			}
+		}
+
+		{
+			symtree_iter_t it;
+			const char *key;
+			size_t keylen, count = 0;
+			bool found = false;
+			if (symtree_iter_init(&it, tree, "H", 1)) {
+				while (symtree_iter_next(&it, &key, &keylen, &sym)) {
+					found = strcmp(key, var_HowAreYou) == 0 && strcmp(sym, str_HowAreYou) == 0;
+					count++;
+				}
+				symtree_iter_free(&it);
+			}
+			if (found && count == 1) {
+				fprintf(fd, "Iterated over the symbols starting with \"H\" successfuly.\n");
+			} else {
+				fprintf(fd, "Failed to iterate over the symbols starting with \"H\".\n");
+				rv = 15;
+			}
+		}
+
+		{
+			size_t count = 0;
+			if (find_sym_fuzzy(tree, "HowAreYuo", 0, 2, count_fuzzy, &count) && count == 1) {
+				fprintf(fd, "Found symbol \"%s\" by searching for \"%s\" within 2 edits.\n", var_HowAreYou, "HowAreYuo");
+			} else {
+				fprintf(fd, "Failed to locate symbol \"%s\" by searching for \"%s\" within 2 edits.\n", var_HowAreYou, "HowAreYuo");
+				rv = 16;
+			}
+		}
+
+		{
+			symtree_stats_t stats;
+			symtree_counts_t counts;
+#ifdef _SYMTREE_CONCURRENT
+			// retired nodes are counted until they are reclaimed, but symtree_stats only walks the live ones
+			symtree_reclaim(tree);
+#endif
+			counts = symtree_counts(tree);
+			if (symtree_stats(tree, &stats) && stats.counts.nodes == counts.nodes && stats.counts.keys == counts.keys && counts.keys == 3
+				&& stats.counts.nodebytes == counts.nodebytes && stats.counts.valuebytes == counts.valuebytes) {
+				fprintf(fd, "Counted %zu nodes and %zu keys, with %zu nodes having a single subtree.\n", counts.nodes, counts.keys, stats.fanout[1]);
+			} else {
+				fprintf(fd, "Failed to count the nodes and keys of symtree.\n");
+				rv = 17;
+			}
+		}
+
+		{
+			symtree_metrics_t metrics;
+			size_t traced = 0;
+			uint64_t invalid;
+			symtree_metrics(&metrics);
+			invalid = metrics.invalidchars;
+			symtree_metrics_sample_every(1);
+			symtree_add_trace_hook(count_traced, &traced);
+			find_sym(tree, str_HowAreYou, 0);
+			find_sym(tree, var_HowAreYou, 0);
+			symtree_remove_trace_hook(count_traced, &traced);
+			symtree_metrics(&metrics);
+#ifndef _SYMTREE_BINARY_KEYS
+			// the first lookup has characters outside of the alphabet
+			invalid++;
+#endif
+			if (traced == 2 && metrics.invalidchars == invalid && metrics.nodesallocated >= metrics.nodesfreed
+				&& metrics.ops[SYMTREE_OP_FIND] >= 2 && symtree_metrics_percentile(&metrics, SYMTREE_OP_FIND, 50) > 0) {
+				fprintf(fd, "Counted %u lookups visiting %u nodes, and traced the last 2 of them.\n", (unsigned)metrics.ops[SYMTREE_OP_FIND], (unsigned)metrics.nodesvisited);
+			} else {
+				fprintf(fd, "Failed to count and trace lookups.\n");
+				rv = 18;
+			}
+		}
+
+#ifdef _SYMTREE_BINARY_KEYS
+		{
+			const char *path = "/usr/lib/\"caf\xc3\xa9\".so";
+			size_t len;
+			if ((tree2 = alloc_symtree()) != NULL && new_sym(tree2, path, 0, str_HelloWorld) != NULL && new_sym(tree2, "nul\0byte", 8, str_IAmWell) != NULL
+				&& dump_symtree(tree2, buffer, sizeof(buffer), &len)) {
+				free_symtree(tree2);
+				tree2 = load_symtree(buffer, len);
+			}
+			if (tree2 != NULL && (sym = find_sym(tree2, path, 0)) != NULL && strcmp(sym, str_HelloWorld) == 0
+				&& find_sym(tree2, "nul\0byte", 8) != NULL && find_sym(tree2, "nul", 0) == NULL) {
+				fprintf(fd, "Dumped and loaded symbol \"%s\" successfuly.\n", path);
+			} else {
+				fprintf(fd, "Failed to dump and load symbol \"%s\".\n", path);
+				rv = 19;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+
+#endif
+#ifdef _SYMTREE_BURST_CONTAINERS
+		{
+			// enough keys under one prefix to burst its container a few times over
+			const char *chars = "abcdefghijklmnopqrst";
+			// long suffixes are converted in blocks of characters, which must reject a bad one anywhere in them
+			const char *longkey = "BurstLongSuffixOfManyCharacters_0123456789";
+			const char *badkey = "BurstLongSuffixOfManyCharacters_01234567-9";
+			// binary keys have no characters outside of the alphabet
+			bool badvalid = !_SYMTREE_INVALID_CHAR(_PARSE_SYM_NAME_CHAR((uint8_t)'-'));
+			char name[8] = "Burst";
+			const char *key;
+			size_t keylen, count = 0;
+			symtree_iter_t it;
+			symtree_stats_t stats;
+			VALUE_TYPE value;
+			bool sorted = true;
+			if ((tree2 = alloc_symtree()) != NULL) {
+				for (size_t i=0; i<400; i++) {
+					name[5] = chars[i / 20];
+					name[6] = chars[i % 20];
+					new_sym(tree2, name, 0, str_HelloWorld);
+				}
+				if (symtree_iter_init(&it, tree2, "Burstb", 6)) {
+					while (symtree_iter_next(&it, &key, &keylen, &value)) {
+						sorted = sorted && (count == 0 || key[6] == chars[count]);
+						count++;
+					}
+					symtree_iter_free(&it);
+				}
+			}
+			if (tree2 != NULL && sorted && count == 20 && find_sym(tree2, "Burstts", 0) != NULL && find_sym(tree2, "Burstt", 0) == NULL
+				&& del_sym(tree2, "Burstaa", 0, false) && find_sym(tree2, "Burstaa", 0) == NULL && symtree_stats(tree2, &stats)
+				&& stats.counts.keys == 399 && stats.containers > 1 && new_sym(tree2, longkey, 0, str_HelloWorld) != NULL
+				&& (new_sym(tree2, badkey, 0, str_HelloWorld) != NULL) == badvalid && find_sym(tree2, longkey, 0) == str_HelloWorld && (find_sym(tree2, badkey, 0) != NULL) == badvalid) {
+				fprintf(fd, "Burst %u keys into %u containers.\n", (unsigned)stats.counts.keys, (unsigned)stats.containers);
+			} else {
+				fprintf(fd, "Failed to burst containers.\n");
+				rv = 20;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+
+#endif
+#ifdef _SYMTREE_INTERN_VALUES
+		{
+			// many keys sharing a few values keep a single copy of each
+			char name[8] = "Intern";
+			const char *json = "{\"Same\": \"$Hello World!\", \"Other\": \"$Hello World!\", \"Third\": \"How are you?\"}";
+			symtree_counts_t before, after;
+			VALUE_TYPE first;
+			VALUE_TYPE value;
+			bool shared = true;
+			if ((tree2 = alloc_symtree()) != NULL && (first = symtree_intern(tree2, str_HelloWorld, 0)) != NULL) {
+				before = symtree_counts(tree2);
+				for (size_t i=0; i<26; i++) {
+					name[6] = 'a' + i;
+					value = symtree_intern(tree2, str_HelloWorld, strlen(str_HelloWorld));
+					shared = shared && value == first && new_sym(tree2, name, 0, value) != NULL;
+				}
+				after = symtree_counts(tree2);
+				if (shared && after.valuebytes == before.valuebytes && after.keys == 26 && symtree_interned_len(first) == strlen(str_HelloWorld)
+					&& append_symtree(tree2, json, strlen(json)) != NULL && find_sym(tree2, "Same", 0) == first && find_sym(tree2, "Other", 0) == first
+					&& del_sym(tree2, "Internz", 0, true) && strcmp(first, str_HelloWorld) == 0) {
+					fprintf(fd, "Interned %u keys' values into %u bytes.\n", (unsigned)symtree_counts(tree2).keys, (unsigned)symtree_counts(tree2).valuebytes);
+				} else {
+					fprintf(fd, "Failed to intern values.\n");
+					rv = 21;
+				}
+			} else {
+				fprintf(fd, "Failed to intern values.\n");
+				rv = 21;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+
+#endif
+		{
+			// escapes are decoded, and malformed data is reported at the byte where parsing stopped
+			const char *escaped = "{\"Esc\\u0041pe\": \"a\\tb\\\"c\\u00e9\\ud83d\\ude00\"}";
+			const char *badescape = "{\"Key\": \"bad \\q\"}";
+			const char *nocolon = "{\"Key\" \"value\"}";
+			const char *trailing = "{\"Key\": \"value\"} x";
+			size_t error = 0, badescapeat = 0, nocolonat = 0, trailingat = 0;
+			bool parsed = false;
+			if ((tree2 = load_symtree_ex(escaped, strlen(escaped), &error)) != NULL) {
+				parsed = (sym = find_sym(tree2, "EscApe", 0)) != NULL && strcmp(sym, "a\tb\"c\xc3\xa9\xf0\x9f\x98\x80") == 0;
+				free_symtree(tree2);
+			}
+			parsed = parsed && load_symtree_ex(badescape, strlen(badescape), &badescapeat) == NULL
+				&& load_symtree_ex(nocolon, strlen(nocolon), &nocolonat) == NULL
+				&& load_symtree_ex(trailing, strlen(trailing), &trailingat) == NULL;
+			if (parsed && badescapeat == (size_t)(strchr(badescape, '\\') - badescape) && nocolonat == 7 && trailingat == strlen(trailing) - 1
+				&& (tree2 = load_symtree("{} \r\n", 5)) != NULL) {
+				fprintf(fd, "Parsed escapes and reported parse errors at their offsets.\n");
+				free_symtree(tree2);
+			} else {
+				fprintf(fd, "Failed to parse escapes or report parse errors. (offsets %zu, %zu, %zu)\n", badescapeat, nocolonat, trailingat);
+				rv = 22;
+			}
+		}
+
+#ifdef _SYMTREE_PATH_COMPRESSION
+		{
+			// a key's unique tail takes as few nodes as labels allow, and is split when a later key diverges inside a label
+			size_t chain = 1 + (19 + _SYMTREE_MAX_LABEL_LEN) / (_SYMTREE_MAX_LABEL_LEN + 1);
+			if ((tree2 = alloc_symtree()) != NULL && new_sym(tree2, "CompressedLongLabel", 0, str_HelloWorld) != NULL && live_nodes(tree2) == chain
+				&& new_sym(tree2, "CompressedLongLeaf", 0, str_HowAreYou) != NULL && new_sym(tree2, "Compressed", 0, str_IAmWell) != NULL
+				&& live_nodes(tree2) <= chain + 3 && find_sym(tree2, "CompressedLongLabel", 0) == str_HelloWorld
+				&& find_sym(tree2, "CompressedLongLeaf", 0) == str_HowAreYou && find_sym(tree2, "Compressed", 0) == str_IAmWell
+				&& find_sym(tree2, "CompressedLong", 0) == NULL && find_sym(tree2, "CompressedLongLabels", 0) == NULL && find_sym(tree2, "CompressedLongLa", 0) == NULL
+				&& del_sym(tree2, "CompressedLongLeaf", 0, false) && find_sym(tree2, "CompressedLongLabel", 0) == str_HelloWorld) {
+				fprintf(fd, "Stored 3 keys sharing a prefix in %u nodes.\n", (unsigned)live_nodes(tree2));
+			} else {
+				fprintf(fd, "Failed to compress and split key labels.\n");
+				rv = 23;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+
+#endif
+#ifdef _SYMTREE_USE_ARENA
+		{
+			// nodes of deleted keys go on the arena's free lists, so adding the keys again barely grows the arena
+			char name[16];
+			size_t used = 0;
+			bool found = true;
+			if ((tree2 = alloc_symtree()) != NULL) {
+				for (int round=0; round<2; round++) {
+					for (int i=0; i<4096; i++) {
+						sprintf(name, "Arena%X", i);
+						found = found && new_sym(tree2, name, 0, str_HelloWorld) != NULL;
+					}
+					if (round == 0) {
+						used = _SYMTREE_INFO(tree2)->used;
+					}
+					for (int i=0; i<4096; i++) {
+						sprintf(name, "Arena%X", i);
+						found = found && find_sym(tree2, name, 0) == str_HelloWorld && del_sym(tree2, name, 0, false);
+					}
+				}
+			}
+			if (tree2 != NULL && found && _SYMTREE_INFO(tree2)->used <= used + used / 8 && symtree_counts(tree2).keys == 0) {
+				fprintf(fd, "Reused %zu bytes of arena after deleting every key.\n", used);
+			} else {
+				fprintf(fd, "Failed to reuse arena memory.\n");
+				rv = 24;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+
+#endif
+#ifdef _SYMTREE_USE_PAGED_NODES
+		{
+			// far more nodes than 16-bit offsets reach within one page, linked across pages through escapes
+			char name[16];
+			size_t pages = 0;
+			bool found = true;
+			if ((tree2 = alloc_symtree()) != NULL) {
+				for (int i=0; i<65536; i++) {
+					sprintf(name, "Paged%X", i * 7919);
+					found = found && new_sym(tree2, name, 0, str_HowAreYou) != NULL;
+				}
+				for (int i=0; i<65536; i++) {
+					sprintf(name, "Paged%X", i * 7919);
+					found = found && find_sym(tree2, name, 0) == str_HowAreYou;
+				}
+				pages = _SYMTREE_INFO(tree2)->used / _SYMTREE_PAGE_SIZE;
+			}
+			if (tree2 != NULL && found && pages > 1 && symtree_counts(tree2).keys == 65536 && del_sym(tree2, "Paged0", 0, false) && find_sym(tree2, "Paged1EEF", 0) == str_HowAreYou) {
+				fprintf(fd, "Stored 65536 keys across %zu pages with 16-bit offsets.\n", pages);
+			} else {
+				fprintf(fd, "Failed to store keys across pages with 16-bit offsets.\n");
+				rv = 25;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+
+#endif
+		{
+			// deleting every key prunes the tree back to its root, as does compacting after setting every key to NULL
+			char name[16];
+			size_t nodes = 0, freed = 0;
+			bool found = true;
+			if ((tree2 = alloc_symtree()) != NULL) {
+				nodes = symtree_counts(tree2).nodes;
+				for (int i=0; i<256; i++) {
+					sprintf(name, "Prune%X", i * 31);
+					found = found && new_sym(tree2, name, 0, str_HelloWorld) != NULL;
+				}
+				found = found && symtree_counts(tree2).nodes > nodes;
+				for (int i=0; i<256; i++) {
+					sprintf(name, "Prune%X", i * 31);
+					found = found && del_sym(tree2, name, 0, false);
+				}
+				found = found && live_nodes(tree2) == nodes;
+				for (int i=0; i<256; i++) {
+					sprintf(name, "Prune%X", i * 31);
+					found = found && new_sym(tree2, name, 0, str_HelloWorld) != NULL;
+				}
+				for (int i=0; i<256; i++) {
+					sprintf(name, "Prune%X", i * 31);
+					set_sym(tree2, name, 0, NULL);
+				}
+				freed = symtree_compact(tree2);
+			}
+			if (tree2 != NULL && found && freed > 0 && live_nodes(tree2) == nodes && find_sym(tree2, "Prune0", 0) == NULL) {
+				fprintf(fd, "Pruned deleted keys and compacted %zu dead nodes.\n", freed);
+			} else {
+				fprintf(fd, "Failed to prune deleted keys.\n");
+				rv = 26;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+		{
+			// fixed width hexadecimal numbers keep the keys sharing a prefix together, then a duplicate and an out of order key follow them
+			char names[514][16];
+			const char *keys[514];
+			VALUE_TYPE values[514];
+			bool found = true;
+			for (int i=0; i<512; i++) {
+				sprintf(names[i], "Sorted%03X", i);
+				keys[i] = names[i];
+				values[i] = str_HelloWorld;
+			}
+			keys[512] = "Sorted1FF";
+			values[512] = str_IAmWell;
+			keys[513] = "Aaa";
+			values[513] = str_HowAreYou;
+			if ((tree2 = symtree_build_sorted(keys, NULL, values, 514)) != NULL) {
+				for (int i=0; i<511; i++) {
+					found = found && find_sym(tree2, names[i], 0) == str_HelloWorld;
+				}
+			}
+			if (tree2 != NULL && found && symtree_counts(tree2).keys == 513 && find_sym(tree2, "Sorted1FF", 0) == str_IAmWell
+				&& find_sym(tree2, "Aaa", 0) == str_HowAreYou && find_sym(tree2, "Sorted", 0) == NULL) {
+				fprintf(fd, "Built symtree of %zu keys from sorted keys.\n", symtree_counts(tree2).keys);
+			} else {
+				fprintf(fd, "Failed to build symtree from sorted keys.\n");
+				rv = 27;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+		{
+			// more keys than the batch keeps in flight, mixing hits with misses, prefixes of keys, invalid and empty keys
+			char names[100][16];
+			const char *keys[100];
+			size_t lens[100];
+			VALUE_TYPE values[100];
+			size_t count = 0;
+			bool found = true;
+			if ((tree2 = alloc_symtree()) != NULL) {
+				for (int i=0; i<100; i++) {
+					sprintf(names[i], "Batch%X", i);
+					keys[i] = names[i];
+					lens[i] = 0;
+					if (i % 4 == 0) {
+						found = found && new_sym(tree2, names[i], 0, str_HowAreYou) != NULL;
+					}
+				}
+				keys[1] = "";
+				keys[2] = "Batch";
+				keys[3] = "Batch-3";
+				lens[4] = 5;
+				count = find_sym_batch(tree2, keys, lens, values, 100);
+				for (int i=0; i<100; i++) {
+					found = found && values[i] == (i % 4 == 0 && i != 4 ? str_HowAreYou : NULL);
+				}
+			}
+			if (tree2 != NULL && found && count == 24 && find_sym_batch(tree2, keys, NULL, values, 1) == 1 && values[0] == str_HowAreYou) {
+				fprintf(fd, "Found %zu of 100 symbols in a batch.\n", count);
+			} else {
+				fprintf(fd, "Failed to find symbols in a batch.\n");
+				rv = 28;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+		{
+			// a dump many chunks long, streamed to memory and to a file, has to be exactly as long as measured and load back the same keys
+			char name[16];
+			dump_buffer_t dump = {NULL, 0, 0};
+			FILE *tmp;
+			long filelen = -1;
+			bool found = true;
+			tree3 = NULL;
+			if ((tree2 = alloc_symtree()) != NULL) {
+				for (int i=0; i<2048; i++) {
+					sprintf(name, "Stream%X", i);
+					found = found && new_sym(tree2, name, 0, i % 2 ? str_IAmWell : str_HowAreYou) != NULL;
+				}
+				dump.size = dump_symtree_size(tree2);
+				if ((tmp = tmpfile()) != NULL) {
+					if (dump_symtree_file(tree2, tmp)) {
+						filelen = ftell(tmp);
+					}
+					fclose(tmp);
+				}
+				if (dump.size > _SYMTREE_DUMP_CHUNK_SIZE && (dump.data = malloc(dump.size)) != NULL && dump_symtree_stream(tree2, append_dump, &dump)) {
+					tree3 = load_symtree(dump.data, dump.len);
+				}
+			}
+			if (tree3 != NULL) {
+				for (int i=0; i<2048; i++) {
+					sprintf(name, "Stream%X", i);
+					found = found && (sym = find_sym(tree3, name, 0)) != NULL && strcmp(sym, i % 2 ? str_IAmWell : str_HowAreYou) == 0;
+				}
+			}
+			if (tree3 != NULL && found && dump.len == dump.size && filelen == (long)dump.size && symtree_counts(tree3).keys == 2048) {
+				fprintf(fd, "Streamed a dump of %zu bytes and loaded it back.\n", dump.len);
+			} else {
+				fprintf(fd, "Failed to stream a dump and load it back.\n");
+				rv = 29;
+			}
+			if (tree3 != NULL) {
+				free_symtree(tree3);
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+			free(dump.data);
+		}
+		{
+			// keys long enough for whole blocks of 32 and 16 characters and a few more, converted as they would be one character at a time
+			const char *chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz_";
+			// characters just outside of each range of the default alphabet
+			const char *bad = "/:@[^`{\x7f\x80\xff";
+			char key[70];
+			uint8_t numbers[70];
+			bool parsed = true;
+			unsigned c;
+			for (size_t len=1; len<=sizeof(key); len++) {
+				for (size_t i=0; i<len; i++) {
+					key[i] = chars[(i * 7 + len) % 63];
+				}
+				parsed = parsed && _symtree_parse_key(numbers, key, len);
+				for (size_t i=0; i<len; i++) {
+					parsed = parsed && numbers[i] == _PARSE_SYM_NAME_CHAR((uint8_t)key[i]);
+				}
+				for (size_t i=0; bad[i]; i++) {
+					key[(len * 5 + i) % len] = bad[i];
+					c = _PARSE_SYM_NAME_CHAR((uint8_t)bad[i]);
+					parsed = parsed && _symtree_parse_key(numbers, key, len) == !_SYMTREE_INVALID_CHAR(c) && _symtree_valid_key(key, len) == !_SYMTREE_INVALID_CHAR(c);
+					key[(len * 5 + i) % len] = chars[((len * 5 + i) % len * 7 + len) % 63];
+				}
+			}
+			if (parsed) {
+				fprintf(fd, "Converted keys of up to %zu characters to key numbers.\n", sizeof(key));
+			} else {
+				fprintf(fd, "Failed to convert keys to key numbers.\n");
+				rv = 30;
+			}
+		}
+
+#ifdef _SYMTREE_WEIGHTS
+		{
+			// the heaviest keys under the prefix come first, and keys that are deleted or set to NULL drop out for the next heaviest
+			const char *names[] = {"Weight", "WeightA", "WeightB", "WeightC", "WeightD", "WeightE", "Weighty", "Other"};
+			uint32_t weights[] = {5, 10, 50, 30, 40, 20, 1, 100};
+			const char *expected[3][3] = {{"WeightB", "WeightD", "WeightC"}, {"WeightD", "WeightC", "WeightE"}, {"WeightC", "WeightE", "WeightA"}};
+			uint32_t expectedweights[3][3] = {{50, 40, 30}, {40, 30, 20}, {30, 20, 10}};
+			symtree_completion_t *completions;
+			size_t count;
+			bool found = true;
+			if ((tree2 = alloc_symtree()) != NULL) {
+				for (int i=0; i<8; i++) {
+					found = found && new_sym_weighted(tree2, names[i], 0, str_HelloWorld, weights[i]) == str_HelloWorld;
+				}
+				for (int round=0; round<3; round++) {
+					if (round == 1) {
+						found = found && del_sym(tree2, "WeightB", 0, false);
+					} else if (round == 2) {
+						set_sym(tree2, "WeightD", 0, NULL);
+					}
+					if ((completions = symtree_complete_topk(tree2, "Weight", 6, 3, &count)) == NULL) {
+						found = false;
+						break;
+					}
+					found = found && count == 3;
+					for (size_t i=0; i<count && i<3; i++) {
+						found = found && strcmp(completions[i].key, expected[round][i]) == 0 && completions[i].keylen == strlen(expected[round][i])
+							&& completions[i].weight == expectedweights[round][i] && completions[i].value == str_HelloWorld;
+					}
+					free(completions);
+				}
+			}
+			if (tree2 != NULL && found) {
+				fprintf(fd, "Completed the heaviest keys of a prefix as they changed.\n");
+			} else {
+				fprintf(fd, "Failed to complete the heaviest keys of a prefix.\n");
+				rv = 31;
+			}
+			if (tree2 != NULL) {
+				free_symtree(tree2);
+			}
+		}
+
+#endif
+		// changes to either tree must stay out of the other, even while they share nodes with copy-on-write clones
+		if ((tree2 = clone_symtree(tree)) != NULL && set_sym(tree2, var_HowAreYou, 0, str_IAmWell) != NULL
+			&& (sym = find_sym(tree, var_HowAreYou, 0)) != NULL && strcmp(sym, str_HowAreYou) == 0
+			&& del_sym(tree2, var_IAmWell, 0, false) && find_sym(tree2, var_IAmWell, 0) == NULL && find_sym(tree, var_IAmWell, 0) != NULL
+			&& new_sym(tree, "Unshared", 0, str_IAmWell) != NULL && find_sym(tree2, "Unshared", 0) == NULL) {
+			fprintf(fd, "Cloned symtree and changed symbol \"%s\" in the clone only.\n", var_HowAreYou);
+		} else {
+			fprintf(fd, "Failed to clone symtree.\n");
+			rv = 14;
+		}
+		// free a clone before the tree it was cloned from, then the tree before another clone of it
+		tree3 = clone_symtree(tree);
+		if (tree2 != NULL) {
+			free_symtree(tree2);
+		}
+
 		free_symtree(tree);
 
+		if (tree3 != NULL && (sym = find_sym(tree3, var_HowAreYou, 0)) != NULL && strcmp(sym, str_HowAreYou) == 0
+			&& find_sym(tree3, "Unshared", 0) == str_IAmWell && new_sym(tree3, var_HelloWorld, 0, str_IAmWell) != NULL) {
+			fprintf(fd, "Freed symtree and its clones in either order.\n");
+		} else {
+			fprintf(fd, "Failed to keep a clone after freeing its symtree.\n");
+			rv = 14;
+		}
+		if (tree3 != NULL) {
+			free_symtree(tree3);
+		}
+
 		if ((fd2 = fopen("symtreedump1.json", "r"))) {
 			size_t len;
 			fseek(fd2, 0, 2);
@@ -139,12 +762,21 @@ int main(int argc, char *argv[]) {
 			fclose(fd2);
 			if (allocatedbuffer != NULL) {
 				tree = load_symtree(allocatedbuffer, len);
+				if ((tree2 = load_symtree_parallel(allocatedbuffer, len, 2, NULL)) != NULL && (sym = find_sym(tree2, var_IAmWell, 0)) != NULL && strcmp(sym, str_IAmWell) == 0) {
+					fprintf(fd, "Loaded symbols from symtreedump1.json on 2 threads successfuly.\n");
+				} else {
+					fprintf(fd, "Failed to load symbols from symtreedump1.json on 2 threads.\n");
+					rv = 13;
+				}
+				if (tree2 != NULL) {
+					free_symtree(tree2);
+				}
 				free(allocatedbuffer);
 				treesize = symtree_size(tree, true);
-				fprintf(fd, "Successfuly loaded symbols from symtreedump1.json, totalling %u bytes.\n", treesize);
-				if (dump_symtree(tree, &buffer, sizeof(buffer), &bufferlen)) {
+				fprintf(fd, "Successfuly loaded symbols from symtreedump1.json, totalling %zu bytes.\n", treesize);
+				if (dump_symtree(tree, buffer, sizeof(buffer), &bufferlen)) {
 					if ((fd2 = fopen("symtreedump3.json", "w"))) {
-						fwrite(&buffer, bufferlen, 1, fd2);
+						fwrite(buffer, bufferlen, 1, fd2);
 						fclose(fd2);
 					}
 				} else if (bufferlen > 0) {
@@ -0,0 +1,97 @@
+
+/**
+ * symtreetest.cpp
+ * Author:       Adam "beckadamtheinventor" Beckingham
+ * Description:  Fast string:value dictionary structure C++ test file.
+ * License:      GPL3
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "symtree.h"
+#include "symtree.hpp"
+
+int main(int argc, char *argv[]) {
+	int rv = 0;
+
+	{
+		// the C interface still works from C++
+		char value[] = "$Hello World!";
+		symtree_t *tree = alloc_symtree();
+		if (tree == NULL || new_sym(tree, "HelloWorld", 0, value) == NULL || find_sym(tree, "HelloWorld", 0) == NULL) {
+			rv = 1;
+		}
+		if (tree != NULL) {
+			free_symtree(tree);
+		}
+	}
+
+	{
+		symtree<> tree;
+		std::string *value;
+		if (tree.insert("HelloWorld", "$Hello World!") == nullptr || tree.insert("HowAreYou", "$How are you?") == nullptr
+			|| tree.insert("bad key", "") != nullptr || tree.size() != 2) {
+			rv = 2;
+		} else if ((value = tree.find("HowAreYou")) == nullptr || *value != "$How are you?" || tree.find("How") != nullptr) {
+			rv = 3;
+		} else if (tree.set("HowAreYou", "$I am well.") == nullptr || tree.set("IAmWell", "") != nullptr || *tree.find("HowAreYou") != "$I am well.") {
+			rv = 4;
+		} else if (!tree.erase("HelloWorld") || tree.erase("HelloWorld") || tree.contains("HelloWorld") || tree.node_count() != 10) {
+			rv = 5;
+		}
+	}
+
+	{
+		// several alphabets and value types in the same program
+		symtree<symtree_lowercase_alphabet, std::unique_ptr<int>> lower;
+		symtree<symtree_dictionary_alphabet, int> dictionary;
+		std::string keys;
+		if (lower.emplace("abc", std::make_unique<int>(1)) == nullptr || lower.emplace("ab", new int(2)) == nullptr
+			|| lower.emplace("ABC", std::make_unique<int>(3)) != nullptr || **lower.find("ab") != 2) {
+			rv = 6;
+		}
+		dictionary.insert("Ice Cream", 1);
+		dictionary.insert("ice-box", 2);
+		dictionary.insert("ICE", 3);
+		dictionary.for_each([&](std::string_view key, int &value) {
+			keys.append(key);
+			keys.push_back(';');
+		}, "ice");
+		if (dictionary.size() != 3 || dictionary.find("ice cream") == nullptr || keys != "ICE;ICE CREAM;ICE-BOX;") {
+			rv = 7;
+		}
+		auto moved = std::move(lower);
+		if (lower.size() != 0 || lower.find("abc") != nullptr || moved.size() != 2 || **moved.find("abc") != 1) {
+			rv = 8;
+		}
+	}
+
+	{
+		// node indices run out, without anything being added
+		symtree<symtree_lowercase_alphabet, int, uint8_t> small;
+		std::string key(255, 'a');
+		size_t count = 0;
+		if (small.insert(key, 1) == nullptr || small.insert(key + "a", 2) != nullptr || small.node_count() != 256 || small.size() != 1) {
+			rv = 9;
+		} else if (!small.erase(key) || small.node_count() != 1 || small.insert("z" + key.substr(1), 3) == nullptr || small.node_count() != 256) {
+			rv = 10;
+		}
+		auto copy = small;
+		copy.insert("z", 4);
+		copy.for_each([&](std::string_view key, const int &value) {
+			count++;
+			return false;
+		});
+		if (copy.size() != 2 || small.size() != 1 || small.find("z") != nullptr || count != 1) {
+			rv = 11;
+		}
+	}
+
+	if (rv != 0) {
+		printf("Failed C++ test %d.\n", rv);
+	}
+	return rv;
+}
@@ -6,6 +6,7 @@
 #include <time.h>
 
 #define _SYMTREE_USE_INT32_OFFSETS
+#define _SYMTREE_WEIGHTS
 // #define _SYMTREE_BLOCK_SIZE 8
 
 #define _PARSE_SYM_NAME_CHAR(c) ((c)=='-' ? 27 : ((c)==' ' ? 26 : ((unsigned)(c)-'A'<26 ? (c)-'A' : ((unsigned)(c)-'a'<26 ? (c)-'a' : -1))))
@@ -13,6 +14,14 @@
 #define _SYMTREE_NUM_CHARS 28
 #include "../symtree.h"
 
+// Print each word found by find_sym_fuzzy.
+bool print_fuzzy(void *context, const char *key, size_t keylen, char *value, unsigned dist) {
+	if (context != NULL) {
+		printf("%s (%u)\n", key, dist);
+	}
+	return true;
+}
+
 int main(int argc, char **argv) {
 	uint8_t buffer;
 	symtree_t *tree;
@@ -53,20 +62,38 @@ int main(int argc, char **argv) {
 	treesize = symtree_size(tree, true) / 1024;
 	printf("Successfuly added json to tree, totalling %u kb. (%f gb)\n", treesize, (double)treesize/(1024*1024.0f));
 
-	if ((fd = fopen("dictionarydump.json", "wb")) != NULL) {
-		#define BUFFER_LEN (24*1024*1024)
-		size_t buffer_len = 0;
-		uint8_t *buffer = malloc(BUFFER_LEN);
-		if (buffer == NULL) {
-			printf("Insufficient memory to malloc dump buffer!\n");
-			return 1;
+	{
+		// rank completions by the length of their definitions
+		symtree_iter_t it;
+		const char *key;
+		size_t keylen, numwords = 0, maxwords = 0;
+		char **words = NULL, **newwords;
+		if (symtree_iter_init(&it, tree, NULL, 0)) {
+			while (symtree_iter_next(&it, &key, &keylen, &sym)) {
+				if (numwords == maxwords) {
+					maxwords = maxwords < 1024 ? 1024 : maxwords * 2;
+					if ((newwords = realloc(words, maxwords * sizeof(char*))) == NULL) {
+						break;
+					}
+					words = newwords;
+				}
+				words[numwords++] = strdup(key);
+			}
+			symtree_iter_free(&it);
 		}
-		if (!dump_symtree(tree, buffer, BUFFER_LEN, &buffer_len)) {
-			printf("Failed to dump symtree! Buffer length is insufficient to dump.\n");
+		for (size_t i=0; i<numwords; i++) {
+			sym = find_sym(tree, words[i], 0);
+			new_sym_weighted(tree, words[i], 0, sym, strlen(sym));
+			free(words[i]);
+		}
+		free(words);
+	}
+
+	if ((fd = fopen("dictionarydump.json", "wb")) != NULL) {
+		if (!dump_symtree_file(tree, fd)) {
+			printf("Failed to dump symtree!\n");
 		}
-		fwrite(buffer, buffer_len, 1, fd);
 		fclose(fd);
-		#undef BUFFER_LEN
 	}
 	
 	{
@@ -81,6 +108,36 @@ int main(int argc, char **argv) {
 				while (ptr = strchr(&inputstr, '_')) {
 					*ptr = ' ';
 				}
+				if ((ptr = strchr(inputstr, '*')) != NULL) {
+					// complete a prefix with the words having the longest definitions
+					symtree_completion_t *completions;
+					size_t count;
+					start = clock();
+					for (int n=0; n<9999; n++) {
+						free(symtree_complete_topk(tree, inputstr, ptr - inputstr, 10, &count));
+					}
+					completions = symtree_complete_topk(tree, inputstr, ptr - inputstr, 10, &count);
+					dt = (1000.0f * (clock()-start)) / (float)CLOCKS_PER_SEC;
+					printf("\n");
+					for (size_t i=0; i<count; i++) {
+						printf("%s (%u)\n", completions[i].key, completions[i].weight);
+					}
+					free(completions);
+					printf("Took %f ms per ten thousand top-10 completions.\n", dt);
+					continue;
+				}
+				if ((ptr = strchr(inputstr, '~')) != NULL) {
+					// find the words within 2 edits of the input
+					start = clock();
+					for (int n=0; n<999; n++) {
+						find_sym_fuzzy(tree, inputstr, ptr - inputstr, 2, print_fuzzy, NULL);
+					}
+					dt = (1000.0f * (clock()-start)) / (float)CLOCKS_PER_SEC;
+					printf("\n");
+					find_sym_fuzzy(tree, inputstr, ptr - inputstr, 2, print_fuzzy, inputstr);
+					printf("Took %f ms per thousand searches within 2 edits.\n", dt);
+					continue;
+				}
 				start = clock();
 				for (int n=0; n<9999999; n++) {
 					find_sym(tree, inputstr, 0);